@@ -2,14 +2,18 @@
 
 #include "cosmo/AbsGaussianRandomFieldGenerator.h"
 #include "cosmo/RuntimeError.h"
+#include "cosmo/GridFileWriter.h"
 
 #include "likely/Random.h"
 
+#include <vector>
+
 namespace local = cosmo;
 
 local::AbsGaussianRandomFieldGenerator::AbsGaussianRandomFieldGenerator(
 PowerSpectrumPtr powerSpectrum, double spacing, int nx, int ny, int nz, likely::RandomPtr random)
-: _powerSpectrum(powerSpectrum), _spacing(spacing), _nx(nx), _ny(ny), _nz(nz), _random(random)
+: _powerSpectrum(powerSpectrum), _spacing(spacing), _nx(nx), _ny(ny), _nz(nz), _random(random),
+_fieldData(0), _fieldZStride(0), _fieldStep(1)
 {
     if(spacing <= 0) {
         throw RuntimeError("AbsGaussianRandomFieldGenerator: invalid spacing <= 0.");
@@ -41,6 +45,40 @@ double local::AbsGaussianRandomFieldGenerator::getField(int x, int y, int z) con
     return _getFieldUnchecked(x,y,z);
 }
 
+local::GaussianRandomFieldView local::AbsGaussianRandomFieldGenerator::getFieldView() const {
+    if(0 == _fieldData) {
+        throw RuntimeError("AbsGaussianRandomFieldGenerator::getFieldView: no field data available.");
+    }
+    GaussianRandomFieldView view;
+    view.data = _fieldData;
+    view.nx = _nx;
+    view.ny = _ny;
+    view.nz = _nz;
+    view.zstride = _fieldZStride;
+    view.step = _fieldStep;
+    return view;
+}
+
+void local::AbsGaussianRandomFieldGenerator::setFieldView(float const *data, std::size_t zstride,
+std::size_t step) {
+    _fieldData = data;
+    _fieldZStride = zstride;
+    _fieldStep = step;
+}
+
+void local::AbsGaussianRandomFieldGenerator::saveField(std::string const &filename, boost::uint64_t seed) const {
+    GridFileWriter writer(filename,_nx,_ny,_nz,_nz,_spacing,GridFileHeader::Float32,seed,
+        hashPowerSpectrum(_powerSpectrum,_spacing,_nx,_ny,_nz));
+    std::vector<float> row(_nz);
+    for(int x = 0; x < _nx; ++x) {
+        for(int y = 0; y < _ny; ++y) {
+            for(int z = 0; z < _nz; ++z) row[z] = (float)_getFieldUnchecked(x,y,z);
+            writer.write(&row[0],_nz);
+        }
+    }
+    writer.close();
+}
+
 std::size_t local::AbsGaussianRandomFieldGenerator::getMemorySize() const {
     return 0;
 }
@@ -6,9 +6,24 @@
 #include "cosmo/types.h"
 #include "likely/types.h"
 
+#include "boost/cstdint.hpp"
+
+#include <string>
 #include <cstddef>
 
 namespace cosmo {
+    // A read-only view of the float values of a generated field. The value at (x,y,z)
+    // is data[step*z + zstride*(y + ny*x)], so that each (x,y) row of nz values starts
+    // zstride floats after the previous one and has consecutive values step floats apart.
+    struct GaussianRandomFieldView {
+        float const *data;
+        int nx,ny,nz;
+        std::size_t zstride, step;
+        // Returns a pointer to the first value of the (x,y) row.
+        float const *getRow(int x, int y) const;
+        // Returns the value at (x,y,z) without any range checks.
+        float operator()(int x, int y, int z) const;
+    };
     // Represents an abstract generator of 3D Gaussian random fields as realizations of
     // a 3D isotropic power spectrum on a uniform rectangular grid.
 	class AbsGaussianRandomFieldGenerator {
@@ -31,17 +46,40 @@ namespace cosmo {
         // Returns the most recent generated value at the specified grid point. Throws
         // a RuntimeError for invalid (x,y,z).
         double getField(int x, int y, int z) const;
+        // Returns a view of the most recent generated values for fast bulk access, without
+        // any per-voxel range checks or virtual calls. The view remains valid until the
+        // next call to generate(). Throws a RuntimeError if no field has been generated yet
+        // or if this generator does not provide direct access to its values.
+        GaussianRandomFieldView getFieldView() const;
+        // Calls visitor(x,y,z,value) for each grid point of the most recent generated field,
+        // with z varying fastest. Returns the visitor, which is passed by value.
+        template <class Visitor> Visitor forEachVoxel(Visitor visitor) const;
+        // Calls op(result,value) for each value of the most recent generated field, starting
+        // from the specified initial result, and returns the final result.
+        template <class T, class Op> T reduce(T result, Op op) const;
+        // Saves the most recent generated values to the named binary grid file (see
+        // GridFileHeader), recording the specified random seed and a hash of our power
+        // spectrum. The default implementation writes an unpadded float grid.
+        virtual void saveField(std::string const &filename, boost::uint64_t seed = 0) const;
         // Returns the memory size in bytes required for this generator or zero if this
         // information is not available.
         virtual std::size_t getMemorySize() const;
     protected:
         likely::RandomPtr getRandom();
         double getPower(double k) const;
+        PowerSpectrumPtr getPowerSpectrum() const;
+        // Subclasses call this to describe where their generated values are stored, in
+        // the units of GaussianRandomFieldView.
+        void setFieldView(float const *data, std::size_t zstride, std::size_t step = 1);
+        // Returns true if a subclass has described its generated values with setFieldView().
+        bool hasFieldView() const;
 	private:
         PowerSpectrumPtr _powerSpectrum;
         double _spacing;
         int _nx,_ny,_nz;
         likely::RandomPtr _random;
+        float const *_fieldData;
+        std::size_t _fieldZStride, _fieldStep;
         // The getField method calls this virtual method after checking that data is
         // available and that (x,y,z) are valid values.
         virtual double _getFieldUnchecked(int x, int y, int z) const = 0;
@@ -54,6 +92,40 @@ namespace cosmo {
     inline int AbsGaussianRandomFieldGenerator::getNz() const { return _nz; }
 
     inline likely::RandomPtr AbsGaussianRandomFieldGenerator::getRandom() { return _random; }
+    inline PowerSpectrumPtr AbsGaussianRandomFieldGenerator::getPowerSpectrum() const { return _powerSpectrum; }
+    inline bool AbsGaussianRandomFieldGenerator::hasFieldView() const { return 0 != _fieldData; }
+
+    inline float const *GaussianRandomFieldView::getRow(int x, int y) const {
+        return data + zstride*(y + (std::size_t)ny*x);
+    }
+    inline float GaussianRandomFieldView::operator()(int x, int y, int z) const {
+        return getRow(x,y)[step*z];
+    }
+
+    template <class Visitor>
+    Visitor AbsGaussianRandomFieldGenerator::forEachVoxel(Visitor visitor) const {
+        GaussianRandomFieldView view(getFieldView());
+        for(int x = 0; x < view.nx; ++x) {
+            for(int y = 0; y < view.ny; ++y) {
+                float const *row(view.getRow(x,y));
+                for(int z = 0; z < view.nz; ++z) visitor(x,y,z,row[view.step*z]);
+            }
+        }
+        return visitor;
+    }
+
+    template <class T, class Op>
+    T AbsGaussianRandomFieldGenerator::reduce(T result, Op op) const {
+        GaussianRandomFieldView view(getFieldView());
+        std::size_t step(view.step);
+        for(int x = 0; x < view.nx; ++x) {
+            for(int y = 0; y < view.ny; ++y) {
+                float const *row(view.getRow(x,y));
+                for(int z = 0; z < view.nz; ++z) op(result,row[step*z]);
+            }
+        }
+        return result;
+    }
 	
 } // cosmo
 
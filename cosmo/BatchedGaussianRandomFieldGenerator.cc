@@ -0,0 +1,209 @@
+// Created 18-Oct-2026
+
+#include "cosmo/BatchedGaussianRandomFieldGenerator.h"
+#include "cosmo/RuntimeError.h"
+#include "cosmo/PhiloxRandom.h"
+#include "cosmo/WallClock.h"
+#include "cosmo/GaussianRandomFieldSigmaTable.h"
+
+#include "likely/Random.h"
+
+#include "config.h"
+#ifdef HAVE_LIBFFTW3F
+#include "fftw3.h"
+#define FFTW(X) fftwf_ ## X // float transforms
+typedef float FftwReal;
+#endif
+
+#include <algorithm>
+
+namespace local = cosmo;
+
+namespace cosmo {
+    struct BatchedGaussianRandomFieldGenerator::Implementation {
+#ifdef HAVE_LIBFFTW3F
+        FFTW(complex) *data;
+        FFTW(plan) plan;
+#endif
+    };
+} // cosmo::
+
+local::BatchedGaussianRandomFieldGenerator::BatchedGaussianRandomFieldGenerator(
+PowerSpectrumPtr powerSpectrum, double spacing, int nx, int ny, int nz, int batchSize,
+likely::RandomPtr random)
+: AbsGaussianRandomFieldGenerator(powerSpectrum,spacing,nx,ny,nz,random),
+_halfz(nz/2+1), _batchSize(batchSize), _next(batchSize), _pimpl(new Implementation()),
+_realization(0), _nthreads(1), _strategy(FftGaussianRandomFieldGenerator::EstimatePlan),
+_randomTime(0), _scaleTime(0), _fftTime(0)
+{
+#ifdef HAVE_LIBFFTW3F
+    _pimpl->data = 0;
+    _pimpl->plan = 0;
+#else
+    throw RuntimeError("BatchedGaussianRandomFieldGenerator: package not built with FFTW3.");
+#endif
+    if(batchSize <= 0) {
+        throw RuntimeError("BatchedGaussianRandomFieldGenerator: invalid batch size <= 0.");
+    }
+    // Calculate the number of complex values needed in k space for each field.
+    _nbuf = (std::size_t)getNx()*getNy()*_halfz;
+}
+
+local::BatchedGaussianRandomFieldGenerator::~BatchedGaussianRandomFieldGenerator() {
+#ifdef HAVE_LIBFFTW3F
+    if(0 != _pimpl->data) {
+        if(0 != _pimpl->plan) FFTW(destroy_plan)(_pimpl->plan);
+        FFTW(free)(_pimpl->data);
+    }
+#endif
+}
+
+void local::BatchedGaussianRandomFieldGenerator::_initialize() {
+#ifdef HAVE_LIBFFTW3F
+    // Allocate one aligned buffer for the whole batch, with the fields stored contiguously.
+    _pimpl->data = (FFTW(complex)*)FFTW(malloc)(sizeof(FFTW(complex))*_nbuf*_batchSize);
+    if(0 == _pimpl->data) {
+        throw RuntimeError("BatchedGaussianRandomFieldGenerator: unable to allocate batch buffer.");
+    }
+    // Touch each slab first from the thread that will later fill and scale it.
+    float *buffer = (float*)_pimpl->data;
+    long nslabs((long)getNx()*_batchSize), nyz(2*(long)getNy()*_halfz);
+#pragma omp parallel for schedule(static) num_threads(_nthreads)
+    for(long slab = 0; slab < nslabs; ++slab) {
+        std::fill(buffer + nyz*slab, buffer + nyz*(slab+1), 0.f);
+    }
+    _sigmaTable.reset(new GaussianRandomFieldSigmaTable(getPowerSpectrum(),getSpacing(),getNx(),getNy(),getNz()));
+    double start(getWallTime());
+    // Create a single in-place plan for the whole batch. Each complex field has dimensions
+    // (nx,ny,nz/2+1) and each real field is padded to (nx,ny,2*(nz/2+1)).
+    int flags = (_strategy == FftGaussianRandomFieldGenerator::PatientPlan) ? FFTW_PATIENT :
+        (_strategy == FftGaussianRandomFieldGenerator::MeasurePlan) ? FFTW_MEASURE : FFTW_ESTIMATE;
+#ifdef HAVE_LIBFFTW3F_THREADS
+    FFTW(plan_with_nthreads)(_nthreads);
+#endif
+    int dims[3] = { getNx(), getNy(), getNz() };
+    int inembed[3] = { getNx(), getNy(), _halfz };
+    int outembed[3] = { getNx(), getNy(), 2*_halfz };
+    _pimpl->plan = FFTW(plan_many_dft_c2r)(3,dims,_batchSize,
+        _pimpl->data,inembed,1,(int)_nbuf,buffer,outembed,1,(int)(2*_nbuf),flags);
+    if(0 == _pimpl->plan) {
+        throw RuntimeError("BatchedGaussianRandomFieldGenerator: unable to create batch plan.");
+    }
+    _fftTime += getWallTime() - start;
+#endif
+}
+
+void local::BatchedGaussianRandomFieldGenerator::generateBatch() {
+#ifdef HAVE_LIBFFTW3F
+    if(0 == _pimpl->data) _initialize();
+    // Generate random (real,imag) components for the whole batch.
+    double start(getWallTime());
+    if(_counterRandom) {
+        _fillCounterNormal();
+    }
+    else {
+        getRandom()->fillArrayNormal((float*)_pimpl->data,2*_nbuf*_batchSize);
+    }
+    _randomTime += getWallTime() - start;
+    // Scale each complex value according to the power for the corresponding k-vector.
+    start = getWallTime();
+    int nx = getNx(), ny = getNy();
+    int nxby2 = nx/2, nyby2 = ny/2;
+    GaussianRandomFieldSigmaTable const &table(*_sigmaTable);
+    FFTW(complex) *data = _pimpl->data;
+    long nslabs((long)nx*_batchSize);
+    // Each thread scales a contiguous range of x slabs, across field boundaries.
+#pragma omp parallel for schedule(static) num_threads(_nthreads)
+    for(long slab = 0; slab < nslabs; ++slab) {
+        int ix = (int)(slab % nx);
+        int jx = (ix > nxby2 ? ix-nx : ix);
+        std::size_t index(_halfz*(std::size_t)ny*slab);
+        for(int iy = 0; iy < ny; ++iy) {
+            int jy = (iy > nyby2 ? iy-ny : iy);
+            for(int iz = 0; iz < _halfz; ++iz, ++index) {
+                double sigma = table.getSigma(jx,jy,iz);
+                data[index][0] *= sigma;
+                data[index][1] *= sigma;
+            }
+        }
+    }
+    _scaleTime += getWallTime() - start;
+    // Transform the whole batch to r space.
+    start = getWallTime();
+    FFTW(execute)(_pimpl->plan);
+    _fftTime += getWallTime() - start;
+    _next = 0;
+#endif
+}
+
+void local::BatchedGaussianRandomFieldGenerator::generate() {
+    if(_next == _batchSize) generateBatch();
+#ifdef HAVE_LIBFFTW3F
+    float const *field = (float const*)(_pimpl->data + _nbuf*_next);
+    setFieldView(field,2*_halfz);
+#endif
+    ++_next;
+}
+
+void local::BatchedGaussianRandomFieldGenerator::_fillCounterNormal() {
+    // Field b of this batch uses realization _realization+b, and its modes use the same
+    // counters as FftGaussianRandomFieldGenerator so that the two generators agree.
+    PhiloxRandom const &random(*_counterRandom);
+    boost::uint64_t realization(_realization);
+    _realization += _batchSize;
+    float *buffer = (float*)_pimpl->data;
+    long nx(getNx()), nslabs(nx*_batchSize), nyz((long)getNy()*_halfz);
+#pragma omp parallel for schedule(static) num_threads(_nthreads)
+    for(long slab = 0; slab < nslabs; ++slab) {
+        boost::uint64_t fieldRealization(realization + slab/nx);
+        std::size_t mode(nyz*(slab % nx)), index(nyz*slab);
+        for(long iyz = 0; iyz < nyz; ++iyz, ++mode, ++index) {
+            double g1,g2;
+            random.getNormalPair(mode,fieldRealization,g1,g2);
+            buffer[2*index] = (float)g1;
+            buffer[2*index+1] = (float)g2;
+        }
+    }
+}
+
+void local::BatchedGaussianRandomFieldGenerator::setCounterSeed(boost::uint64_t seed, boost::uint64_t realization) {
+    _counterRandom.reset(new PhiloxRandom(seed));
+    _realization = realization;
+}
+
+void local::BatchedGaussianRandomFieldGenerator::setNumThreads(int nthreads) {
+    if(nthreads <= 0) {
+        throw RuntimeError("BatchedGaussianRandomFieldGenerator::setNumThreads: expected nthreads > 0.");
+    }
+#ifdef HAVE_LIBFFTW3F
+    if(0 != _pimpl->plan) {
+        throw RuntimeError("BatchedGaussianRandomFieldGenerator::setNumThreads: plan already created.");
+    }
+#endif
+    FftGaussianRandomFieldGenerator::initializeThreads();
+    _nthreads = nthreads;
+}
+
+void local::BatchedGaussianRandomFieldGenerator::setPlanStrategy(FftGaussianRandomFieldGenerator::Strategy strategy) {
+#ifdef HAVE_LIBFFTW3F
+    if(0 != _pimpl->plan) {
+        throw RuntimeError("BatchedGaussianRandomFieldGenerator::setPlanStrategy: plan already created.");
+    }
+#endif
+    _strategy = strategy;
+}
+
+void local::BatchedGaussianRandomFieldGenerator::getTimings(double &randomTime, double &scaleTime, double &fftTime) const {
+    randomTime = _randomTime;
+    scaleTime = _scaleTime;
+    fftTime = _fftTime;
+}
+
+double local::BatchedGaussianRandomFieldGenerator::_getFieldUnchecked(int x, int y, int z) const {
+    return getFieldView()(x,y,z);
+}
+
+std::size_t local::BatchedGaussianRandomFieldGenerator::getMemorySize() const {
+    return sizeof(*this) + (std::size_t)getNx()*getNy()*_halfz*8*_batchSize +
+        (_sigmaTable ? _sigmaTable->getMemorySize() : 0);
+}
@@ -0,0 +1,76 @@
+// Created 18-Oct-2026
+
+#ifndef COSMO_BATCHED_GAUSSIAN_RANDOM_FIELD_GENERATOR
+#define COSMO_BATCHED_GAUSSIAN_RANDOM_FIELD_GENERATOR
+
+#include "cosmo/AbsGaussianRandomFieldGenerator.h"
+#include "cosmo/FftGaussianRandomFieldGenerator.h"
+
+#include "boost/smart_ptr.hpp"
+#include "boost/cstdint.hpp"
+
+namespace cosmo {
+    class GaussianRandomFieldSigmaTable;
+    // Generates many independent realizations of a small grid in batches, using a single
+    // FFTW plan that transforms a whole batch of contiguous fields at once. Each call to
+    // generate() hands out the next field of the current batch and only generates a new
+    // batch when the current one is used up, so this is a drop-in replacement for
+    // FftGaussianRandomFieldGenerator in loops over many fields.
+	class BatchedGaussianRandomFieldGenerator : public AbsGaussianRandomFieldGenerator {
+	public:
+	    // Creates a new generator for batches of the specified number of fields.
+		BatchedGaussianRandomFieldGenerator(PowerSpectrumPtr powerSpectrum, double spacing,
+		    int nx, int ny, int nz, int batchSize, likely::RandomPtr random = likely::RandomPtr());
+		virtual ~BatchedGaussianRandomFieldGenerator();
+        // Makes the next field of the current batch available via getField() and
+        // getFieldView(), first calling generateBatch() if necessary.
+        virtual void generate();
+        // Generates a new batch of r-space realizations, discarding any fields of the
+        // current batch that have not been handed out yet.
+        void generateBatch();
+        // Returns the number of fields in each batch.
+        int getBatchSize() const;
+        // Returns the number of fields of the current batch that have not been handed out.
+        int getRemaining() const;
+        // Returns the memory size in bytes required for this generator.
+        virtual std::size_t getMemorySize() const;
+        // Uses a counter-based random source keyed by the specified seed, with consecutive
+        // realization numbers for consecutive fields. Each field is then identical to the
+        // corresponding realization of FftGaussianRandomFieldGenerator::setCounterSeed.
+        void setCounterSeed(boost::uint64_t seed, boost::uint64_t realization = 0);
+        // Sets the number of threads used to generate each batch. The default is 1.
+        // Must be called before the first call to generate() or generateBatch().
+        void setNumThreads(int nthreads);
+        int getNumThreads() const;
+        // Selects the FFTW planning strategy. Must be called before the first call to
+        // generate() or generateBatch().
+        void setPlanStrategy(FftGaussianRandomFieldGenerator::Strategy strategy);
+        // Returns the total wall-clock times in seconds spent generating random numbers,
+        // scaling them by the power spectrum, and planning and executing FFTs.
+        // The one-time buffer allocation and power spectrum tabulation are not included.
+        void getTimings(double &randomTime, double &scaleTime, double &fftTime) const;
+	private:
+        class Implementation;
+        int _halfz, _batchSize, _next;
+        std::size_t _nbuf;
+        boost::scoped_ptr<Implementation> _pimpl;
+        PhiloxRandomPtr _counterRandom;
+        boost::uint64_t _realization;
+        int _nthreads;
+        FftGaussianRandomFieldGenerator::Strategy _strategy;
+        boost::scoped_ptr<GaussianRandomFieldSigmaTable> _sigmaTable;
+        double _randomTime, _scaleTime, _fftTime;
+        // Allocates our batch buffer, tabulates sigma(|k|) and creates our plan.
+        void _initialize();
+        // Fills our batch buffer with unit Gaussians from our counter-based random source.
+        void _fillCounterNormal();
+        // The getField method calls this after checking for invalid (x,y,z).
+        virtual double _getFieldUnchecked(int x, int y, int z) const;
+	}; // BatchedGaussianRandomFieldGenerator
+
+    inline int BatchedGaussianRandomFieldGenerator::getBatchSize() const { return _batchSize; }
+    inline int BatchedGaussianRandomFieldGenerator::getRemaining() const { return _batchSize - _next; }
+    inline int BatchedGaussianRandomFieldGenerator::getNumThreads() const { return _nthreads; }
+} // cosmo
+
+#endif // COSMO_BATCHED_GAUSSIAN_RANDOM_FIELD_GENERATOR
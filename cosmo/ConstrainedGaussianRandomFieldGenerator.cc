@@ -0,0 +1,352 @@
+// Created 18-Oct-2026
+
+#include "cosmo/ConstrainedGaussianRandomFieldGenerator.h"
+#include "cosmo/GaussianRandomFieldSigmaTable.h"
+#include "cosmo/RuntimeError.h"
+
+#include "boost/math/special_functions/erf.hpp"
+
+#include "config.h"
+#ifdef HAVE_LIBFFTW3F
+#include "fftw3.h"
+#define FFTW(X) fftwf_ ## X // float transforms
+#endif
+
+#include <cmath>
+#include <algorithm>
+
+namespace local = cosmo;
+
+namespace cosmo {
+    struct ConstrainedGaussianRandomFieldGenerator::Implementation {
+#ifdef HAVE_LIBFFTW3F
+        // The grid correlation function, stored with the padded z stride 2*(nz/2+1).
+        FFTW(complex) *xi;
+#endif
+    };
+} // cosmo::
+
+namespace {
+    // Returns the BBKS (Bardeen et al 1986, eqn A15) density f(x) of the scaled curvature
+    // x = -laplacian(delta)/sigma2 at peaks, before weighting by the value distribution.
+    double peakCurvatureDensity(double x) {
+        double a(std::sqrt(2.5)*x), xsq(x*x), pi(4*std::atan(1));
+        return (x*xsq - 3*x)/2*(boost::math::erf(a) + boost::math::erf(a/2)) +
+            std::sqrt(2/(5*pi))*((31*xsq/4 + 1.6)*std::exp(-5*xsq/8) + (xsq/2 - 1.6)*std::exp(-5*xsq/2));
+    }
+} // anonymous
+
+local::ConstrainedGaussianRandomFieldGenerator::ConstrainedGaussianRandomFieldGenerator(
+PowerSpectrumPtr powerSpectrum, double spacing, int nx, int ny, int nz, likely::RandomPtr random)
+: FftGaussianRandomFieldGenerator(powerSpectrum,spacing,nx,ny,nz,random),
+_pimpl(new Implementation()), _halfz(nz/2+1)
+{
+#ifdef HAVE_LIBFFTW3F
+    _pimpl->xi = 0;
+#endif
+    _center[0] = nx/2;
+    _center[1] = ny/2;
+    _center[2] = nz/2;
+}
+
+local::ConstrainedGaussianRandomFieldGenerator::~ConstrainedGaussianRandomFieldGenerator() {
+#ifdef HAVE_LIBFFTW3F
+    if(0 != _pimpl->xi) FFTW(free)(_pimpl->xi);
+#endif
+}
+
+void local::ConstrainedGaussianRandomFieldGenerator::setCenter(int x, int y, int z) {
+    if(x < 0 || x >= getNx() || y < 0 || y >= getNy() || z < 0 || z >= getNz()) {
+        throw RuntimeError("ConstrainedGaussianRandomFieldGenerator::setCenter: invalid grid point.");
+    }
+    _center[0] = x;
+    _center[1] = y;
+    _center[2] = z;
+}
+
+void local::ConstrainedGaussianRandomFieldGenerator::constrainValue(double value) {
+    Constraint constraint;
+    constraint.kind = 0;
+    constraint.value = value;
+    constraint.addTerm(0,0,0,1);
+    _addConstraint(constraint);
+}
+
+void local::ConstrainedGaussianRandomFieldGenerator::constrainGradient(double gx, double gy, double gz) {
+    double values[3] = { gx, gy, gz };
+    double w(1/(2*getSpacing()));
+    for(int axis = 0; axis < 3; ++axis) {
+        int e[3] = { 0, 0, 0 };
+        e[axis] = 1;
+        Constraint constraint;
+        constraint.kind = 1 + axis;
+        constraint.value = values[axis];
+        constraint.addTerm(+e[0],+e[1],+e[2],+w);
+        constraint.addTerm(-e[0],-e[1],-e[2],-w);
+        _addConstraint(constraint);
+    }
+}
+
+void local::ConstrainedGaussianRandomFieldGenerator::constrainCurvature(
+double hxx, double hyy, double hzz, double hxy, double hxz, double hyz) {
+    double values[6] = { hxx, hyy, hzz, hxy, hxz, hyz };
+    int axis1[6] = { 0, 1, 2, 0, 0, 1 }, axis2[6] = { 0, 1, 2, 1, 2, 2 };
+    double h2(getSpacing()*getSpacing());
+    for(int index = 0; index < 6; ++index) {
+        int a[3] = { 0, 0, 0 }, b[3] = { 0, 0, 0 };
+        a[axis1[index]] = 1;
+        b[axis2[index]] = 1;
+        Constraint constraint;
+        constraint.kind = 4 + index;
+        constraint.value = values[index];
+        if(index < 3) {
+            constraint.addTerm(+a[0],+a[1],+a[2],1/h2);
+            constraint.addTerm(0,0,0,-2/h2);
+            constraint.addTerm(-a[0],-a[1],-a[2],1/h2);
+        }
+        else {
+            double w(1/(4*h2));
+            constraint.addTerm(+a[0]+b[0],+a[1]+b[1],+a[2]+b[2],+w);
+            constraint.addTerm(+a[0]-b[0],+a[1]-b[1],+a[2]-b[2],-w);
+            constraint.addTerm(-a[0]+b[0],-a[1]+b[1],-a[2]+b[2],-w);
+            constraint.addTerm(-a[0]-b[0],-a[1]-b[1],-a[2]-b[2],+w);
+        }
+        _addConstraint(constraint);
+    }
+}
+
+void local::ConstrainedGaussianRandomFieldGenerator::constrainPeak(double nu) {
+    double sigma0(getSigma()), h2(getSpacing()*getSpacing());
+    // Calculate sigma1^2 = <|grad delta|^2> and sigma2^2 = <(laplacian delta)^2> for the
+    // same central finite differences used by our gradient and curvature constraints.
+    double sigma1sq(0), sigma2sq(0);
+    for(int a = 0; a < 3; ++a) {
+        int ea[3] = { 0, 0, 0 };
+        ea[a] = 1;
+        sigma1sq += (_getCorrelation(0,0,0) - _getCorrelation(2*ea[0],2*ea[1],2*ea[2]))/(2*h2);
+        for(int b = 0; b < 3; ++b) {
+            int eb[3] = { 0, 0, 0 };
+            eb[b] = 1;
+            // <D_a D_b> for the second differences D_a = delta(+a) - 2 delta(0) + delta(-a).
+            double sum(0);
+            for(int p = -1; p <= 1; ++p) {
+                for(int q = -1; q <= 1; ++q) {
+                    sum += (p ? 1 : -2)*(q ? 1 : -2)*
+                        _getCorrelation(p*ea[0]-q*eb[0],p*ea[1]-q*eb[1],p*ea[2]-q*eb[2]);
+                }
+            }
+            sigma2sq += sum/(h2*h2);
+        }
+    }
+    double sigma2(std::sqrt(sigma2sq)), gamma(sigma1sq/(sigma0*sigma2));
+    if(!(gamma > 0 && gamma < 1)) {
+        throw RuntimeError("ConstrainedGaussianRandomFieldGenerator::constrainPeak: invalid grid spectral moments.");
+    }
+    // Average x over the BBKS distribution of peak curvatures at height |nu|, which is
+    // f(x) exp(-(x - gamma |nu|)^2/(2(1 - gamma^2))) for x > 0, using Simpson's rule.
+    double xstar(gamma*std::fabs(nu)), width(std::sqrt(1 - gamma*gamma));
+    double xmax(std::max(xstar,0.) + 10*width + 5);
+    int nsteps(2000);
+    double dx(xmax/nsteps), sum0(0), sum1(0);
+    for(int i = 0; i <= nsteps; ++i) {
+        double x(i*dx), t((x - xstar)/width);
+        double w((0 == i || nsteps == i) ? 1 : (i % 2 ? 4 : 2));
+        double density(w*peakCurvatureDensity(x)*std::exp(-t*t/2));
+        sum0 += density;
+        sum1 += density*x;
+    }
+    double xmean(sum1/sum0);
+    // The mean Hessian of a maximum with laplacian -xmean*sigma2 is isotropic.
+    double sign(nu < 0 ? -1 : +1), hdiag(-sign*xmean*sigma2/3);
+    constrainValue(nu*sigma0);
+    constrainGradient(0,0,0);
+    constrainCurvature(hdiag,hdiag,hdiag,0,0,0);
+}
+
+void local::ConstrainedGaussianRandomFieldGenerator::_addConstraint(Constraint const &constraint) {
+    for(std::vector<Constraint>::iterator iter = _constraints.begin(); iter != _constraints.end(); ++iter) {
+        if(iter->kind == constraint.kind) {
+            *iter = constraint;
+            _cholesky.clear();
+            return;
+        }
+    }
+    _constraints.push_back(constraint);
+    _cholesky.clear();
+}
+
+void local::ConstrainedGaussianRandomFieldGenerator::clearConstraints() {
+    _constraints.clear();
+    _cholesky.clear();
+}
+
+void local::ConstrainedGaussianRandomFieldGenerator::_tabulateCorrelation() {
+#ifdef HAVE_LIBFFTW3F
+    int nx(getNx()), ny(getNy()), nz(getNz()), halfz(_halfz);
+    std::size_t nbuf((std::size_t)nx*ny*halfz);
+    _pimpl->xi = (FFTW(complex)*)FFTW(malloc)(sizeof(FFTW(complex))*nbuf);
+    if(0 == _pimpl->xi) {
+        throw RuntimeError("ConstrainedGaussianRandomFieldGenerator: unable to allocate correlation buffer.");
+    }
+#ifdef HAVE_LIBFFTW3F_THREADS
+    FFTW(plan_with_nthreads)(getNumThreads());
+#endif
+    FFTW(plan) plan = FFTW(plan_dft_c2r_3d)(nx,ny,nz,_pimpl->xi,(float*)_pimpl->xi,FFTW_ESTIMATE);
+    if(0 == plan) {
+        throw RuntimeError("ConstrainedGaussianRandomFieldGenerator: unable to create FFT plan.");
+    }
+    // The real and imaginary parts of each generated mode have variance sigma^2, so the
+    // inverse FFT of 2 sigma^2 gives <delta(x) delta(0)>. The c2r transform only keeps
+    // the Hermitian part of the independently drawn kz = 0 and Nyquist planes, which
+    // halves their variance to sigma^2.
+    GaussianRandomFieldSigmaTable table(getPowerSpectrum(),getSpacing(),nx,ny,nz);
+    int nxby2(nx/2), nyby2(ny/2);
+    FFTW(complex) *xi = _pimpl->xi;
+#pragma omp parallel for schedule(static) num_threads(getNumThreads())
+    for(int ix = 0; ix < nx; ++ix) {
+        int jx = (ix > nxby2 ? ix-nx : ix);
+        for(int iy = 0; iy < ny; ++iy) {
+            int jy = (iy > nyby2 ? iy-ny : iy);
+            std::size_t index(halfz*(iy+(std::size_t)ny*ix));
+            for(int iz = 0; iz < halfz; ++iz, ++index) {
+                double sigma = table.getSigma(jx,jy,iz);
+                bool hermitian(0 == iz || 2*iz == nz);
+                xi[index][0] = (float)((hermitian ? 1 : 2)*sigma*sigma);
+                xi[index][1] = 0;
+            }
+        }
+    }
+    FFTW(execute)(plan);
+    FFTW(destroy_plan)(plan);
+#endif
+}
+
+double local::ConstrainedGaussianRandomFieldGenerator::_getCorrelation(int dx, int dy, int dz) const {
+#ifdef HAVE_LIBFFTW3F
+    int nx(getNx()), ny(getNy()), nz(getNz());
+    dx = ((dx % nx) + nx) % nx;
+    dy = ((dy % ny) + ny) % ny;
+    dz = ((dz % nz) + nz) % nz;
+    return ((float const*)_pimpl->xi)[dz + 2*_halfz*(dy + (std::size_t)ny*dx)];
+#else
+    return 0;
+#endif
+}
+
+double local::ConstrainedGaussianRandomFieldGenerator::getSigma() {
+#ifdef HAVE_LIBFFTW3F
+    if(0 == _pimpl->xi) _tabulateCorrelation();
+#endif
+    return std::sqrt(_getCorrelation(0,0,0));
+}
+
+void local::ConstrainedGaussianRandomFieldGenerator::_factorize() {
+    // Calculate M_ij = <C_i C_j> = sum_pq w_ip w_jq xi(p - q).
+    int n(getNumConstraints());
+    _cholesky.assign(n*n,0);
+    for(int i = 0; i < n; ++i) {
+        Constraint const &ci(_constraints[i]);
+        for(int j = 0; j <= i; ++j) {
+            Constraint const &cj(_constraints[j]);
+            double sum(0);
+            for(std::size_t p = 0; p < ci.weight.size(); ++p) {
+                for(std::size_t q = 0; q < cj.weight.size(); ++q) {
+                    sum += ci.weight[p]*cj.weight[q]*
+                        _getCorrelation(ci.dx[p]-cj.dx[q],ci.dy[p]-cj.dy[q],ci.dz[p]-cj.dz[q]);
+                }
+            }
+            _cholesky[i*n+j] = sum;
+        }
+    }
+    // Replace the lower triangle of M with its Cholesky factor L, where M = L L^T.
+    for(int j = 0; j < n; ++j) {
+        double diag(_cholesky[j*n+j]);
+        for(int k = 0; k < j; ++k) diag -= _cholesky[j*n+k]*_cholesky[j*n+k];
+        if(!(diag > 0)) {
+            _cholesky.clear();
+            throw RuntimeError("ConstrainedGaussianRandomFieldGenerator: constraints are degenerate on this grid.");
+        }
+        diag = std::sqrt(diag);
+        _cholesky[j*n+j] = diag;
+        for(int i = j+1; i < n; ++i) {
+            double sum(_cholesky[i*n+j]);
+            for(int k = 0; k < j; ++k) sum -= _cholesky[i*n+k]*_cholesky[j*n+k];
+            _cholesky[i*n+j] = sum/diag;
+        }
+    }
+}
+
+void local::ConstrainedGaussianRandomFieldGenerator::generate() {
+    FftGaussianRandomFieldGenerator::generate();
+    int n(getNumConstraints());
+    if(0 == n) return;
+#ifdef HAVE_LIBFFTW3F
+    if(0 == _pimpl->xi) _tabulateCorrelation();
+#endif
+    if(_cholesky.empty()) _factorize();
+    int nx(getNx()), ny(getNy()), nz(getNz());
+    std::size_t zstride(2*_halfz);
+    float *field = getFieldBuffer();
+    // Calculate the residuals c_j - C_j[delta] of the unconstrained realization.
+    std::vector<double> coef(n);
+    for(int j = 0; j < n; ++j) {
+        Constraint const &cj(_constraints[j]);
+        double measured(0);
+        for(std::size_t p = 0; p < cj.weight.size(); ++p) {
+            int x = (_center[0] + cj.dx[p] + nx) % nx;
+            int y = (_center[1] + cj.dy[p] + ny) % ny;
+            int z = (_center[2] + cj.dz[p] + nz) % nz;
+            measured += cj.weight[p]*field[z + zstride*(y + (std::size_t)ny*x)];
+        }
+        coef[j] = cj.value - measured;
+    }
+    // Solve M a = c - C[delta] using our Cholesky factor.
+    for(int i = 0; i < n; ++i) {
+        for(int k = 0; k < i; ++k) coef[i] -= _cholesky[i*n+k]*coef[k];
+        coef[i] /= _cholesky[i*n+i];
+    }
+    for(int i = n-1; i >= 0; --i) {
+        for(int k = i+1; k < n; ++k) coef[i] -= _cholesky[k*n+i]*coef[k];
+        coef[i] /= _cholesky[i*n+i];
+    }
+    // The correction sum_j a_j sum_p w_jp xi(x - center - p) only involves the offsets p
+    // of a 3x3x3 stencil, so combine the weights of each offset first.
+    double stencil[27];
+    std::fill(stencil,stencil+27,0.);
+    for(int j = 0; j < n; ++j) {
+        Constraint const &cj(_constraints[j]);
+        for(std::size_t p = 0; p < cj.weight.size(); ++p) {
+            stencil[(cj.dz[p]+1) + 3*((cj.dy[p]+1) + 3*(cj.dx[p]+1))] += coef[j]*cj.weight[p];
+        }
+    }
+#ifdef HAVE_LIBFFTW3F
+    float const *xi = (float const*)_pimpl->xi;
+#pragma omp parallel for schedule(static) num_threads(getNumThreads())
+    for(int ix = 0; ix < nx; ++ix) {
+        for(int s = 0; s < 27; ++s) {
+            if(0 == stencil[s]) continue;
+            float w = (float)stencil[s];
+            int sx = (_center[0] + s/9 - 1 + nx) % nx;
+            int sy = (_center[1] + (s/3)%3 - 1 + ny) % ny;
+            int sz = (_center[2] + s%3 - 1 + nz) % nz;
+            int xx = (ix - sx + nx) % nx;
+            for(int iy = 0; iy < ny; ++iy) {
+                int yy = (iy - sy + ny) % ny;
+                float *row = field + zstride*(iy + (std::size_t)ny*ix);
+                float const *xiRow = xi + zstride*(yy + (std::size_t)ny*xx);
+                // Add w*xi(z - sz) with z - sz wrapped into [0,nz).
+                for(int iz = 0; iz < sz; ++iz) row[iz] += w*xiRow[iz - sz + nz];
+                for(int iz = sz; iz < nz; ++iz) row[iz] += w*xiRow[iz - sz];
+            }
+        }
+    }
+#endif
+}
+
+std::size_t local::ConstrainedGaussianRandomFieldGenerator::getMemorySize() const {
+    std::size_t size(FftGaussianRandomFieldGenerator::getMemorySize());
+#ifdef HAVE_LIBFFTW3F
+    if(0 != _pimpl->xi) size += (std::size_t)getNx()*getNy()*_halfz*8;
+#endif
+    return size;
+}
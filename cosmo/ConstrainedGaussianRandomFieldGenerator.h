@@ -0,0 +1,92 @@
+// Created 18-Oct-2026
+
+#ifndef COSMO_CONSTRAINED_GAUSSIAN_RANDOM_FIELD_GENERATOR
+#define COSMO_CONSTRAINED_GAUSSIAN_RANDOM_FIELD_GENERATOR
+
+#include "cosmo/FftGaussianRandomFieldGenerator.h"
+
+#include "boost/smart_ptr.hpp"
+
+#include <vector>
+#include <cstddef>
+
+namespace cosmo {
+    // Generates constrained realizations of a Gaussian random field, whose value and
+    // optionally gradient and curvature at a grid point take specified values, using the
+    // Hoffman-Ribak method: each unconstrained realization delta is corrected by
+    // delta_c(x) = delta(x) + sum_ij xi_i(x) M^-1_ij (c_j - C_j[delta]), where C_j are linear
+    // constraints with target values c_j, xi_i(x) = <delta(x) C_i> and M_ij = <C_i C_j>.
+    // These are all combinations of the grid correlation function xi, which is tabulated once
+    // as the inverse FFT of the k-space variance used by FftGaussianRandomFieldGenerator.
+    // Gradients and curvatures are central finite differences on the grid, so the constraints
+    // are satisfied exactly (to float precision) by every realization.
+	class ConstrainedGaussianRandomFieldGenerator : public FftGaussianRandomFieldGenerator {
+	public:
+	    // Creates a new generator whose constraints apply at the box center (nx/2,ny/2,nz/2).
+	    // No constraints are imposed until one of the constrain methods is called.
+		ConstrainedGaussianRandomFieldGenerator(PowerSpectrumPtr powerSpectrum, double spacing,
+		    int nx, int ny, int nz, likely::RandomPtr random = likely::RandomPtr());
+		virtual ~ConstrainedGaussianRandomFieldGenerator();
+        // Generates a new unconstrained realization and applies our constraints to it.
+        virtual void generate();
+        // Sets or gets the grid point where our constraints apply.
+        void setCenter(int x, int y, int z);
+        void getCenter(int &x, int &y, int &z) const;
+        // Constrains the field value at the center.
+        void constrainValue(double value);
+        // Constrains the field gradient at the center, in units of field per Mpc/h.
+        void constrainGradient(double gx, double gy, double gz);
+        // Constrains the field second derivatives at the center, in units of field per (Mpc/h)^2.
+        void constrainCurvature(double hxx, double hyy, double hzz, double hxy, double hxz, double hyz);
+        // Constrains the center to be a maximum (nu > 0) or minimum (nu < 0) of height
+        // nu*sigma with zero gradient and the mean peak Hessian for this height: isotropic,
+        // with the laplacian set to the mean BBKS peak curvature calculated from the grid
+        // spectral moments. This replaces any previous value, gradient or curvature constraint.
+        void constrainPeak(double nu);
+        // Removes all constraints.
+        void clearConstraints();
+        int getNumConstraints() const;
+        // Returns the unconstrained field RMS, sqrt(xi(0)), tabulating xi if necessary.
+        double getSigma();
+        // Returns the memory size in bytes required for this generator.
+        virtual std::size_t getMemorySize() const;
+	private:
+        class Implementation;
+        boost::scoped_ptr<Implementation> _pimpl;
+        int _halfz, _center[3];
+        // Each constraint is a weighted sum of field values at offsets from the center. A new
+        // constraint replaces any previous one of the same kind.
+        struct Constraint {
+            int kind;
+            std::vector<int> dx, dy, dz;
+            std::vector<double> weight;
+            double value;
+            void addTerm(int x, int y, int z, double w) {
+                dx.push_back(x);
+                dy.push_back(y);
+                dz.push_back(z);
+                weight.push_back(w);
+            }
+        };
+        std::vector<Constraint> _constraints;
+        // The Cholesky factor of M, calculated when first needed after any change to our
+        // constraints (or empty).
+        std::vector<double> _cholesky;
+        void _addConstraint(Constraint const &constraint);
+        void _tabulateCorrelation();
+        double _getCorrelation(int dx, int dy, int dz) const;
+        void _factorize();
+	}; // ConstrainedGaussianRandomFieldGenerator
+
+	inline void ConstrainedGaussianRandomFieldGenerator::getCenter(int &x, int &y, int &z) const {
+	    x = _center[0];
+	    y = _center[1];
+	    z = _center[2];
+	}
+	inline int ConstrainedGaussianRandomFieldGenerator::getNumConstraints() const {
+	    return (int)_constraints.size();
+	}
+
+} // cosmo
+
+#endif // COSMO_CONSTRAINED_GAUSSIAN_RANDOM_FIELD_GENERATOR
@@ -2,17 +2,21 @@
 
 #include "cosmo/DistortedPowerCorrelationFft.h"
 #include "cosmo/RuntimeError.h"
+#include "cosmo/TransferFunctionPowerSpectrum.h"
+#include "cosmo/GridFileWriter.h"
 
 #include "likely/BiCubicInterpolator.h"
 
 #include <cmath>
 #include <algorithm>
+#include <string>
 #include <iostream>
 
 #include "config.h"
-#ifdef HAVE_LIBFFTW3F
+#if defined(HAVE_LIBFFTW3F) || defined(HAVE_LIBFFTW3)
 #include "fftw3.h"
 #define FFTW(X) fftwf_ ## X // prefix identifier (float transform)
+#define FFTWD(X) fftw_ ## X // prefix identifier (double transform)
 #endif
 
 namespace local = cosmo;
@@ -22,13 +26,19 @@ namespace cosmo {
 #ifdef HAVE_LIBFFTW3F
         FFTW(complex) *data;
         FFTW(plan) plan;
+#endif
+#ifdef HAVE_LIBFFTW3
+        FFTWD(complex) *ddata;
+        FFTWD(plan) dplan;
 #endif
     };
 }
 
 local::DistortedPowerCorrelationFft::DistortedPowerCorrelationFft(likely::GenericFunctionPtr power,
-KMuPkFunctionCPtr distortion, KMuPkFunctionCPtr imdistortion, bool imagpart, double spacing, int nx, int ny, int nz)
-: _power(power), _distortion(distortion), _imdistortion(imdistortion), _imagpart(imagpart), _spacing(spacing), _nx(nx), _ny(ny), _nz(nz), _pimpl(new Implementation())
+KMuPkFunctionCPtr distortion, KMuPkFunctionCPtr imdistortion, bool imagpart, double spacing, int nx, int ny, int nz,
+bool doublePrecision)
+: _power(power), _distortion(distortion), _imdistortion(imdistortion), _imagpart(imagpart), _spacing(spacing), _nx(nx), _ny(ny), _nz(nz), _pimpl(new Implementation()),
+_nkTable(0), _nmuTable(0), _doublePrecision(doublePrecision)
 {	
 	// Input parameter validation.
 	if(spacing <= 0 ) {
@@ -37,12 +47,30 @@ KMuPkFunctionCPtr distortion, KMuPkFunctionCPtr imdistortion, bool imagpart, dou
 	if(nx <= 0 || ny <= 0 || nz <= 0) {
 		throw RuntimeError("DistortedPowerCorrelationFft: invalid grid size");
 	}
+	// Allocate the data array with the requested precision.
+	std::size_t ngrid = (std::size_t)nx*ny*nz;
+	if(doublePrecision) {
+#ifdef HAVE_LIBFFTW3
+		_pimpl->ddata = (FFTWD(complex)*) FFTWD(malloc)(sizeof(FFTWD(complex)) * ngrid);
+		_pimpl->dplan = 0;
+#else
+		throw RuntimeError("DistortedPowerCorrelationFft: package not built with double-precision FFTW3.");
+#endif
 #ifdef HAVE_LIBFFTW3F
-	// Allocate data array.
-	_pimpl->data = (FFTW(complex)*) FFTW(malloc)(sizeof(FFTW(complex)) * nx*ny*nz);
+		_pimpl->data = 0;
+#endif
+	}
+	else {
+#ifdef HAVE_LIBFFTW3F
+		_pimpl->data = (FFTW(complex)*) FFTW(malloc)(sizeof(FFTW(complex)) * ngrid);
+		_pimpl->plan = 0;
 #else
-    throw RuntimeError("DistortedPowerCorrelationFft: package not built with FFTW3.");
+		throw RuntimeError("DistortedPowerCorrelationFft: package not built with FFTW3.");
 #endif
+#ifdef HAVE_LIBFFTW3
+		_pimpl->ddata = 0;
+#endif
+	}
 	double twopi(8*std::atan(1));
     // Initialize the k space grid that will be used for evaluating the power spectrum.
     // Note that the grid is centered on (0,0,0) and grid points wrap around in a specific order.
@@ -62,19 +90,39 @@ KMuPkFunctionCPtr distortion, KMuPkFunctionCPtr imdistortion, bool imagpart, dou
         double kz = (iz > nz/2 ? iz-nz : iz)*dkz;
         _kzgrid.push_back(kz);
     }
+    // A cubic grid has the same k spacing along each axis, so |k| only takes the values
+    // dk*sqrt(n2) for integer n2 = nx^2+ny^2+nz^2 <= 3*(n/2)^2.
+    _cubic = (nx == ny && ny == nz);
+    if(_cubic) {
+        int nby2(nx/2);
+        std::size_t nk2(3*nby2*nby2+1);
+        _kmag.reserve(nk2);
+        for(std::size_t n2 = 0; n2 < nk2; ++n2) {
+            _kmag.push_back(dkx*std::sqrt((double)n2));
+        }
+        _pktable.resize(nk2);
+    }
     // Calculate normalization.
     _norm = nx*ny*nz*spacing*spacing*spacing;
     // Initialize the array that will be used for bicubic interpolation.
     _xi.reset(new double[(nx/2+1)*(ny/2+1)]);
+    // Initialize the default quadrature used for multipole and wedge projections.
+    setQuadraturePoints(16);
 }
 
 local::DistortedPowerCorrelationFft::~DistortedPowerCorrelationFft() {
 #ifdef HAVE_LIBFFTW3F
     if(0 != _pimpl->data) {
-        FFTW(destroy_plan)(_pimpl->plan);
+        if(0 != _pimpl->plan) FFTW(destroy_plan)(_pimpl->plan);
         FFTW(free)(_pimpl->data);
     }
 #endif
+#ifdef HAVE_LIBFFTW3
+    if(0 != _pimpl->ddata) {
+        if(0 != _pimpl->dplan) FFTWD(destroy_plan)(_pimpl->dplan);
+        FFTWD(free)(_pimpl->ddata);
+    }
+#endif
 }
 
 double local::DistortedPowerCorrelationFft::getImPower(double k, double mu) const {
@@ -84,7 +132,8 @@ double local::DistortedPowerCorrelationFft::getImPower(double k, double mu) cons
     if(k < 0 ) {
         throw RuntimeError("DistortedPowerCorrelationFft::getPower: expected k >= 0.");
     }
-    return (*_power)(k)*(*_imdistortion)(k,mu,(*_power)(k));
+    double pk = (*_power)(k);
+    return pk*(*_imdistortion)(k,mu,pk);
 }
 
 double local::DistortedPowerCorrelationFft::getPower(double k, double mu) const {
@@ -94,7 +143,8 @@ double local::DistortedPowerCorrelationFft::getPower(double k, double mu) const
 	if(k < 0 ) {
 		throw RuntimeError("DistortedPowerCorrelationFft::getPower: expected k >= 0.");
 	}
-	return (*_power)(k)*(*_distortion)(k,mu,(*_power)(k));
+	double pk = (*_power)(k);
+	return pk*(*_distortion)(k,mu,pk);
 }
 
 double local::DistortedPowerCorrelationFft::getCorrelation(double r, double mu) const {
@@ -106,54 +156,283 @@ double local::DistortedPowerCorrelationFft::getCorrelation(double r, double mu)
 	if(r < 0 || rperp > _spacing*_nx/2 || rpar > _spacing*_ny/2) {
 		throw RuntimeError("DistortedPowerCorrelationFft::getCorrelation: r out of range.");
 	}
+	if(!_bicubicinterpolator) {
+		throw RuntimeError("DistortedPowerCorrelationFft::getCorrelation: no transform yet.");
+	}
 	return (*_bicubicinterpolator)(rperp,rpar);
 }
 
+void local::DistortedPowerCorrelationFft::_checkCorrelationRange(std::vector<double> const &r,
+std::vector<double> const &mu, char const *method) const {
+	if(!_bicubicinterpolator) {
+		throw RuntimeError(std::string("DistortedPowerCorrelationFft::") + method + ": no transform yet.");
+	}
+	if(r.empty()) return;
+	double rmin = *std::min_element(r.begin(),r.end());
+	double rmax = *std::max_element(r.begin(),r.end());
+	if(rmin < 0) {
+		throw RuntimeError(std::string("DistortedPowerCorrelationFft::") + method + ": r out of range.");
+	}
+	// Since rperp and rpar both scale with r, checking rmax for each mu covers all points.
+	double rperpMax(getRPerpMax()), rparMax(getRParMax());
+	for(std::vector<double>::const_iterator iter = mu.begin(); iter != mu.end(); ++iter) {
+		double muj(*iter);
+		if(muj < -1 || muj > 1) {
+			throw RuntimeError(std::string("DistortedPowerCorrelationFft::") + method + ": expected -1 <= mu <= 1.");
+		}
+		if(rmax*std::sqrt(1-muj*muj) > rperpMax || rmax*std::fabs(muj) > rparMax) {
+			throw RuntimeError(std::string("DistortedPowerCorrelationFft::") + method + ": r out of range.");
+		}
+	}
+}
+
+void local::DistortedPowerCorrelationFft::getCorrelation(std::vector<double> const &r,
+std::vector<double> const &mu, std::vector<double> &xi) const {
+	_checkCorrelationRange(r,mu,"getCorrelation");
+	std::size_t nr(r.size()), nmu(mu.size());
+	xi.resize(nr*nmu);
+	// Precompute the projections onto the (rperp,rpar) plane for unit r.
+	std::vector<double> sperp(nmu), spar(nmu);
+	for(std::size_t j = 0; j < nmu; ++j) {
+		spar[j] = std::fabs(mu[j]);
+		sperp[j] = std::sqrt(1-mu[j]*mu[j]);
+	}
+	likely::BiCubicInterpolator const &interpolator(*_bicubicinterpolator);
+	for(std::size_t i = 0; i < nr; ++i) {
+		double ri(r[i]);
+		for(std::size_t j = 0; j < nmu; ++j) {
+			xi[j+nmu*i] = interpolator(ri*sperp[j],ri*spar[j]);
+		}
+	}
+}
+
+void local::DistortedPowerCorrelationFft::setQuadraturePoints(int npoints) {
+	if(npoints <= 0) {
+		throw RuntimeError("DistortedPowerCorrelationFft::setQuadraturePoints: expected npoints > 0.");
+	}
+	getGaussLegendre(npoints,_xquad,_wquad);
+}
+
+void local::DistortedPowerCorrelationFft::_project(std::vector<double> const &r, double muMin, double muMax,
+int ell, double norm, std::vector<double> &xi) const {
+	// Map our quadrature points from [-1,1] to [muMin,muMax] and fold the Legendre
+	// polynomial and normalization into the weights.
+	std::size_t nquad(_xquad.size());
+	double mid(0.5*(muMax+muMin)), half(0.5*(muMax-muMin));
+	std::vector<double> mu(nquad), weight(nquad);
+	for(std::size_t j = 0; j < nquad; ++j) {
+		mu[j] = mid + half*_xquad[j];
+		weight[j] = norm*half*_wquad[j]*legendreP(ell,mu[j]);
+	}
+	std::vector<double> xirmu;
+	getCorrelation(r,mu,xirmu);
+	std::size_t nr(r.size());
+	xi.assign(nr,0);
+	for(std::size_t i = 0; i < nr; ++i) {
+		double sum(0);
+		for(std::size_t j = 0; j < nquad; ++j) {
+			sum += weight[j]*xirmu[j+nquad*i];
+		}
+		xi[i] = sum;
+	}
+}
+
+void local::DistortedPowerCorrelationFft::getCorrelationMultipoles(std::vector<double> const &r, int ell,
+std::vector<double> &xi) const {
+	if(ell < 0 || ell % 2 == 1 || ell > 12) {
+		throw RuntimeError("DistortedPowerCorrelationFft::getCorrelationMultipoles: expected even 0 <= ell <= 12.");
+	}
+	// xi(r,mu) is symmetric in mu so we integrate over 0 < mu < 1 with twice the usual (2ell+1)/2.
+	_project(r,0,1,ell,2*ell+1,xi);
+}
+
+double local::DistortedPowerCorrelationFft::getCorrelationMultipole(double r, int ell) const {
+	std::vector<double> rvec(1,r), xi;
+	getCorrelationMultipoles(rvec,ell,xi);
+	return xi[0];
+}
+
+void local::DistortedPowerCorrelationFft::getCorrelationWedges(std::vector<double> const &r,
+double muMin, double muMax, std::vector<double> &xi) const {
+	if(muMin < 0 || muMax > 1 || muMin >= muMax) {
+		throw RuntimeError("DistortedPowerCorrelationFft::getCorrelationWedges: expected 0 <= muMin < muMax <= 1.");
+	}
+	_project(r,muMin,muMax,0,1/(muMax-muMin),xi);
+}
+
 void local::DistortedPowerCorrelationFft::transform() {
+	// Tabulate P(k) at each distinct |k| of a cubic grid.
+	if(_cubic) {
+		_pktable[0] = 0;
+		for(std::size_t n2 = 1; n2 < _pktable.size(); ++n2) {
+			_pktable[n2] = (*_power)(_kmag[n2]);
+		}
+		if(_filter) {
+			_filtertable.resize(_kmag.size());
+			for(std::size_t n2 = 0; n2 < _filtertable.size(); ++n2) {
+				_filtertable[n2] = (*_filter)(_kmag[n2]);
+			}
+		}
+	}
+	// Tabulate D(k,mu) if requested.
+	if(_nkTable > 0) {
+		_fillDistortionTable(_distortion,_dtable);
+		if(_imagpart) _fillDistortionTable(_imdistortion,_dimtable);
+	}
+	if(_doublePrecision) {
+#ifdef HAVE_LIBFFTW3
+		// Create a plan for an in-place transform the first time we are called.
+		if(0 == _pimpl->dplan) {
+			_pimpl->dplan = FFTWD(plan_dft_3d)(_nx,_ny,_nz,_pimpl->ddata,_pimpl->ddata,FFTW_BACKWARD,FFTW_ESTIMATE);
+		}
+		_fillGrid(_pimpl->ddata);
+		// Execute FFT to r space.
+		FFTWD(execute)(_pimpl->dplan);
+		_extractCorrelation(_pimpl->ddata);
+#endif
+	}
+	else {
 #ifdef HAVE_LIBFFTW3F
-	// Clean up any previous plan.
-    if(_pimpl->data) FFTW(destroy_plan)(_pimpl->plan);
-    // Create a new plan for an in-place transform.
-    _pimpl->plan = FFTW(plan_dft_3d)(_nx,_ny,_nz,_pimpl->data,_pimpl->data,FFTW_BACKWARD,FFTW_ESTIMATE);
+		// Create a plan for an in-place transform the first time we are called.
+		if(0 == _pimpl->plan) {
+			_pimpl->plan = FFTW(plan_dft_3d)(_nx,_ny,_nz,_pimpl->data,_pimpl->data,FFTW_BACKWARD,FFTW_ESTIMATE);
+		}
+		_fillGrid(_pimpl->data);
+		// Execute FFT to r space.
+		FFTW(execute)(_pimpl->plan);
+		_extractCorrelation(_pimpl->data);
+#endif
+	}
+    // Create the bicubic interpolator.
+	_bicubicinterpolator.reset(new likely::BiCubicInterpolator(likely::BiCubicInterpolator::DataPlane(_xi),_spacing,_nx/2+1,_ny/2+1));
+}
+
+template <class FftwComplex>
+void local::DistortedPowerCorrelationFft::_fillGrid(FftwComplex *data) const {
+	bool useTable(_nkTable > 0);
 	// Evaluate the power spectrum at each grid point (kx,ky,kz).
 	for(int ix = 0; ix < _nx; ++ix){
+		int jx = (ix > _nx/2 ? ix-_nx : ix);
 		for(int iy = 0; iy < _ny; ++iy){
+			int jy = (iy > _ny/2 ? iy-_ny : iy);
+			int nxy2 = jx*jx + jy*jy;
+			double kxy2 = _kxgrid[ix]*_kxgrid[ix] + _kygrid[iy]*_kygrid[iy];
 			for(int iz = 0; iz < _nz; ++iz){
 				std::size_t index(iz+_nz*(iy+_ny*ix));
-				double ksq = _kxgrid[ix]*_kxgrid[ix] + _kygrid[iy]*_kygrid[iy] + _kzgrid[iz]*_kzgrid[iz];
-            	double k = std::sqrt(ksq);
-            	if(k==0) {
-            		_pimpl->data[index][0] = 0;
-            		_pimpl->data[index][1] = 0;
-            	}
-            	if(k>0) {
-            		double mu = _kygrid[iy]/k;
-            		_pimpl->data[index][0] = getPower(k,mu);
-                    if (_imagpart){
-                        _pimpl->data[index][1] = getImPower(k,mu);
-                    }
-                    else{
-                        _pimpl->data[index][1] = 0;
-                    }
-            	}
-            }
-        }
-    }
-    // Execute FFT to r space.
-	FFTW(execute)(_pimpl->plan);
+				double k,pk,filter(1);
+				if(_cubic) {
+					int jz = (iz > _nz/2 ? iz-_nz : iz);
+					int n2 = nxy2 + jz*jz;
+					k = _kmag[n2];
+					pk = _pktable[n2];
+					if(_filter) filter = _filtertable[n2];
+				}
+				else {
+					k = std::sqrt(kxy2 + _kzgrid[iz]*_kzgrid[iz]);
+					pk = k > 0 ? (*_power)(k) : 0;
+					if(_filter && k > 0) filter = (*_filter)(k);
+				}
+				if(k == 0) {
+					data[index][0] = 0;
+					data[index][1] = 0;
+					continue;
+				}
+				double mu = _kygrid[iy]/k;
+				data[index][0] = filter*pk*(useTable ?
+					_interpolateDistortion(_dtable,k,mu) : (*_distortion)(k,mu,pk));
+				if(_imagpart) {
+					data[index][1] = filter*pk*(useTable ?
+						_interpolateDistortion(_dimtable,k,mu) : (*_imdistortion)(k,mu,pk));
+				}
+				else {
+					data[index][1] = 0;
+				}
+			}
+		}
+	}
+}
+
+template <class FftwComplex>
+void local::DistortedPowerCorrelationFft::_extractCorrelation(FftwComplex *data) {
 	// Extract the correlation function at grid points (rx,ry,0).
 	for(int iy = 0; iy < _ny/2+1; ++iy) {
         for(int ix = 0; ix < _nx/2+1; ++ix) {
-        	std::size_t ind(_nz*(iy+_ny*ix));
+        	std::size_t ind(_nz*(iy+(std::size_t)_ny*ix));
         	std::size_t ind2(ix+(_nx/2+1)*iy);
-        	_xi[ind2] = (double)_pimpl->data[ind][0]/_norm;
+        	_xi[ind2] = (double)data[ind][0]/_norm;
         }
     }
-    // Create the bicubic interpolator.
-	_bicubicinterpolator = new likely::BiCubicInterpolator(likely::BiCubicInterpolator::DataPlane(_xi),_spacing,_nx/2+1,_ny/2+1);
-#endif
+}
+
+void local::DistortedPowerCorrelationFft::saveCorrelationGrid(std::string const &filename) const {
+	if(!_bicubicinterpolator) {
+		throw RuntimeError("DistortedPowerCorrelationFft::saveCorrelationGrid: no transform yet.");
+	}
+	GridFileWriter writer(filename,1,_ny/2+1,_nx/2+1,_nx/2+1,_spacing,GridFileHeader::Float64);
+	writer.write(_xi.get(),(std::size_t)(_nx/2+1)*(_ny/2+1));
+	writer.close();
+}
+
+void local::DistortedPowerCorrelationFft::setFilter(likely::GenericFunctionPtr filter) {
+	_filter = filter;
+	if(!_filter) std::vector<double>().swap(_filtertable);
+}
+
+void local::DistortedPowerCorrelationFft::setDistortionTable(int nk, int nmu) {
+	if(nk < 0 || nk == 1) {
+		throw RuntimeError("DistortedPowerCorrelationFft::setDistortionTable: expected nk = 0 or nk >= 2.");
+	}
+	if(nk > 0 && nmu < 2) {
+		throw RuntimeError("DistortedPowerCorrelationFft::setDistortionTable: expected nmu >= 2.");
+	}
+	_nkTable = nk;
+	_nmuTable = nk > 0 ? nmu : 0;
+	if(0 == nk) {
+		std::vector<double>().swap(_dtable);
+		std::vector<double>().swap(_dimtable);
+		return;
+	}
+	// Cover all non-zero |k| on our grid, from the smallest to the largest axis spacing.
+	double kxmax(std::fabs(_kxgrid[_nx/2])), kymax(std::fabs(_kygrid[_ny/2])), kzmax(std::fabs(_kzgrid[_nz/2]));
+	double kmax = std::sqrt(kxmax*kxmax + kymax*kymax + kzmax*kzmax);
+	_kminTable = _kxgrid[_nx > 1 ? 1 : 0];
+	if(_ny > 1 && _kygrid[1] < _kminTable) _kminTable = _kygrid[1];
+	if(_nz > 1 && _kzgrid[1] < _kminTable) _kminTable = _kzgrid[1];
+	if(!(_kminTable > 0) || kmax <= _kminTable) {
+		throw RuntimeError("DistortedPowerCorrelationFft::setDistortionTable: grid too small.");
+	}
+	_dkTable = (kmax - _kminTable)/(nk-1.);
+	_dmuTable = 2./(nmu-1.);
+	_dtable.resize(nk*nmu);
+	if(_imagpart) _dimtable.resize(nk*nmu);
+}
+
+void local::DistortedPowerCorrelationFft::_fillDistortionTable(KMuPkFunctionCPtr distortion,
+std::vector<double> &table) const {
+	for(int ik = 0; ik < _nkTable; ++ik) {
+		double k = _kminTable + ik*_dkTable;
+		double pk = (*_power)(k);
+		for(int imu = 0; imu < _nmuTable; ++imu) {
+			double mu = -1 + imu*_dmuTable;
+			table[imu+_nmuTable*ik] = (*distortion)(k,mu,pk);
+		}
+	}
+}
+
+double local::DistortedPowerCorrelationFft::_interpolateDistortion(std::vector<double> const &table,
+double k, double mu) const {
+	double tk = (k - _kminTable)/_dkTable, tmu = (mu + 1)/_dmuTable;
+	int ik = (int)tk, imu = (int)tmu;
+	if(ik > _nkTable-2) ik = _nkTable-2;
+	if(imu > _nmuTable-2) imu = _nmuTable-2;
+	if(ik < 0) ik = 0;
+	if(imu < 0) imu = 0;
+	double wk = tk - ik, wmu = tmu - imu;
+	double const *row0 = &table[imu+_nmuTable*ik], *row1 = row0 + _nmuTable;
+	return (1-wk)*((1-wmu)*row0[0] + wmu*row0[1]) + wk*((1-wmu)*row1[0] + wmu*row1[1]);
 }
 
 std::size_t local::DistortedPowerCorrelationFft::getMemorySize() const {
-    return sizeof(*this) + (std::size_t)_nx*_ny*_nz*8;
+    return sizeof(*this) + (std::size_t)_nx*_ny*_nz*(_doublePrecision ? 16 : 8) +
+        (_kmag.size() + _pktable.size() + _filtertable.size() + _dtable.size() + _dimtable.size())*sizeof(double);
 }
@@ -0,0 +1,176 @@
+// Created 18-Oct-2026
+
+#include "cosmo/DistortedPowerCorrelationHankel.h"
+#include "cosmo/MultipoleTransform.h"
+#include "cosmo/RuntimeError.h"
+
+#include "likely/BiCubicInterpolator.h"
+#include "likely/Interpolator.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include "config.h"
+#ifdef HAVE_LIBFFTW3
+#include "fftw3.h"
+#define FFTW(X) fftw_ ## X // prefix identifier (double transform)
+#endif
+
+namespace local = cosmo;
+
+namespace cosmo {
+    struct DistortedPowerCorrelationHankel::Implementation {
+#ifdef HAVE_LIBFFTW3
+        FFTW(complex) *data;
+        FFTW(plan) plan;
+#endif
+    };
+}
+
+local::DistortedPowerCorrelationHankel::DistortedPowerCorrelationHankel(
+likely::GenericFunctionPtr power, KMuPkFunctionCPtr distortion, KMuPkFunctionCPtr imdistortion,
+bool imagpart, double spacing, int npar, double rperpMax, double veps)
+: _pimpl(new Implementation()), _power(power), _distortion(distortion), _imdistortion(imdistortion),
+_imagpart(imagpart), _spacing(spacing), _npar(npar)
+{
+	// Input parameter validation.
+	if(spacing <= 0) {
+		throw RuntimeError("DistortedPowerCorrelationHankel: invalid grid spacing.");
+	}
+	if(npar < 4) {
+		throw RuntimeError("DistortedPowerCorrelationHankel: expected npar >= 4.");
+	}
+	if(rperpMax <= spacing) {
+		throw RuntimeError("DistortedPowerCorrelationHankel: expected rperpMax > spacing.");
+	}
+#ifndef HAVE_LIBFFTW3
+	throw RuntimeError("DistortedPowerCorrelationHankel: package not built with FFTW3.");
+#endif
+	// Initialize the uniform rperp grid where results will be tabulated.
+	_nperp = (int)std::ceil(rperpMax/spacing) + 1;
+	_rperpgrid.reserve(_nperp);
+	for(int i = 0; i < _nperp; ++i) _rperpgrid.push_back(i*spacing);
+	// Create the Hankel transform covering our rperp grid. We start well below the
+	// first non-zero rperp since xi is an even function of rperp and so flat at rperp = 0.
+	_hankel.reset(new MultipoleTransform(MultipoleTransform::Hankel,0,
+		0.1*spacing,_rperpgrid.back(),veps,MultipoleTransform::EstimatePlan));
+	int nu = _hankel->getUGrid().size();
+	_ftable.resize(nu);
+	if(imagpart) _imftable.resize(nu);
+	// Initialize the kpar grid with the usual FFT wrap-around ordering.
+	double twopi(8*std::atan(1));
+	_dkpar = twopi/(npar*spacing);
+	_kpargrid.reserve(npar);
+	for(int m = 0; m < npar; ++m) {
+		_kpargrid.push_back((m > npar/2 ? m-npar : m)*_dkpar);
+	}
+#ifdef HAVE_LIBFFTW3
+	// Allocate a [rperp][kpar] array and plan a batch of in-place 1D transforms along kpar.
+	_pimpl->data = (FFTW(complex)*) FFTW(malloc)(sizeof(FFTW(complex))*(std::size_t)_nperp*npar);
+	_pimpl->plan = FFTW(plan_many_dft)(1,&_npar,_nperp,_pimpl->data,0,1,_npar,
+		_pimpl->data,0,1,_npar,FFTW_BACKWARD,FFTW_ESTIMATE);
+#endif
+	// Initialize the array that will be used for bicubic interpolation.
+	_xi.reset(new double[_nperp*(npar/2+1)]);
+}
+
+local::DistortedPowerCorrelationHankel::~DistortedPowerCorrelationHankel() {
+#ifdef HAVE_LIBFFTW3
+	FFTW(destroy_plan)(_pimpl->plan);
+	FFTW(free)(_pimpl->data);
+#endif
+}
+
+double local::DistortedPowerCorrelationHankel::getPower(double k, double mu) const {
+	if(mu < -1 || mu > 1) {
+		throw RuntimeError("DistortedPowerCorrelationHankel::getPower: expected -1 <= mu <= 1.");
+	}
+	if(k < 0) {
+		throw RuntimeError("DistortedPowerCorrelationHankel::getPower: expected k >= 0.");
+	}
+	double pk = (*_power)(k);
+	return pk*(*_distortion)(k,mu,pk);
+}
+
+double local::DistortedPowerCorrelationHankel::getImPower(double k, double mu) const {
+	if(mu < -1 || mu > 1) {
+		throw RuntimeError("DistortedPowerCorrelationHankel::getImPower: expected -1 <= mu <= 1.");
+	}
+	if(k < 0) {
+		throw RuntimeError("DistortedPowerCorrelationHankel::getImPower: expected k >= 0.");
+	}
+	double pk = (*_power)(k);
+	return pk*(*_imdistortion)(k,mu,pk);
+}
+
+double local::DistortedPowerCorrelationHankel::getCorrelation(double r, double mu) const {
+	if(mu < -1 || mu > 1) {
+		throw RuntimeError("DistortedPowerCorrelationHankel::getCorrelation: expected -1 <= mu <= 1.");
+	}
+	double rpar = r*std::fabs(mu);
+	double rperp = r*std::sqrt(1-mu*mu);
+	if(r < 0 || rperp > getRPerpMax() || rpar > getRParMax()) {
+		throw RuntimeError("DistortedPowerCorrelationHankel::getCorrelation: r out of range.");
+	}
+	if(!_bicubicinterpolator) {
+		throw RuntimeError("DistortedPowerCorrelationHankel::getCorrelation: no transform yet.");
+	}
+	return (*_bicubicinterpolator)(rperp,rpar);
+}
+
+void local::DistortedPowerCorrelationHankel::transform() {
+#ifdef HAVE_LIBFFTW3
+	std::vector<double> const &ugrid = _hankel->getUGrid(), &vgrid = _hankel->getVGrid();
+	int nu = ugrid.size();
+	// Combine the normalizations of the 2D Hankel transform, 1/(2pi), and the discrete
+	// 1D transform along kpar, dkpar/(2pi).
+	double twopi(8*std::atan(1));
+	double coef = multipoleTransformNormalization(0,2,+1)*_dkpar/twopi;
+	likely::InterpolatorPtr reInterpolator, imInterpolator;
+	for(int m = 0; m < _npar; ++m) {
+		double kpar = _kpargrid[m];
+		// Tabulate P(k,mu) at this kpar for each kperp of the Hankel u grid.
+		for(int i = 0; i < nu; ++i) {
+			double kperp = ugrid[i];
+			double k = std::sqrt(kperp*kperp + kpar*kpar);
+			double mu = kpar/k;
+			double pk = (*_power)(k);
+			_ftable[i] = pk*(*_distortion)(k,mu,pk);
+			if(_imagpart) _imftable[i] = pk*(*_imdistortion)(k,mu,pk);
+		}
+		// Hankel transform kperp -> rperp and resample onto our uniform rperp grid.
+		_hankel->transform(_ftable,_hankelRe);
+		reInterpolator.reset(new likely::Interpolator(vgrid,_hankelRe,"cspline"));
+		if(_imagpart) {
+			_hankel->transform(_imftable,_hankelIm);
+			imInterpolator.reset(new likely::Interpolator(vgrid,_hankelIm,"cspline"));
+		}
+		for(int iperp = 0; iperp < _nperp; ++iperp) {
+			double rperp = std::max(_rperpgrid[iperp],vgrid.front());
+			std::size_t index(m+(std::size_t)_npar*iperp);
+			_pimpl->data[index][0] = coef*(*reInterpolator)(rperp);
+			_pimpl->data[index][1] = _imagpart ? coef*(*imInterpolator)(rperp) : 0;
+		}
+	}
+	// Execute the 1D FFTs kpar -> rpar for each rperp.
+	FFTW(execute)(_pimpl->plan);
+	// Extract the correlation function at grid points (rperp,rpar).
+	for(int jpar = 0; jpar < _npar/2+1; ++jpar) {
+		for(int iperp = 0; iperp < _nperp; ++iperp) {
+			_xi[iperp+_nperp*jpar] = _pimpl->data[jpar+(std::size_t)_npar*iperp][0];
+		}
+	}
+	// Create the bicubic interpolator.
+	_bicubicinterpolator.reset(new likely::BiCubicInterpolator(
+		likely::BiCubicInterpolator::DataPlane(_xi),_spacing,_nperp,_npar/2+1));
+#endif
+}
+
+int local::DistortedPowerCorrelationHankel::getNKPerp() const {
+	return _hankel->getUGrid().size();
+}
+
+std::size_t local::DistortedPowerCorrelationHankel::getMemorySize() const {
+	return sizeof(*this) + (std::size_t)_nperp*_npar*16 + (std::size_t)_nperp*(_npar/2+1)*8 +
+		(_ftable.size() + _imftable.size())*sizeof(double);
+}
@@ -0,0 +1,76 @@
+// Created 18-Oct-2026
+
+#ifndef COSMO_DISTORTED_POWER_CORRELATION_HANKEL
+#define COSMO_DISTORTED_POWER_CORRELATION_HANKEL
+
+#include "cosmo/types.h"
+#include "likely/types.h"
+#include "likely/function.h"
+
+#include "boost/smart_ptr.hpp"
+
+#include <vector>
+#include <cstddef>
+
+namespace likely{class BiCubicInterpolator;}
+namespace cosmo {
+	class MultipoleTransform;
+	class DistortedPowerCorrelationHankel {
+	// Represents the 3D correlation function corresponding to an isotropic power
+	// spectrum P(k) that is distorted by a multiplicative function D(k,mu_k), with
+	// the same interface as DistortedPowerCorrelationFft. Since P(k,mu_k) is
+	// azimuthally symmetric about the line of sight, xi(rperp,rpar) is calculated with
+	// a 0th-order Hankel transform in kperp for each kpar of a 1D grid, followed by
+	// a 1D FFT along kpar for each rperp. This costs O(N^2 log N) for an N-point
+	// line-of-sight grid, instead of O(N^3 log N) for a 3D FFT. The accuracy of the
+	// Hankel transforms is controlled by veps, as described in MultipoleTransform.
+	// The normal usage is:
+	//
+	//    - transform() each time D(k,mu_k) changes internally
+	//      - call getCorrelation(r,mu) many times
+	//
+	public:
+		// Creates a new distorted power correlation function using the specified
+		// isotropic power P(k) and distortion function D(k,mu). The line-of-sight
+		// grid has npar points with the specified spacing in Mpc/h, and the results
+		// are tabulated with the same spacing for rperp up to at least rperpMax.
+		DistortedPowerCorrelationHankel(likely::GenericFunctionPtr power,
+			KMuPkFunctionCPtr distortion, KMuPkFunctionCPtr imdistortion, bool imagpart,
+			double spacing, int npar, double rperpMax, double veps = 0.01);
+		virtual ~DistortedPowerCorrelationHankel();
+		// Returns the value of P(k,mu) = P(k)*D(k,mu).
+		double getPower(double k, double mu) const;
+		double getImPower(double k, double mu) const;
+		// Returns the correlation function xi(r,mu).
+		double getCorrelation(double r, double mu) const;
+		// Transforms the k-space power spectrum to r space.
+		void transform();
+		// Returns the largest values of r*sqrt(1-mu^2) and r*|mu| that getCorrelation(r,mu)
+		// accepts.
+		double getRPerpMax() const;
+		double getRParMax() const;
+		// Returns the number of kperp values where P(k,mu) is evaluated for each kpar.
+		int getNKPerp() const;
+		// Returns the memory size in bytes required for this transform or zero if this
+		// information is not available.
+		virtual std::size_t getMemorySize() const;
+	private:
+		class Implementation;
+		boost::scoped_ptr<Implementation> _pimpl;
+		likely::GenericFunctionPtr _power;
+		KMuPkFunctionCPtr _distortion, _imdistortion;
+		bool _imagpart;
+		double _spacing, _dkpar;
+		int _npar, _nperp;
+		boost::scoped_ptr<MultipoleTransform> _hankel;
+		std::vector<double> _kpargrid, _rperpgrid, _ftable, _imftable, _hankelRe, _hankelIm;
+		boost::shared_array<double> _xi;
+		boost::scoped_ptr<likely::BiCubicInterpolator> _bicubicinterpolator;
+	}; // DistortedPowerCorrelationHankel
+
+	inline double DistortedPowerCorrelationHankel::getRPerpMax() const { return _spacing*(_nperp-1); }
+	inline double DistortedPowerCorrelationHankel::getRParMax() const { return _spacing*(_npar/2); }
+
+} // cosmo
+
+#endif // COSMO_DISTORTED_POWER_CORRELATION_HANKEL
@@ -0,0 +1,102 @@
+// Created 18-Oct-2026
+
+#include "cosmo/DistortedPowerCorrelationNestedFft.h"
+#include "cosmo/DistortedPowerCorrelationFft.h"
+#include "cosmo/RuntimeError.h"
+
+#include "boost/bind.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+namespace local = cosmo;
+
+namespace {
+	// Returns the low-pass filter W(k) = exp(-(k*rsplit)^8/2) used for the coarse grid.
+	double nestedLowPass(double k, double rsplit) {
+		double kr2(k*rsplit*k*rsplit), kr4(kr2*kr2);
+		return std::exp(-0.5*kr4*kr4);
+	}
+	// Returns the complementary high-pass filter 1-W(k) used for the fine grid.
+	double nestedHighPass(double k, double rsplit) {
+		double kr2(k*rsplit*k*rsplit), kr4(kr2*kr2);
+		return 1 - std::exp(-0.5*kr4*kr4);
+	}
+} // anonymous
+
+local::DistortedPowerCorrelationNestedFft::DistortedPowerCorrelationNestedFft(
+likely::GenericFunctionPtr power, KMuPkFunctionCPtr distortion, KMuPkFunctionCPtr imdistortion,
+bool imagpart, double coarseSpacing, int coarseN, double fineSpacing, int fineN,
+double rsplit, bool doublePrecision)
+: _rsplit(rsplit)
+{
+	if(coarseSpacing <= 0 || fineSpacing <= 0) {
+		throw RuntimeError("DistortedPowerCorrelationNestedFft: invalid grid spacing.");
+	}
+	if(fineSpacing >= coarseSpacing) {
+		throw RuntimeError("DistortedPowerCorrelationNestedFft: expected fineSpacing < coarseSpacing.");
+	}
+	if(fineSpacing*fineN >= coarseSpacing*coarseN) {
+		throw RuntimeError("DistortedPowerCorrelationNestedFft: expected fine grid inside coarse grid.");
+	}
+	if(rsplit < 0) {
+		throw RuntimeError("DistortedPowerCorrelationNestedFft: expected rsplit >= 0.");
+	}
+	if(0 == rsplit) _rsplit = coarseSpacing;
+	if(_rsplit < coarseSpacing/2) {
+		throw RuntimeError("DistortedPowerCorrelationNestedFft: expected rsplit >= coarseSpacing/2.");
+	}
+	double fineMax(fineSpacing*fineN/2);
+	if(fineMax < 8*_rsplit) {
+		throw RuntimeError("DistortedPowerCorrelationNestedFft: expected fineSpacing*fineN/2 >= 8*rsplit.");
+	}
+	_coarse.reset(new DistortedPowerCorrelationFft(power,distortion,imdistortion,imagpart,
+		coarseSpacing,coarseN,coarseN,coarseN,doublePrecision));
+	_coarse->setFilter(likely::GenericFunctionPtr(new likely::GenericFunction(
+		boost::bind(nestedLowPass,_1,_rsplit))));
+	_fine.reset(new DistortedPowerCorrelationFft(power,distortion,imdistortion,imagpart,
+		fineSpacing,fineN,fineN,fineN,doublePrecision));
+	_fine->setFilter(likely::GenericFunctionPtr(new likely::GenericFunction(
+		boost::bind(nestedHighPass,_1,_rsplit))));
+}
+
+local::DistortedPowerCorrelationNestedFft::~DistortedPowerCorrelationNestedFft() { }
+
+double local::DistortedPowerCorrelationNestedFft::getPower(double k, double mu) const {
+	return _coarse->getPower(k,mu);
+}
+
+double local::DistortedPowerCorrelationNestedFft::getImPower(double k, double mu) const {
+	return _coarse->getImPower(k,mu);
+}
+
+double local::DistortedPowerCorrelationNestedFft::getCorrelation(double r, double mu) const {
+	if(mu < -1 || mu > 1) {
+		throw RuntimeError("DistortedPowerCorrelationNestedFft::getCorrelation: expected -1 <= mu <= 1.");
+	}
+	double result = _coarse->getCorrelation(r,mu);
+	// Add the small-scale contribution when (r,mu) is covered by the fine grid, tapering it
+	// smoothly to zero over the outer tenth of the fine grid so that xi is continuous.
+	double rpar = r*std::fabs(mu);
+	double rperp = r*std::sqrt(1-mu*mu);
+	double t = std::max(rperp/_fine->getRPerpMax(),rpar/_fine->getRParMax());
+	if(t < 1) {
+		double s = std::min(1.,10*(1-t));
+		result += s*s*(3-2*s)*_fine->getCorrelation(r,mu);
+	}
+	return result;
+}
+
+void local::DistortedPowerCorrelationNestedFft::transform() {
+	_coarse->transform();
+	_fine->transform();
+}
+
+void local::DistortedPowerCorrelationNestedFft::setDistortionTable(int nk, int nmu) {
+	_coarse->setDistortionTable(nk,nmu);
+	_fine->setDistortionTable(nk,nmu);
+}
+
+std::size_t local::DistortedPowerCorrelationNestedFft::getMemorySize() const {
+	return sizeof(*this) + _coarse->getMemorySize() + _fine->getMemorySize();
+}
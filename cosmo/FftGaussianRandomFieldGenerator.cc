@@ -2,6 +2,10 @@
 
 #include "cosmo/FftGaussianRandomFieldGenerator.h"
 #include "cosmo/RuntimeError.h"
+#include "cosmo/PhiloxRandom.h"
+#include "cosmo/WallClock.h"
+#include "cosmo/GaussianRandomFieldSigmaTable.h"
+#include "cosmo/GridFileWriter.h"
 
 #include "likely/Random.h"
 #include "likely/WeightedAccumulator.h"
@@ -15,6 +19,8 @@
 typedef float FftwReal;
 #endif
 
+#include <algorithm>
+
 namespace local = cosmo;
 
 namespace cosmo {
@@ -29,10 +35,12 @@ namespace cosmo {
 local::FftGaussianRandomFieldGenerator::FftGaussianRandomFieldGenerator(
 PowerSpectrumPtr powerSpectrum, double spacing, int nx, int ny, int nz, likely::RandomPtr random)
 : AbsGaussianRandomFieldGenerator(powerSpectrum,spacing,nx,ny,nz,random),
-_pimpl(new Implementation()), _halfz(nz/2+1)
+_pimpl(new Implementation()), _halfz(nz/2+1), _realization(0), _nthreads(1),
+_strategy(EstimatePlan), _randomTime(0), _scaleTime(0), _fftTime(0)
 {
 #ifdef HAVE_LIBFFTW3F
     _pimpl->data = 0;
+    _pimpl->plan = 0;
 #else
     throw RuntimeError("FftGaussianRandomFieldGenerator: package not built with FFTW3.");
 #endif
@@ -43,58 +51,171 @@ _pimpl(new Implementation()), _halfz(nz/2+1)
 local::FftGaussianRandomFieldGenerator::~FftGaussianRandomFieldGenerator() {
 #ifdef HAVE_LIBFFTW3F
     if(0 != _pimpl->data) {
-        FFTW(destroy_plan)(_pimpl->plan);
+        if(0 != _pimpl->plan) FFTW(destroy_plan)(_pimpl->plan);
+        FFTW(free)(_pimpl->data);
+    }
+#endif
+}
+
+void local::FftGaussianRandomFieldGenerator::_initialize() {
+#ifdef HAVE_LIBFFTW3F
+    // Allocate an aligned buffer that we reuse for every realization.
+    _pimpl->data = (FFTW(complex)*)FFTW(malloc)(sizeof(FFTW(complex))*_nbuf);
+    if(0 == _pimpl->data) {
+        throw RuntimeError("FftGaussianRandomFieldGenerator: unable to allocate k-space buffer.");
+    }
+    // Touch each slab first from the thread that will later fill and scale it, so that
+    // its pages are local to that thread, before any planning that writes to the buffer.
+    float *buffer = (float*)_pimpl->data;
+    long nx(getNx()), nyz(2*(long)getNy()*_halfz);
+#pragma omp parallel for schedule(static) num_threads(_nthreads)
+    for(long ix = 0; ix < nx; ++ix) {
+        std::fill(buffer + nyz*ix, buffer + nyz*(ix+1), 0.f);
     }
+    // Tabulate sigma(|k|) for every realization.
+    _sigmaTable.reset(new GaussianRandomFieldSigmaTable(getPowerSpectrum(),getSpacing(),getNx(),getNy(),getNz()));
+    double start(getWallTime());
+    // Create an in-place plan that we reuse for every realization. The measure and patient
+    // strategies overwrite the buffer, which is fine since it has no contents yet.
+    int flags = (_strategy == PatientPlan) ? FFTW_PATIENT :
+        (_strategy == MeasurePlan) ? FFTW_MEASURE : FFTW_ESTIMATE;
+#ifdef HAVE_LIBFFTW3F_THREADS
+    FFTW(plan_with_nthreads)(_nthreads);
+#endif
+    _pimpl->plan = FFTW(plan_dft_c2r_3d)(getNx(),getNy(),getNz(),_pimpl->data,(FftwReal*)_pimpl->data,flags);
+    if(0 == _pimpl->plan) {
+        throw RuntimeError("FftGaussianRandomFieldGenerator: unable to create plan.");
+    }
+    _fftTime += getWallTime() - start;
 #endif
 }
 
 void local::FftGaussianRandomFieldGenerator::generateFieldK() {
 #ifdef HAVE_LIBFFTW3F
-    // Cleanup any previous plan.
-    if(_pimpl->data) FFTW(destroy_plan)(_pimpl->plan);
-    // Generate random (real,imag) components with unit Gaussian distributions.
-    std::size_t ngen(2*_nbuf);
-    _buffer = getRandom()->fillFloatArrayNormal(ngen);
-    // Create a new plan for the new buffer.
-    _pimpl->data = (FFTW(complex)*)&_buffer[0];
-    FftwReal *realData = (FftwReal*)(_pimpl->data);
-    _pimpl->plan = FFTW(plan_dft_c2r_3d)(getNx(),getNy(),getNz(),_pimpl->data,realData,FFTW_ESTIMATE);
-    // Scale each complex value according to the power for the coresponding k-vector.
-    double twopi(8*std::atan(1)), spacing(getSpacing());
-    double dkx = twopi/(getNx()*spacing), dky = twopi/(getNy()*spacing), dkz = twopi/(getNz()*spacing);
-    double dk3 = dkx*dky*dkz/(2*twopi);
-    int nxby2 = getNx()/2, nyby2 = getNy()/2, nzby2 = getNz()/2;
-    for(int ix = 0; ix < getNx(); ++ix) {
-        double kx = (ix > nxby2 ? ix-getNx() : ix)*dkx;
-        for(int iy = 0; iy < getNy(); ++iy) {
-            double ky = (iy > nyby2 ? iy-getNy() : iy)*dky;
-            for(int iz = 0; iz < _halfz; ++iz) {
-                double kz = iz*dkz;
-                double ksq = kx*kx + ky*ky + kz*kz;
-                double sigma(0);
-                if(ksq > 0) {
-                    double k = std::sqrt(ksq);
-                    // Evaluate Deltak = k^3/(2pi^2) P(k)
-                    double Deltak = getPower(k);
-                    // Calculate corresponding RMS for Re,Im parts of delta_k
-                    sigma = std::sqrt(Deltak*dk3/(ksq*k)/2);
-                    //sigma = std::exp(-(k-.2)*(k-.2)/.00001);
-                    //sigma = 1/(ksq);
-                }
-                std::size_t index(iz+_halfz*(iy+getNy()*ix));
-                //std::cout << index << " " << sigma << std::endl;
-                _pimpl->data[index][0] *= sigma;//sigma;
-                _pimpl->data[index][1] *= sigma;//sigma;
+    // Allocate our buffer and plan the first time we are called.
+    if(0 == _pimpl->data) _initialize();
+    // Our buffer holds k-space values until the next transformFieldToR().
+    setFieldView(0,0);
+    // Generate random (real,imag) components with unit Gaussian distributions in place.
+    double start(getWallTime());
+    if(_counterRandom) {
+        _fillCounterNormal();
+    }
+    else {
+        getRandom()->fillArrayNormal((float*)_pimpl->data,2*_nbuf);
+    }
+    _randomTime += getWallTime() - start;
+    // Scale each complex value according to the power for the coresponding k-vector,
+    // using our table of sigma values.
+    start = getWallTime();
+    int nx = getNx(), ny = getNy();
+    int nxby2 = nx/2, nyby2 = ny/2;
+    GaussianRandomFieldSigmaTable const &table(*_sigmaTable);
+    FFTW(complex) *data = _pimpl->data;
+    // Each thread scales a contiguous range of ix slabs.
+#pragma omp parallel for schedule(static) num_threads(_nthreads)
+    for(int ix = 0; ix < nx; ++ix) {
+        int jx = (ix > nxby2 ? ix-nx : ix);
+        for(int iy = 0; iy < ny; ++iy) {
+            int jy = (iy > nyby2 ? iy-ny : iy);
+            std::size_t index(_halfz*(iy+(std::size_t)ny*ix));
+            for(int iz = 0; iz < _halfz; ++iz, ++index) {
+                double sigma = table.getSigma(jx,jy,iz);
+                data[index][0] *= sigma;
+                data[index][1] *= sigma;
             }
         }
     }
+    _scaleTime += getWallTime() - start;
 #endif    
 }
 
+void local::FftGaussianRandomFieldGenerator::setPlanStrategy(Strategy strategy) {
+#ifdef HAVE_LIBFFTW3F
+    if(0 != _pimpl->plan) {
+        throw RuntimeError("FftGaussianRandomFieldGenerator::setPlanStrategy: plan already created.");
+    }
+#endif
+    _strategy = strategy;
+}
+
+void local::FftGaussianRandomFieldGenerator::setNumThreads(int nthreads) {
+    if(nthreads <= 0) {
+        throw RuntimeError("FftGaussianRandomFieldGenerator::setNumThreads: expected nthreads > 0.");
+    }
+#ifdef HAVE_LIBFFTW3F
+    if(0 != _pimpl->plan) {
+        throw RuntimeError("FftGaussianRandomFieldGenerator::setNumThreads: plan already created.");
+    }
+#endif
+    initializeThreads();
+    _nthreads = nthreads;
+}
+
+void local::FftGaussianRandomFieldGenerator::initializeThreads() {
+#ifdef HAVE_LIBFFTW3F_THREADS
+    // FFTW requires a single global initialization before any multithreaded plan.
+    static bool fftwThreadsInitialized(false);
+    if(!fftwThreadsInitialized) {
+        if(0 == FFTW(init_threads)()) {
+            throw RuntimeError("FftGaussianRandomFieldGenerator::initializeThreads: FFTW threads initialization failed.");
+        }
+        fftwThreadsInitialized = true;
+    }
+#endif
+#ifdef HAVE_LIBFFTW3_THREADS
+    // Double-precision plans, e.g. in GridCorrelationEstimator, need their own initialization.
+    static bool fftwdThreadsInitialized(false);
+    if(!fftwdThreadsInitialized) {
+        if(0 == fftw_init_threads()) {
+            throw RuntimeError("FftGaussianRandomFieldGenerator::initializeThreads: FFTW threads initialization failed.");
+        }
+        fftwdThreadsInitialized = true;
+    }
+#endif
+}
+
+void local::FftGaussianRandomFieldGenerator::getTimings(double &randomTime, double &scaleTime, double &fftTime) const {
+    randomTime = _randomTime;
+    scaleTime = _scaleTime;
+    fftTime = _fftTime;
+}
+
+void local::FftGaussianRandomFieldGenerator::setCounterSeed(boost::uint64_t seed, boost::uint64_t realization) {
+    _counterRandom.reset(new PhiloxRandom(seed));
+    _realization = realization;
+}
+
+void local::FftGaussianRandomFieldGenerator::_fillCounterNormal() {
+    // Each mode uses the counter (mode index,realization) so the loop iterations are
+    // independent and can be divided among threads in any way.
+    PhiloxRandom const &random(*_counterRandom);
+    boost::uint64_t realization(_realization++);
+    float *buffer = (float*)_pimpl->data;
+    long nx(getNx()), nyz((long)getNy()*_halfz);
+#pragma omp parallel for schedule(static) num_threads(_nthreads)
+    for(long ix = 0; ix < nx; ++ix) {
+        std::size_t index(nyz*ix);
+        for(long iyz = 0; iyz < nyz; ++iyz, ++index) {
+            double g1,g2;
+            random.getNormalPair(index,realization,g1,g2);
+            buffer[2*index] = (float)g1;
+            buffer[2*index+1] = (float)g2;
+        }
+    }
+}
+
 void local::FftGaussianRandomFieldGenerator::transformFieldToR() {
 #ifdef HAVE_LIBFFTW3F
+    if(0 == _pimpl->plan) {
+        throw RuntimeError("FftGaussianRandomFieldGenerator::transformFieldToR: no k-space field generated yet.");
+    }
     // Do the inverse FFT.
+    double start(getWallTime());
     FFTW(execute)(_pimpl->plan);
+    _fftTime += getWallTime() - start;
+    // The r-space values are stored in place with each z row padded to 2*(nz/2+1) floats.
+    setFieldView((float const*)_pimpl->data,2*_halfz);
 #endif
 }
 
@@ -109,6 +230,25 @@ int local::FftGaussianRandomFieldGenerator::flattenIndex(int kx, int ky, int kz)
     return kz+_halfz*(ky+getNy()*kx);
 }
 
+float const *local::FftGaussianRandomFieldGenerator::getFieldKData() const {
+#ifdef HAVE_LIBFFTW3F
+    if(0 == _pimpl->data) {
+        throw RuntimeError("FftGaussianRandomFieldGenerator::getFieldKData: no k-space field generated yet.");
+    }
+    return (float const*)_pimpl->data;
+#else
+    return 0;
+#endif
+}
+
+float *local::FftGaussianRandomFieldGenerator::getFieldBuffer() {
+#ifdef HAVE_LIBFFTW3F
+    return (float*)_pimpl->data;
+#else
+    return 0;
+#endif
+}
+
 double local::FftGaussianRandomFieldGenerator::getFieldKRe(int kx, int ky, int kz) const {
     if(kx < 0 || kx >= getNx()) {
         throw RuntimeError("FftGaussianRandomFieldGenerator: invalid kx < 0 or >= nx.");
@@ -192,6 +332,19 @@ double local::FftGaussianRandomFieldGenerator::_getFieldUnchecked(int x, int y,
     return (double)realData[index];
 }
 
+void local::FftGaussianRandomFieldGenerator::saveField(std::string const &filename, boost::uint64_t seed) const {
+#ifdef HAVE_LIBFFTW3F
+    if(!hasFieldView()) {
+        throw RuntimeError("FftGaussianRandomFieldGenerator::saveField: no field generated yet.");
+    }
+    GridFileWriter writer(filename,getNx(),getNy(),getNz(),2*_halfz,getSpacing(),
+        GridFileHeader::Float32,seed,hashPowerSpectrum(getPowerSpectrum(),getSpacing(),getNx(),getNy(),getNz()));
+    writer.write((float const*)_pimpl->data,2*_nbuf);
+    writer.close();
+#endif
+}
+
 std::size_t local::FftGaussianRandomFieldGenerator::getMemorySize() const {
-    return sizeof(*this) + (std::size_t)getNx()*getNy()*_halfz*8;
+    return sizeof(*this) + (std::size_t)getNx()*getNy()*_halfz*8 +
+        (_sigmaTable ? _sigmaTable->getMemorySize() : 0);
 }
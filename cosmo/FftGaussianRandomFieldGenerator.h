@@ -6,11 +6,15 @@
 #include "cosmo/AbsGaussianRandomFieldGenerator.h"
 
 #include "boost/smart_ptr.hpp"
+#include "boost/cstdint.hpp"
 
 namespace cosmo {
+    class GaussianRandomFieldSigmaTable;
     // Implements the abstract Gaussian random field generator interface using FFT.
 	class FftGaussianRandomFieldGenerator : public AbsGaussianRandomFieldGenerator {
 	public:
+	    // Planning strategies for the inverse FFT, in order of increasing planning time.
+	    enum Strategy { EstimatePlan, MeasurePlan, PatientPlan };
 		FftGaussianRandomFieldGenerator(PowerSpectrumPtr powerSpectrum, double spacing,
 		    int nx, int ny, int nz, likely::RandomPtr random = likely::RandomPtr());
 		virtual ~FftGaussianRandomFieldGenerator();
@@ -19,6 +23,7 @@ namespace cosmo {
         virtual void generate();
         // Generates a new k-space field realization and stores the results internally. 
         // Use the getReFieldK() and getImFieldK() methods to access generated values.
+        // The r-space field view is unavailable until the next transformFieldToR().
         void generateFieldK();
         // Performs inverse FFT on the stored k-space field to transform to r-space.
         void transformFieldToR();
@@ -30,15 +35,67 @@ namespace cosmo {
         // Returns the imaginary component of the k-space delta field at the specified position
         double getFieldKIm(int kx, int ky, int kz) const;
         int flattenIndex(int kx, int ky, int kz) const;
+        // Returns the stored half of the k-space field as interleaved (re,im) floats with
+        // dimensions (nx,ny,nz/2+1). This is only a k-space field after generateFieldK()
+        // and before transformFieldToR(). Throws a RuntimeError if no field is available.
+        float const *getFieldKData() const;
+        // Saves the most recent r-space realization to the named binary grid file using
+        // the padded z stride 2*(nz/2+1) of our in-place FFT buffer.
+        virtual void saveField(std::string const &filename, boost::uint64_t seed = 0) const;
+        // Uses a counter-based random source keyed by the specified seed instead of our
+        // likely::Random source. The unit Gaussians for each k-space mode are then a function
+        // of (seed,realization,mode) only, so they can be generated in parallel and the
+        // resulting fields do not depend on the number of threads. The realization number
+        // starts at zero and increments with each call to generateFieldK().
+        void setCounterSeed(boost::uint64_t seed, boost::uint64_t realization = 0);
+        // Returns the realization number that the next call to generateFieldK() will use
+        // with a counter-based random source.
+        boost::uint64_t getRealization() const;
+        // Sets the number of threads used to fill and scale the k-space field and, when
+        // FFTW was built with thread support, to perform the inverse FFT. The default is 1.
+        // Threads are only available when the package is built with OpenMP.
+        // Must be called before the first call to generate() or generateFieldK().
+        void setNumThreads(int nthreads);
+        int getNumThreads() const;
+        // Performs the one-time global initialization of single and double precision FFTW
+        // threads, if FFTW was built with thread support. This is called automatically by setNumThreads().
+        static void initializeThreads();
+        // Selects the FFTW planning strategy. Our buffer and plan are created once, by the
+        // first call to generate() or generateFieldK(), and reused for every realization after
+        // that, so the extra planning time of MeasurePlan or PatientPlan is amortized over
+        // repeated realizations. The default is EstimatePlan. Must be called before the first
+        // call to generate() or generateFieldK().
+        void setPlanStrategy(Strategy strategy);
+        // Returns the total wall-clock times in seconds spent generating random numbers,
+        // scaling them by the power spectrum, and planning and executing FFTs.
+        // The one-time buffer allocation and power spectrum tabulation are not included.
+        void getTimings(double &randomTime, double &scaleTime, double &fftTime) const;
+    protected:
+        // Returns our in-place buffer, for subclasses that modify the r-space field after
+        // transformFieldToR(). Returns zero before the first call to generateFieldK().
+        float *getFieldBuffer();
 	private:
         class Implementation;
         int _halfz;
         std::size_t _nbuf;
         boost::scoped_ptr<Implementation> _pimpl;
-        boost::shared_array<float> _buffer;
+        PhiloxRandomPtr _counterRandom;
+        boost::uint64_t _realization;
+        int _nthreads;
+        Strategy _strategy;
+        // Allocates our buffer, tabulates sigma(|k|) and creates our plan.
+        void _initialize();
+        // The RMS of the real and imaginary parts of each k-space mode, tabulated once.
+        boost::scoped_ptr<GaussianRandomFieldSigmaTable> _sigmaTable;
+        double _randomTime, _scaleTime, _fftTime;
+        // Fills our buffer with unit Gaussians from our counter-based random source.
+        void _fillCounterNormal();
         // The getField method calls this after checking for invalid (x,y,z).
         virtual double _getFieldUnchecked(int x, int y, int z) const;
 	}; // FftGaussianRandomFieldGenerator
+
+    inline boost::uint64_t FftGaussianRandomFieldGenerator::getRealization() const { return _realization; }
+    inline int FftGaussianRandomFieldGenerator::getNumThreads() const { return _nthreads; }
 } // cosmo
 
 #endif // COSMO_FFT_GAUSSIAN_RANDOM_FIELD_GENERATOR
@@ -0,0 +1,54 @@
+// Created 18-Oct-2026
+
+#include "cosmo/GaussianRandomFieldSigmaTable.h"
+#include "cosmo/RuntimeError.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace local = cosmo;
+
+local::GaussianRandomFieldSigmaTable::GaussianRandomFieldSigmaTable(PowerSpectrumPtr powerSpectrum,
+double spacing, int nx, int ny, int nz) {
+    if(spacing <= 0) {
+        throw RuntimeError("GaussianRandomFieldSigmaTable: invalid grid spacing.");
+    }
+    if(nx <= 0 || ny <= 0 || nz <= 0) {
+        throw RuntimeError("GaussianRandomFieldSigmaTable: invalid grid size.");
+    }
+    double twopi(8*std::atan(1));
+    _dkx = twopi/(nx*spacing);
+    _dky = twopi/(ny*spacing);
+    _dkz = twopi/(nz*spacing);
+    double dk3 = _dkx*_dky*_dkz/(2*twopi);
+    int nxby2 = nx/2, nyby2 = ny/2, nzby2 = nz/2;
+    _cubic = (nx == ny && ny == nz);
+    std::size_t ntable;
+    if(_cubic) {
+        // A cubic grid has |k|^2 = dk^2 n^2 with integer n^2 <= 3*(n/2)^2.
+        ntable = 3*(std::size_t)nxby2*nxby2 + 1;
+        _dksq = _dkx*_dkx;
+    }
+    else {
+        // Use a table spacing that is a small fraction of the smallest non-zero |k|^2.
+        double dkmin = std::min(_dkx,std::min(_dky,_dkz));
+        _dksq = dkmin*dkmin/16;
+        double ksqmax = (nxby2*_dkx)*(nxby2*_dkx) + (nyby2*_dky)*(nyby2*_dky) + (nzby2*_dkz)*(nzby2*_dkz);
+        ntable = (std::size_t)std::ceil(ksqmax/_dksq) + 2;
+    }
+    _table.resize(ntable);
+    _table[0] = 0;
+    for(std::size_t i = 1; i < ntable; ++i) {
+        double ksq = i*_dksq, k = std::sqrt(ksq);
+        // Evaluate Deltak = k^3/(2pi^2) P(k)
+        double Deltak = (*powerSpectrum)(k);
+        // Calculate corresponding RMS for Re,Im parts of delta_k
+        _table[i] = std::sqrt(Deltak*dk3/(ksq*k)/2);
+    }
+}
+
+local::GaussianRandomFieldSigmaTable::~GaussianRandomFieldSigmaTable() { }
+
+std::size_t local::GaussianRandomFieldSigmaTable::getMemorySize() const {
+    return sizeof(*this) + _table.size()*sizeof(double);
+}
@@ -0,0 +1,47 @@
+// Created 18-Oct-2026
+
+#ifndef COSMO_GAUSSIAN_RANDOM_FIELD_SIGMA_TABLE
+#define COSMO_GAUSSIAN_RANDOM_FIELD_SIGMA_TABLE
+
+#include "cosmo/types.h"
+
+#include <vector>
+#include <cstddef>
+
+namespace cosmo {
+    // Tabulates the RMS of the real and imaginary parts of the k-space modes of a Gaussian
+    // random field on a uniform grid, for a power spectrum k^3/(2pi^2) P(k). The RMS only
+    // depends on |k|^2 so it is tabulated exactly for each integer n^2 = jx^2+jy^2+jz^2 of a
+    // cubic grid, or else on a fine grid in |k|^2 that is linearly interpolated.
+	class GaussianRandomFieldSigmaTable {
+	public:
+	    // Creates a new table for a grid with the specified spacing in Mpc/h and dimensions.
+	    // This is the only time that the power spectrum is evaluated.
+		GaussianRandomFieldSigmaTable(PowerSpectrumPtr powerSpectrum, double spacing,
+		    int nx, int ny, int nz);
+		virtual ~GaussianRandomFieldSigmaTable();
+		// Returns the RMS for the mode with signed integer wavenumbers (jx,jy,jz), which
+		// must satisfy |jx| <= nx/2, |jy| <= ny/2 and |jz| <= nz/2.
+		double getSigma(int jx, int jy, int jz) const;
+		// Returns true if our grid is cubic, so that getSigma is exact.
+		bool isCubic() const;
+		// Returns the memory size in bytes used by this table.
+		std::size_t getMemorySize() const;
+	private:
+        bool _cubic;
+        double _dkx, _dky, _dkz, _dksq;
+        std::vector<double> _table;
+	}; // GaussianRandomFieldSigmaTable
+	
+	inline double GaussianRandomFieldSigmaTable::getSigma(int jx, int jy, int jz) const {
+	    if(_cubic) return _table[jx*jx + jy*jy + jz*jz];
+	    double kx(jx*_dkx), ky(jy*_dky), kz(jz*_dkz);
+	    double t = (kx*kx + ky*ky + kz*kz)/_dksq;
+	    std::size_t it = (std::size_t)t;
+	    return _table[it] + (t - it)*(_table[it+1] - _table[it]);
+	}
+	inline bool GaussianRandomFieldSigmaTable::isCubic() const { return _cubic; }
+
+} // cosmo
+
+#endif // COSMO_GAUSSIAN_RANDOM_FIELD_SIGMA_TABLE
@@ -0,0 +1,266 @@
+// Created 18-Oct-2026
+
+#include "cosmo/GridCorrelationEstimator.h"
+#include "cosmo/FftGaussianRandomFieldGenerator.h"
+#include "cosmo/MappedGridFile.h"
+#include "cosmo/RuntimeError.h"
+
+#include "config.h"
+#ifdef HAVE_LIBFFTW3
+#include "fftw3.h"
+#define FFTWD(X) fftw_ ## X // double transforms
+#endif
+
+#include <cmath>
+#include <algorithm>
+
+namespace local = cosmo;
+
+namespace cosmo {
+    struct GridCorrelationEstimator::Implementation {
+#ifdef HAVE_LIBFFTW3
+        FFTWD(complex) *data;
+        FFTWD(plan) forward, backward;
+#endif
+    };
+} // cosmo::
+
+local::GridCorrelationEstimator::GridCorrelationEstimator(int nx, int ny, int nz, double spacing,
+double rmin, double rmax, int nbins, int ellMax, int losAxis)
+: _nx(nx), _ny(ny), _nz(nz), _halfz(nz/2+1), _nbins(nbins), _ellMax(ellMax), _losAxis(losAxis),
+_nthreads(1), _spacing(spacing), _rmin(rmin), _rmax(rmax), _pimpl(new Implementation())
+{
+#ifdef HAVE_LIBFFTW3
+    _pimpl->data = 0;
+    _pimpl->forward = 0;
+    _pimpl->backward = 0;
+#endif
+    if(nx <= 0 || ny <= 0 || nz <= 0) {
+        throw RuntimeError("GridCorrelationEstimator: invalid grid size.");
+    }
+    if(spacing <= 0) {
+        throw RuntimeError("GridCorrelationEstimator: invalid spacing <= 0.");
+    }
+    if(nbins <= 0) {
+        throw RuntimeError("GridCorrelationEstimator: invalid nbins <= 0.");
+    }
+    if(rmin < 0 || rmax <= rmin) {
+        throw RuntimeError("GridCorrelationEstimator: invalid r range.");
+    }
+    if(ellMax < 0 || ellMax % 2) {
+        throw RuntimeError("GridCorrelationEstimator: ellMax must be even and >= 0.");
+    }
+    if(losAxis < 0 || losAxis > 2) {
+        throw RuntimeError("GridCorrelationEstimator: invalid line-of-sight axis.");
+    }
+    _dr = (rmax - rmin)/nbins;
+    _nstat = 2 + ellMax/2 + 1;
+    // Use a fixed number of x chunks, independent of the number of threads.
+    _nchunks = std::min(nx,64);
+    _sums.resize((std::size_t)nbins*_nstat + 2*(std::size_t)nbins*nbins,0);
+}
+
+local::GridCorrelationEstimator::~GridCorrelationEstimator() {
+#ifdef HAVE_LIBFFTW3
+    if(0 != _pimpl->data) {
+        if(0 != _pimpl->forward) FFTWD(destroy_plan)(_pimpl->forward);
+        if(0 != _pimpl->backward) FFTWD(destroy_plan)(_pimpl->backward);
+        FFTWD(free)(_pimpl->data);
+    }
+#endif
+}
+
+void local::GridCorrelationEstimator::setNumThreads(int nthreads) {
+    if(nthreads <= 0) {
+        throw RuntimeError("GridCorrelationEstimator::setNumThreads: expected nthreads > 0.");
+    }
+#ifdef HAVE_LIBFFTW3
+    if(0 != _pimpl->forward) {
+        throw RuntimeError("GridCorrelationEstimator::setNumThreads: plans already created.");
+    }
+#endif
+    FftGaussianRandomFieldGenerator::initializeThreads();
+    _nthreads = nthreads;
+}
+
+void local::GridCorrelationEstimator::estimate(GaussianRandomFieldView const &field) {
+    if(field.nx != _nx || field.ny != _ny || field.nz != _nz) {
+        throw RuntimeError("GridCorrelationEstimator::estimate: field has wrong dimensions.");
+    }
+    _estimateGrid(field.data,field.zstride,field.step);
+}
+
+void local::GridCorrelationEstimator::estimate(MappedGridFile const &file) {
+    if(file.getNx() != _nx || file.getNy() != _ny || file.getNz() != _nz) {
+        throw RuntimeError("GridCorrelationEstimator::estimate: grid file has wrong dimensions.");
+    }
+    if(file.getDataType() == GridFileHeader::Float32) {
+        _estimateGrid(file.getFloatData(),file.getZStride(),1);
+    }
+    else {
+        _estimateGrid(file.getDoubleData(),file.getZStride(),1);
+    }
+}
+
+template <class T>
+void local::GridCorrelationEstimator::_estimateGrid(T const *data, std::size_t zstride, std::size_t step) {
+#ifdef HAVE_LIBFFTW3
+    // Allocate our buffer and create our in-place plans the first time we are called.
+    std::size_t nbuf = (std::size_t)_nx*_ny*_halfz;
+    double *buffer;
+    if(0 == _pimpl->data) {
+        _pimpl->data = (FFTWD(complex)*)FFTWD(malloc)(sizeof(FFTWD(complex))*nbuf);
+        if(0 == _pimpl->data) {
+            throw RuntimeError("GridCorrelationEstimator: unable to allocate FFT buffer.");
+        }
+        buffer = (double*)_pimpl->data;
+#ifdef HAVE_LIBFFTW3_THREADS
+        FFTWD(plan_with_nthreads)(_nthreads);
+#endif
+        _pimpl->forward = FFTWD(plan_dft_r2c_3d)(_nx,_ny,_nz,buffer,_pimpl->data,FFTW_ESTIMATE);
+        _pimpl->backward = FFTWD(plan_dft_c2r_3d)(_nx,_ny,_nz,_pimpl->data,buffer,FFTW_ESTIMATE);
+    }
+    buffer = (double*)_pimpl->data;
+    // Copy the grid into our padded buffer.
+    int nx(_nx), ny(_ny), nz(_nz), halfz(_halfz);
+#pragma omp parallel for schedule(static) num_threads(_nthreads)
+    for(int ix = 0; ix < nx; ++ix) {
+        for(int iy = 0; iy < ny; ++iy) {
+            T const *in = data + zstride*(iy + (std::size_t)ny*ix);
+            double *out = buffer + 2*halfz*(iy + (std::size_t)ny*ix);
+            for(int iz = 0; iz < nz; ++iz) out[iz] = in[step*iz];
+        }
+    }
+    // Replace delta_k with |delta_k|^2/N^2 and transform back, which gives the mean of
+    // delta(x) delta(x+s) over all N grid points x, for each lag s. This is done in double
+    // precision since xi at large s is a small difference of large terms.
+    FFTWD(execute)(_pimpl->forward);
+    double ntot = (double)_nx*_ny*_nz;
+    double norm = 1/(ntot*ntot);
+    FFTWD(complex) *modes = _pimpl->data;
+    long nmodes((long)nbuf);
+#pragma omp parallel for schedule(static) num_threads(_nthreads)
+    for(long index = 0; index < nmodes; ++index) {
+        modes[index][0] = norm*(modes[index][0]*modes[index][0] + modes[index][1]*modes[index][1]);
+        modes[index][1] = 0;
+    }
+    FFTWD(execute)(_pimpl->backward);
+    _binLags();
+#else
+    throw RuntimeError("GridCorrelationEstimator: package not built with FFTW3.");
+#endif
+}
+
+int local::GridCorrelationEstimator::_getBin(double r) const {
+    if(r < _rmin || r >= _rmax) return -1;
+    int bin = (int)std::floor((r - _rmin)/_dr);
+    return bin < _nbins ? bin : -1;
+}
+
+void local::GridCorrelationEstimator::_binLags() {
+#ifdef HAVE_LIBFFTW3
+    double const *xi = (double const*)_pimpl->data;
+    int nx(_nx), ny(_ny), nz(_nz), halfz(_halfz), nbins(_nbins), nstat(_nstat);
+    int ellMax(_ellMax), losAxis(_losAxis), nchunks(_nchunks);
+    double spacing(_spacing);
+    std::size_t nsums(_sums.size()), offset2d((std::size_t)nbins*nstat);
+    _chunkSums.assign(nsums*nchunks,0);
+#pragma omp parallel for schedule(dynamic) num_threads(_nthreads)
+    for(int chunk = 0; chunk < nchunks; ++chunk) {
+        double *sums = &_chunkSums[nsums*chunk];
+        std::vector<double> legendre(ellMax+1,1);
+        int ix1 = (int)(((long)nx*chunk)/nchunks), ix2 = (int)(((long)nx*(chunk+1))/nchunks);
+        for(int ix = ix1; ix < ix2; ++ix) {
+            // Use the minimum image of each periodic lag.
+            double dx = spacing*(ix > nx/2 ? ix-nx : ix);
+            for(int iy = 0; iy < ny; ++iy) {
+                double dy = spacing*(iy > ny/2 ? iy-ny : iy);
+                double const *row = xi + 2*halfz*(iy + (std::size_t)ny*ix);
+                for(int iz = 0; iz < nz; ++iz) {
+                    double dz = spacing*(iz > nz/2 ? iz-nz : iz);
+                    double value(row[iz]);
+                    double rsq = dx*dx + dy*dy + dz*dz, r = std::sqrt(rsq);
+                    double rpar = std::fabs(losAxis == 0 ? dx : losAxis == 1 ? dy : dz);
+                    int bin = _getBin(r);
+                    if(bin >= 0) {
+                        double *stat = sums + (std::size_t)nstat*bin;
+                        stat[0] += 1;
+                        stat[1] += r;
+                        stat[2] += value;
+                        if(ellMax > 0 && r > 0) {
+                            double mu = rpar/r;
+                            legendre[1] = mu;
+                            for(int ell = 2; ell <= ellMax; ++ell) {
+                                legendre[ell] = ((2*ell-1)*mu*legendre[ell-1] - (ell-1)*legendre[ell-2])/ell;
+                            }
+                            for(int ell = 2; ell <= ellMax; ell += 2) {
+                                stat[2+ell/2] += value*legendre[ell];
+                            }
+                        }
+                    }
+                    int parBin = _getBin(rpar), perpBin = _getBin(std::sqrt(rsq - rpar*rpar));
+                    if(parBin >= 0 && perpBin >= 0) {
+                        double *stat = sums + offset2d + 2*(perpBin + (std::size_t)nbins*parBin);
+                        stat[0] += 1;
+                        stat[1] += value;
+                    }
+                }
+            }
+        }
+    }
+    // Sum the chunks in a fixed order so that the results do not depend on the threads used.
+    std::fill(_sums.begin(),_sums.end(),0.);
+    for(int chunk = 0; chunk < nchunks; ++chunk) {
+        double const *sums = &_chunkSums[nsums*chunk];
+        for(std::size_t i = 0; i < nsums; ++i) _sums[i] += sums[i];
+    }
+#endif
+}
+
+void local::GridCorrelationEstimator::_checkBin(int bin) const {
+    if(bin < 0 || bin >= _nbins) {
+        throw RuntimeError("GridCorrelationEstimator: invalid bin index.");
+    }
+}
+
+double local::GridCorrelationEstimator::getBinCenter(int bin) const {
+    _checkBin(bin);
+    return _rmin + (bin+.5)*_dr;
+}
+
+double local::GridCorrelationEstimator::getNumLags(int bin) const {
+    _checkBin(bin);
+    return _sums[(std::size_t)_nstat*bin];
+}
+
+double local::GridCorrelationEstimator::getMeanR(int bin) const {
+    double nlags = getNumLags(bin);
+    return nlags > 0 ? _sums[(std::size_t)_nstat*bin+1]/nlags : 0;
+}
+
+double local::GridCorrelationEstimator::getCorrelation(int bin, int ell) const {
+    if(ell < 0 || ell > _ellMax || ell % 2) {
+        throw RuntimeError("GridCorrelationEstimator::getCorrelation: invalid multipole.");
+    }
+    double nlags = getNumLags(bin);
+    return nlags > 0 ? (2*ell+1)*_sums[(std::size_t)_nstat*bin+2+ell/2]/nlags : 0;
+}
+
+double local::GridCorrelationEstimator::getNumLags2D(int perpBin, int parBin) const {
+    _checkBin(perpBin);
+    _checkBin(parBin);
+    return _sums[(std::size_t)_nstat*_nbins + 2*(perpBin + (std::size_t)_nbins*parBin)];
+}
+
+double local::GridCorrelationEstimator::getCorrelation2D(int perpBin, int parBin) const {
+    double nlags = getNumLags2D(perpBin,parBin);
+    return nlags > 0 ? _sums[(std::size_t)_nstat*_nbins + 2*(perpBin + (std::size_t)_nbins*parBin) + 1]/nlags : 0;
+}
+
+std::size_t local::GridCorrelationEstimator::getMemorySize() const {
+    return sizeof(*this) + (_chunkSums.size() + _sums.size())*sizeof(double) +
+#ifdef HAVE_LIBFFTW3
+        (_pimpl->data ? (std::size_t)_nx*_ny*_halfz*16 : 0) +
+#endif
+        0;
+}
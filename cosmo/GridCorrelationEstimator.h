@@ -0,0 +1,72 @@
+// Created 18-Oct-2026
+
+#ifndef COSMO_GRID_CORRELATION_ESTIMATOR
+#define COSMO_GRID_CORRELATION_ESTIMATOR
+
+#include "cosmo/AbsGaussianRandomFieldGenerator.h"
+
+#include "boost/smart_ptr.hpp"
+
+#include <vector>
+#include <cstddef>
+
+namespace cosmo {
+    class MappedGridFile;
+    // Calculates the exact correlation function xi of a field on a uniform periodic grid,
+    // averaged over all pairs of grid points, as the inverse FFT of |delta_k|^2. Each lag
+    // vector on the grid then represents N = nx*ny*nz pairs, and lags are binned in r,
+    // in (rperp,rpar) and as even multipoles relative to a line of sight along one of the
+    // grid axes. The transforms are done in double precision, using 16 bytes per complex
+    // mode, since xi at large r is a small difference of large terms. Lags are accumulated
+    // in a fixed number of x chunks that are summed in order, so the results do not depend
+    // on the number of threads.
+	class GridCorrelationEstimator {
+	public:
+	    // Creates a new estimator for a grid with the specified dimensions and spacing in
+	    // Mpc/h, using nbins bins from rmin to rmax in Mpc/h for r, rperp and |rpar|.
+	    // Multipoles up to the even value ellMax are calculated relative to the line-of-sight
+	    // axis 0 (x), 1 (y) or 2 (z).
+		GridCorrelationEstimator(int nx, int ny, int nz, double spacing, double rmin, double rmax,
+		    int nbins, int ellMax = 0, int losAxis = 2);
+		virtual ~GridCorrelationEstimator();
+		// Sets the number of threads to use for each estimate. The default is 1.
+		void setNumThreads(int nthreads);
+		int getNumThreads() const;
+		// Estimates the correlation function of an r-space grid.
+		void estimate(GaussianRandomFieldView const &field);
+		void estimate(MappedGridFile const &file);
+		// Accessors for the binning.
+		int getNBins() const;
+		int getEllMax() const;
+		double getBinCenter(int bin) const;
+		// Returns the results of the last estimate for the specified r bin: the number of
+		// lags in the bin, their mean separation and the mean xi or its multipole ell.
+		double getNumLags(int bin) const;
+		double getMeanR(int bin) const;
+		double getCorrelation(int bin, int ell = 0) const;
+		// Returns the results of the last estimate for the specified (rperp,rpar) bins.
+		double getNumLags2D(int perpBin, int parBin) const;
+		double getCorrelation2D(int perpBin, int parBin) const;
+		// Returns the memory size in bytes required for this estimator.
+		std::size_t getMemorySize() const;
+	private:
+        class Implementation;
+        int _nx, _ny, _nz, _halfz, _nbins, _ellMax, _losAxis, _nthreads, _nstat, _nchunks;
+        double _spacing, _rmin, _rmax, _dr;
+        boost::scoped_ptr<Implementation> _pimpl;
+        // Per-chunk and total sums of count, count*r and xi*L_ell(mu) for each r bin,
+        // followed by count and xi for each (rperp,rpar) bin.
+        std::vector<double> _chunkSums, _sums;
+        template <class T> void _estimateGrid(T const *data, std::size_t zstride, std::size_t step);
+        void _binLags();
+        int _getBin(double r) const;
+        void _checkBin(int bin) const;
+	}; // GridCorrelationEstimator
+
+	inline int GridCorrelationEstimator::getNumThreads() const { return _nthreads; }
+	inline int GridCorrelationEstimator::getNBins() const { return _nbins; }
+	inline int GridCorrelationEstimator::getEllMax() const { return _ellMax; }
+
+} // cosmo
+
+#endif // COSMO_GRID_CORRELATION_ESTIMATOR
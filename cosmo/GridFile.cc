@@ -0,0 +1,50 @@
+// Created 18-Oct-2026
+
+#include "cosmo/GridFile.h"
+#include "cosmo/RuntimeError.h"
+
+#include "boost/static_assert.hpp"
+
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+
+namespace local = cosmo;
+
+// The data that follows the header is aligned for any value type.
+BOOST_STATIC_ASSERT(sizeof(local::GridFileHeader) == 64);
+
+int local::getGridFileValueSize(GridFileHeader::DataType dataType) {
+    switch(dataType) {
+        case GridFileHeader::Float32:
+        return 4;
+        case GridFileHeader::Float64:
+        return 8;
+    }
+    throw RuntimeError("getGridFileValueSize: invalid data type.");
+}
+
+boost::uint64_t local::hashPowerSpectrum(PowerSpectrumPtr powerSpectrum, double spacing,
+int nx, int ny, int nz) {
+    // Use 64-bit FNV-1a on the bytes of the power evaluated at 64 log-spaced k values
+    // from the smallest non-zero |k| of the grid to its largest |k| at the Nyquist corner,
+    // which a tabulated P(k) must already cover to generate the grid.
+    boost::uint64_t hash(14695981039346656037ULL);
+    if(!powerSpectrum) return 0;
+    double twopi(8*std::atan(1));
+    double kx(twopi/(nx*spacing)), ky(twopi/(ny*spacing)), kz(twopi/(nz*spacing));
+    double kmin = twopi/(std::max(nx,std::max(ny,nz))*spacing);
+    double kmax = std::sqrt((nx/2)*kx*(nx/2)*kx + (ny/2)*ky*(ny/2)*ky + (nz/2)*kz*(nz/2)*kz);
+    if(kmax < kmin) return hash;
+    for(int i = 0; i < 64; ++i) {
+        double k = std::min(kmax,std::max(kmin,kmin*std::exp(std::log(kmax/kmin)*i/63.)));
+        double pk = (*powerSpectrum)(k);
+        unsigned char bytes[sizeof(double)];
+        std::memcpy(bytes,&pk,sizeof(double));
+        for(std::size_t j = 0; j < sizeof(double); ++j) {
+            hash ^= bytes[j];
+            hash *= 1099511628211ULL;
+        }
+    }
+    return hash;
+}
@@ -0,0 +1,36 @@
+// Created 18-Oct-2026
+
+#ifndef COSMO_GRID_FILE
+#define COSMO_GRID_FILE
+
+#include "cosmo/types.h"
+
+#include "boost/cstdint.hpp"
+
+namespace cosmo {
+    // Describes the fixed 64-byte header at the start of a binary grid file. The header is
+    // followed by nx*ny*zstride values of the specified data type, with z varying fastest,
+    // then y, then x. Only the first nz of each zstride values along z are used, so that
+    // zstride = 2*(nz/2+1) matches the padded layout of an in-place FFTW real transform and
+    // zstride = nz is unpadded. Values are stored in the native byte order, which is
+    // recorded so that readers can detect a mismatch.
+    struct GridFileHeader {
+        enum DataType { Float32 = 1, Float64 = 2 };
+        char magic[8];
+        boost::uint32_t version, byteOrder, dataType, nx, ny, nz, zstride, reserved;
+        double spacing;
+        boost::uint64_t seed, powerHash;
+    }; // GridFileHeader
+
+    // Returns the number of bytes per value for the specified grid file data type.
+    int getGridFileValueSize(GridFileHeader::DataType dataType);
+    
+    // Returns a hash of the specified power spectrum function based on its values at
+    // log-spaced wavenumbers within the |k| range of a grid with the specified spacing
+    // and dimensions, for recording the power used to generate that grid.
+    boost::uint64_t hashPowerSpectrum(PowerSpectrumPtr powerSpectrum, double spacing,
+        int nx, int ny, int nz);
+
+} // cosmo
+
+#endif // COSMO_GRID_FILE
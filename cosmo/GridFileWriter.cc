@@ -0,0 +1,72 @@
+// Created 18-Oct-2026
+
+#include "cosmo/GridFileWriter.h"
+#include "cosmo/RuntimeError.h"
+
+#include <cstring>
+
+namespace local = cosmo;
+
+local::GridFileWriter::GridFileWriter(std::string const &filename, int nx, int ny, int nz, int zstride,
+double spacing, GridFileHeader::DataType dataType, boost::uint64_t seed, boost::uint64_t powerHash)
+: _dataType(dataType)
+{
+    if(nx <= 0 || ny <= 0 || nz <= 0) {
+        throw RuntimeError("GridFileWriter: invalid grid size.");
+    }
+    if(0 == zstride) zstride = nz;
+    if(zstride < nz) {
+        throw RuntimeError("GridFileWriter: invalid zstride < nz.");
+    }
+    getGridFileValueSize(dataType);
+    GridFileHeader header;
+    std::memset(&header,0,sizeof(header));
+    std::memcpy(header.magic,"COSMOGRD",8);
+    header.version = 1;
+    header.byteOrder = 0x01020304u;
+    header.dataType = dataType;
+    header.nx = nx;
+    header.ny = ny;
+    header.nz = nz;
+    header.zstride = zstride;
+    header.spacing = spacing;
+    header.seed = seed;
+    header.powerHash = powerHash;
+    _out.open(filename.c_str(),std::ios::binary | std::ios::trunc);
+    _out.write((char const*)&header,sizeof(header));
+    if(!_out.good()) {
+        throw RuntimeError("GridFileWriter: unable to write " + filename);
+    }
+    _remaining = (std::size_t)nx*ny*zstride;
+}
+
+local::GridFileWriter::~GridFileWriter() { }
+
+void local::GridFileWriter::write(float const *values, std::size_t nvalues) {
+    _write((char const*)values,nvalues,GridFileHeader::Float32);
+}
+
+void local::GridFileWriter::write(double const *values, std::size_t nvalues) {
+    _write((char const*)values,nvalues,GridFileHeader::Float64);
+}
+
+void local::GridFileWriter::_write(char const *bytes, std::size_t nvalues, GridFileHeader::DataType dataType) {
+    if(dataType != _dataType) {
+        throw RuntimeError("GridFileWriter::write: wrong data type.");
+    }
+    if(nvalues > _remaining) {
+        throw RuntimeError("GridFileWriter::write: too many values.");
+    }
+    _out.write(bytes,(std::streamsize)(nvalues*getGridFileValueSize(dataType)));
+    if(!_out.good()) {
+        throw RuntimeError("GridFileWriter::write: error writing values.");
+    }
+    _remaining -= nvalues;
+}
+
+void local::GridFileWriter::close() {
+    if(_remaining > 0) {
+        throw RuntimeError("GridFileWriter::close: file is incomplete.");
+    }
+    _out.close();
+}
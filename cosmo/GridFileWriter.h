@@ -0,0 +1,44 @@
+// Created 18-Oct-2026
+
+#ifndef COSMO_GRID_FILE_WRITER
+#define COSMO_GRID_FILE_WRITER
+
+#include "cosmo/GridFile.h"
+
+#include "boost/cstdint.hpp"
+
+#include <string>
+#include <fstream>
+#include <cstddef>
+
+namespace cosmo {
+    // Writes a binary grid file, described by GridFileHeader, that can be memory mapped
+    // by MappedGridFile.
+	class GridFileWriter {
+	public:
+	    // Opens the named file and writes a header for a grid with the specified dimensions,
+	    // z stride (or zero for zstride = nz), spacing in Mpc/h, random seed and power
+	    // spectrum hash.
+		GridFileWriter(std::string const &filename, int nx, int ny, int nz, int zstride,
+		    double spacing, GridFileHeader::DataType dataType = GridFileHeader::Float32,
+		    boost::uint64_t seed = 0, boost::uint64_t powerHash = 0);
+		virtual ~GridFileWriter();
+		// Appends the specified values to the file, which must have our data type.
+		void write(float const *values, std::size_t nvalues);
+		void write(double const *values, std::size_t nvalues);
+		// Closes the file after checking that all nx*ny*zstride values have been written.
+		void close();
+		// Returns the number of values that remain to be written.
+		std::size_t getRemaining() const;
+	private:
+        std::ofstream _out;
+        GridFileHeader::DataType _dataType;
+        std::size_t _remaining;
+        void _write(char const *bytes, std::size_t nvalues, GridFileHeader::DataType dataType);
+	}; // GridFileWriter
+	
+	inline std::size_t GridFileWriter::getRemaining() const { return _remaining; }
+
+} // cosmo
+
+#endif // COSMO_GRID_FILE_WRITER
@@ -0,0 +1,258 @@
+// Created 18-Oct-2026
+
+#include "cosmo/GridPeakStacker.h"
+#include "cosmo/FftGaussianRandomFieldGenerator.h"
+#include "cosmo/RuntimeError.h"
+
+#include "config.h"
+#ifdef HAVE_LIBFFTW3F
+#include "fftw3.h"
+#define FFTW(X) fftwf_ ## X // float transforms
+#endif
+
+#include <cmath>
+#include <algorithm>
+
+namespace local = cosmo;
+
+namespace cosmo {
+    struct GridPeakStacker::Implementation {
+#ifdef HAVE_LIBFFTW3F
+        FFTW(complex) *data;
+        FFTW(plan) forward, backward;
+#endif
+    };
+} // cosmo::
+
+namespace {
+    // Orders peaks from most to least extreme, breaking ties by grid index.
+    struct PeakOrder {
+        PeakOrder(bool minima) : _minima(minima) { }
+        bool operator()(std::pair<float,std::size_t> const &a, std::pair<float,std::size_t> const &b) const {
+            if(a.first != b.first) return _minima ? a.first < b.first : a.first > b.first;
+            return a.second < b.second;
+        }
+        bool _minima;
+    };
+} // anonymous
+
+local::GridPeakStacker::GridPeakStacker(int nx, int ny, int nz)
+: _nx(nx), _ny(ny), _nz(nz), _halfz(nz/2+1), _nthreads(1), _pimpl(new Implementation())
+{
+#ifdef HAVE_LIBFFTW3F
+    _pimpl->data = 0;
+    _pimpl->forward = 0;
+    _pimpl->backward = 0;
+#else
+    throw RuntimeError("GridPeakStacker: package not built with FFTW3.");
+#endif
+    if(nx <= 0 || ny <= 0 || nz <= 0) {
+        throw RuntimeError("GridPeakStacker: invalid grid size.");
+    }
+    _nbuf = (std::size_t)nx*ny*_halfz;
+}
+
+local::GridPeakStacker::~GridPeakStacker() {
+#ifdef HAVE_LIBFFTW3F
+    if(0 != _pimpl->data) {
+        if(0 != _pimpl->forward) FFTW(destroy_plan)(_pimpl->forward);
+        if(0 != _pimpl->backward) FFTW(destroy_plan)(_pimpl->backward);
+        FFTW(free)(_pimpl->data);
+    }
+#endif
+}
+
+void local::GridPeakStacker::setNumThreads(int nthreads) {
+    if(nthreads <= 0) {
+        throw RuntimeError("GridPeakStacker::setNumThreads: expected nthreads > 0.");
+    }
+#ifdef HAVE_LIBFFTW3F
+    if(0 != _pimpl->forward) {
+        throw RuntimeError("GridPeakStacker::setNumThreads: plans already created.");
+    }
+#endif
+    FftGaussianRandomFieldGenerator::initializeThreads();
+    _nthreads = nthreads;
+}
+
+void local::GridPeakStacker::findPeaks(GaussianRandomFieldView const &field, double nu, int maxPeaks,
+bool minima) {
+    if(field.nx != _nx || field.ny != _ny || field.nz != _nz) {
+        throw RuntimeError("GridPeakStacker::findPeaks: field has wrong dimensions.");
+    }
+    int nx(_nx), ny(_ny), nz(_nz);
+    // Calculate the field RMS, summing each x slab separately and then in order.
+    std::vector<double> slabSumsq(nx,0);
+#pragma omp parallel for schedule(static) num_threads(_nthreads)
+    for(int ix = 0; ix < nx; ++ix) {
+        double sumsq(0);
+        for(int iy = 0; iy < ny; ++iy) {
+            float const *row(field.getRow(ix,iy));
+            for(int iz = 0; iz < nz; ++iz) {
+                double value(row[field.step*iz]);
+                sumsq += value*value;
+            }
+        }
+        slabSumsq[ix] = sumsq;
+    }
+    double sumsq(0);
+    for(int ix = 0; ix < nx; ++ix) sumsq += slabSumsq[ix];
+    float threshold = (float)(nu*std::sqrt(sumsq/((double)nx*ny*nz)));
+    if(minima) threshold = -threshold;
+    // Find the candidates in each x slab, then collect them in slab order.
+    std::vector<std::vector<std::pair<float,std::size_t> > > slabPeaks(nx);
+#pragma omp parallel for schedule(dynamic) num_threads(_nthreads)
+    for(int ix = 0; ix < nx; ++ix) {
+        for(int iy = 0; iy < ny; ++iy) {
+            for(int iz = 0; iz < nz; ++iz) {
+                float value(field(ix,iy,iz));
+                if(minima ? !(value < threshold) : !(value > threshold)) continue;
+                bool isPeak(true);
+                for(int dx = -1; dx <= 1 && isPeak; ++dx) {
+                    int jx = (ix + dx + nx) % nx;
+                    for(int dy = -1; dy <= 1 && isPeak; ++dy) {
+                        int jy = (iy + dy + ny) % ny;
+                        for(int dz = -1; dz <= 1; ++dz) {
+                            if(0 == dx && 0 == dy && 0 == dz) continue;
+                            float neighbor(field(jx,jy,(iz + dz + nz) % nz));
+                            if(minima ? !(value < neighbor) : !(value > neighbor)) {
+                                isPeak = false;
+                                break;
+                            }
+                        }
+                    }
+                }
+                if(isPeak) {
+                    slabPeaks[ix].push_back(std::make_pair(value,iz + nz*(iy + (std::size_t)ny*ix)));
+                }
+            }
+        }
+    }
+    std::vector<std::pair<float,std::size_t> > peaks;
+    for(int ix = 0; ix < nx; ++ix) peaks.insert(peaks.end(),slabPeaks[ix].begin(),slabPeaks[ix].end());
+    std::sort(peaks.begin(),peaks.end(),PeakOrder(minima));
+    if(maxPeaks > 0 && (int)peaks.size() > maxPeaks) peaks.resize(maxPeaks);
+    _peakIndex.resize(peaks.size());
+    _peakValue.resize(peaks.size());
+    for(std::size_t i = 0; i < peaks.size(); ++i) {
+        _peakValue[i] = peaks[i].first;
+        _peakIndex[i] = peaks[i].second;
+    }
+}
+
+void local::GridPeakStacker::getPeak(int index, int &x, int &y, int &z) const {
+    if(index < 0 || index >= getNumPeaks()) {
+        throw RuntimeError("GridPeakStacker::getPeak: invalid peak index.");
+    }
+    std::size_t flat(_peakIndex[index]);
+    z = (int)(flat % _nz);
+    y = (int)((flat/_nz) % _ny);
+    x = (int)(flat/((std::size_t)_nz*_ny));
+}
+
+double local::GridPeakStacker::getPeakValue(int index) const {
+    if(index < 0 || index >= getNumPeaks()) {
+        throw RuntimeError("GridPeakStacker::getPeakValue: invalid peak index.");
+    }
+    return _peakValue[index];
+}
+
+void local::GridPeakStacker::_initialize() {
+#ifdef HAVE_LIBFFTW3F
+    // Our buffer holds the peak indicator, the field and its square, in that order.
+    _pimpl->data = (FFTW(complex)*)FFTW(malloc)(sizeof(FFTW(complex))*_nbuf*3);
+    if(0 == _pimpl->data) {
+        throw RuntimeError("GridPeakStacker: unable to allocate FFT buffer.");
+    }
+    float *buffer = (float*)_pimpl->data;
+    std::fill(buffer,buffer + 6*_nbuf,0.f);
+#ifdef HAVE_LIBFFTW3F_THREADS
+    FFTW(plan_with_nthreads)(_nthreads);
+#endif
+    int dims[3] = { _nx, _ny, _nz };
+    int realEmbed[3] = { _nx, _ny, 2*_halfz };
+    int complexEmbed[3] = { _nx, _ny, _halfz };
+    // Transform all three grids forward, then only the two cross correlations back.
+    _pimpl->forward = FFTW(plan_many_dft_r2c)(3,dims,3,buffer,realEmbed,1,(int)(2*_nbuf),
+        _pimpl->data,complexEmbed,1,(int)_nbuf,FFTW_ESTIMATE);
+    _pimpl->backward = FFTW(plan_many_dft_c2r)(3,dims,2,_pimpl->data+_nbuf,complexEmbed,1,(int)_nbuf,
+        buffer+2*_nbuf,realEmbed,1,(int)(2*_nbuf),FFTW_ESTIMATE);
+    if(0 == _pimpl->forward || 0 == _pimpl->backward) {
+        throw RuntimeError("GridPeakStacker: unable to create FFT plans.");
+    }
+#endif
+}
+
+void local::GridPeakStacker::stack(GaussianRandomFieldView const &field) {
+#ifdef HAVE_LIBFFTW3F
+    if(field.nx != _nx || field.ny != _ny || field.nz != _nz) {
+        throw RuntimeError("GridPeakStacker::stack: field has wrong dimensions.");
+    }
+    if(0 == _pimpl->data) _initialize();
+    float *indicator = (float*)_pimpl->data, *values = indicator + 2*_nbuf, *squares = values + 2*_nbuf;
+    // Fill the padded grids of the peak indicator, the field and its square.
+    int nx(_nx), ny(_ny), nz(_nz), halfz(_halfz);
+#pragma omp parallel for schedule(static) num_threads(_nthreads)
+    for(int ix = 0; ix < nx; ++ix) {
+        for(int iy = 0; iy < ny; ++iy) {
+            float const *in(field.getRow(ix,iy));
+            std::size_t offset(2*halfz*(iy + (std::size_t)ny*ix));
+            for(int iz = 0; iz < nz; ++iz) {
+                float value(in[field.step*iz]);
+                indicator[offset+iz] = 0;
+                values[offset+iz] = value;
+                squares[offset+iz] = value*value;
+            }
+        }
+    }
+    for(std::size_t i = 0; i < _peakIndex.size(); ++i) {
+        std::size_t flat(_peakIndex[i]);
+        std::size_t row(flat/nz);
+        indicator[2*halfz*row + flat%nz] = 1;
+    }
+    FFTW(execute)(_pimpl->forward);
+    // Multiply each transformed grid by 1/N times the conjugate of the transformed
+    // indicator. The inverse transform then gives the sum over peaks at each lag.
+    FFTW(complex) *modes = _pimpl->data;
+    long nbuf((long)_nbuf);
+    float norm = (float)(1/((double)nx*ny*nz));
+#pragma omp parallel for schedule(static) num_threads(_nthreads)
+    for(long index = 0; index < nbuf; ++index) {
+        float pre(norm*modes[index][0]), pim(-norm*modes[index][1]);
+        for(int slot = 1; slot <= 2; ++slot) {
+            FFTW(complex) &mode = modes[index + nbuf*slot];
+            float re(mode[0]), im(mode[1]);
+            mode[0] = pre*re - pim*im;
+            mode[1] = pre*im + pim*re;
+        }
+    }
+    FFTW(execute)(_pimpl->backward);
+#endif
+}
+
+local::GaussianRandomFieldView local::GridPeakStacker::getSumView() const {
+    GaussianRandomFieldView view;
+    view.nx = _nx;
+    view.ny = _ny;
+    view.nz = _nz;
+    view.zstride = 2*_halfz;
+    view.step = 1;
+    view.data = 0;
+#ifdef HAVE_LIBFFTW3F
+    if(0 != _pimpl->data) view.data = (float const*)(_pimpl->data + _nbuf);
+#endif
+    if(0 == view.data) {
+        throw RuntimeError("GridPeakStacker::getSumView: no stack available.");
+    }
+    return view;
+}
+
+local::GaussianRandomFieldView local::GridPeakStacker::getSquareSumView() const {
+    GaussianRandomFieldView view(getSumView());
+    view.data += 2*_nbuf;
+    return view;
+}
+
+std::size_t local::GridPeakStacker::getMemorySize() const {
+    return sizeof(*this) + 3*_nbuf*8 + _peakIndex.size()*(sizeof(std::size_t) + sizeof(float));
+}
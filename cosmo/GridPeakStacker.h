@@ -0,0 +1,63 @@
+// Created 18-Oct-2026
+
+#ifndef COSMO_GRID_PEAK_STACKER
+#define COSMO_GRID_PEAK_STACKER
+
+#include "cosmo/AbsGaussianRandomFieldGenerator.h"
+
+#include "boost/smart_ptr.hpp"
+
+#include <vector>
+#include <cstddef>
+
+namespace cosmo {
+    // Stacks a field on all of its peaks at once. The sums over peaks p of field(p+s) and
+    // field(p+s)^2 for every lag s on a periodic grid are the cross correlations of a peak
+    // indicator field with the field and its square, which are calculated with FFTs at a
+    // cost that does not depend on the number of peaks.
+	class GridPeakStacker {
+	public:
+	    // Creates a new stacker for fields with the specified grid dimensions.
+		GridPeakStacker(int nx, int ny, int nz);
+		virtual ~GridPeakStacker();
+		// Sets the number of threads to use. The default is 1. Must be called before the
+		// first call to stack().
+		void setNumThreads(int nthreads);
+		int getNumThreads() const;
+		// Finds the peaks of the specified field, which are the grid points whose value is
+		// strictly greater (or less, for minima) than each of their 26 periodic neighbours
+		// and than nu (or -nu, for minima) times the field RMS. If maxPeaks > 0, only the
+		// maxPeaks most extreme of these are kept. Peaks are ordered from most to least
+		// extreme, and the results do not depend on the number of threads.
+		void findPeaks(GaussianRandomFieldView const &field, double nu, int maxPeaks = 0,
+		    bool minima = false);
+		// Returns the number of peaks found by the last call to findPeaks().
+		int getNumPeaks() const;
+		// Returns the grid position and field value of the specified peak.
+		void getPeak(int index, int &x, int &y, int &z) const;
+		double getPeakValue(int index) const;
+		// Stacks the specified field on the peaks found by the last call to findPeaks().
+		void stack(GaussianRandomFieldView const &field);
+		// Return views of the sums over peaks of field(p+s) and field(p+s)^2 for each
+		// lag s, calculated by the last call to stack().
+		GaussianRandomFieldView getSumView() const;
+		GaussianRandomFieldView getSquareSumView() const;
+		// Returns the memory size in bytes required for this stacker.
+		std::size_t getMemorySize() const;
+	private:
+        class Implementation;
+        int _nx, _ny, _nz, _halfz, _nthreads;
+        std::size_t _nbuf;
+        boost::scoped_ptr<Implementation> _pimpl;
+        // The flat index (z + nz*(y + ny*x)) and value of each peak.
+        std::vector<std::size_t> _peakIndex;
+        std::vector<float> _peakValue;
+        void _initialize();
+	}; // GridPeakStacker
+
+	inline int GridPeakStacker::getNumThreads() const { return _nthreads; }
+	inline int GridPeakStacker::getNumPeaks() const { return (int)_peakIndex.size(); }
+
+} // cosmo
+
+#endif // COSMO_GRID_PEAK_STACKER
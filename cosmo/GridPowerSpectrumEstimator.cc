@@ -0,0 +1,274 @@
+// Created 18-Oct-2026
+
+#include "cosmo/GridPowerSpectrumEstimator.h"
+#include "cosmo/FftGaussianRandomFieldGenerator.h"
+#include "cosmo/MappedGridFile.h"
+#include "cosmo/RuntimeError.h"
+
+#include "config.h"
+#ifdef HAVE_LIBFFTW3F
+#include "fftw3.h"
+#define FFTW(X) fftwf_ ## X // float transforms
+#endif
+
+#include <cmath>
+#include <algorithm>
+
+namespace local = cosmo;
+
+namespace cosmo {
+    struct GridPowerSpectrumEstimator::Implementation {
+#ifdef HAVE_LIBFFTW3F
+        FFTW(complex) *data;
+        FFTW(plan) plan;
+#endif
+    };
+} // cosmo::
+
+local::GridPowerSpectrumEstimator::GridPowerSpectrumEstimator(int nx, int ny, int nz, double spacing,
+double kmin, double kmax, int nbins, Binning binning, int ellMax, int losAxis)
+: _nx(nx), _ny(ny), _nz(nz), _halfz(nz/2+1), _nbins(nbins), _ellMax(ellMax), _losAxis(losAxis),
+_nthreads(1), _spacing(spacing), _kmin(kmin), _kmax(kmax), _binning(binning),
+_pimpl(new Implementation())
+{
+#ifdef HAVE_LIBFFTW3F
+    _pimpl->data = 0;
+    _pimpl->plan = 0;
+#endif
+    if(nx <= 0 || ny <= 0 || nz <= 0) {
+        throw RuntimeError("GridPowerSpectrumEstimator: invalid grid size.");
+    }
+    if(spacing <= 0) {
+        throw RuntimeError("GridPowerSpectrumEstimator: invalid spacing <= 0.");
+    }
+    if(nbins <= 0) {
+        throw RuntimeError("GridPowerSpectrumEstimator: invalid nbins <= 0.");
+    }
+    if(kmin < 0 || kmax <= kmin || (binning == LogBins && kmin == 0)) {
+        throw RuntimeError("GridPowerSpectrumEstimator: invalid k range.");
+    }
+    if(ellMax < 0 || ellMax % 2) {
+        throw RuntimeError("GridPowerSpectrumEstimator: ellMax must be even and >= 0.");
+    }
+    if(losAxis < 0 || losAxis > 2) {
+        throw RuntimeError("GridPowerSpectrumEstimator: invalid line-of-sight axis.");
+    }
+    _dbin = (binning == LogBins) ? std::log(kmax/kmin)/nbins : (kmax-kmin)/nbins;
+    _nstat = 3 + ellMax/2 + 1;
+    _sums.resize((std::size_t)nbins*_nstat,0);
+}
+
+local::GridPowerSpectrumEstimator::~GridPowerSpectrumEstimator() {
+#ifdef HAVE_LIBFFTW3F
+    if(0 != _pimpl->data) {
+        if(0 != _pimpl->plan) FFTW(destroy_plan)(_pimpl->plan);
+        FFTW(free)(_pimpl->data);
+    }
+#endif
+}
+
+void local::GridPowerSpectrumEstimator::setNumThreads(int nthreads) {
+    if(nthreads <= 0) {
+        throw RuntimeError("GridPowerSpectrumEstimator::setNumThreads: expected nthreads > 0.");
+    }
+#ifdef HAVE_LIBFFTW3F
+    if(0 != _pimpl->plan) {
+        throw RuntimeError("GridPowerSpectrumEstimator::setNumThreads: plan already created.");
+    }
+#endif
+    FftGaussianRandomFieldGenerator::initializeThreads();
+    _nthreads = nthreads;
+}
+
+int local::GridPowerSpectrumEstimator::_getBin(double k) const {
+    if(k < _kmin || k >= _kmax) return -1;
+    int bin = (int)std::floor(_binning == LogBins ? std::log(k/_kmin)/_dbin : (k-_kmin)/_dbin);
+    return bin < _nbins ? bin : -1;
+}
+
+void local::GridPowerSpectrumEstimator::estimate(FftGaussianRandomFieldGenerator const &generator) {
+    if(generator.getNx() != _nx || generator.getNy() != _ny || generator.getNz() != _nz) {
+        throw RuntimeError("GridPowerSpectrumEstimator::estimate: generator has wrong dimensions.");
+    }
+    // The generator's modes have P = V |delta_k|^2.
+    double volume = _nx*_ny*_nz*_spacing*_spacing*_spacing;
+    estimateHalfComplex(generator.getFieldKData(),volume);
+}
+
+void local::GridPowerSpectrumEstimator::estimate(GaussianRandomFieldView const &field) {
+    if(field.nx != _nx || field.ny != _ny || field.nz != _nz) {
+        throw RuntimeError("GridPowerSpectrumEstimator::estimate: field has wrong dimensions.");
+    }
+    _estimateGrid(field.data,field.zstride,field.step);
+}
+
+void local::GridPowerSpectrumEstimator::estimate(MappedGridFile const &file) {
+    if(file.getNx() != _nx || file.getNy() != _ny || file.getNz() != _nz) {
+        throw RuntimeError("GridPowerSpectrumEstimator::estimate: grid file has wrong dimensions.");
+    }
+    if(file.getDataType() == GridFileHeader::Float32) {
+        _estimateGrid(file.getFloatData(),file.getZStride(),1);
+    }
+    else {
+        _estimateGrid(file.getDoubleData(),file.getZStride(),1);
+    }
+}
+
+template <class T>
+void local::GridPowerSpectrumEstimator::_estimateGrid(T const *data, std::size_t zstride, std::size_t step) {
+#ifdef HAVE_LIBFFTW3F
+    // Allocate our buffer and create our in-place plan the first time we are called.
+    std::size_t nbuf = (std::size_t)_nx*_ny*_halfz;
+    if(0 == _pimpl->data) {
+        _pimpl->data = (FFTW(complex)*)FFTW(malloc)(sizeof(FFTW(complex))*nbuf);
+        if(0 == _pimpl->data) {
+            throw RuntimeError("GridPowerSpectrumEstimator: unable to allocate FFT buffer.");
+        }
+#ifdef HAVE_LIBFFTW3F_THREADS
+        FFTW(plan_with_nthreads)(_nthreads);
+#endif
+        _pimpl->plan = FFTW(plan_dft_r2c_3d)(_nx,_ny,_nz,(float*)_pimpl->data,_pimpl->data,FFTW_ESTIMATE);
+    }
+    // Copy the grid into our padded buffer.
+    float *buffer = (float*)_pimpl->data;
+    int nx(_nx), ny(_ny), nz(_nz);
+#pragma omp parallel for schedule(static) num_threads(_nthreads)
+    for(int ix = 0; ix < nx; ++ix) {
+        for(int iy = 0; iy < ny; ++iy) {
+            T const *in = data + zstride*(iy + (std::size_t)ny*ix);
+            float *out = buffer + 2*_halfz*(iy + (std::size_t)ny*ix);
+            for(int iz = 0; iz < nz; ++iz) out[iz] = (float)in[step*iz];
+        }
+    }
+    FFTW(execute)(_pimpl->plan);
+    // The forward transform of a grid sums N = nx*ny*nz values, so P = V/N^2 |FFT|^2.
+    double ntot = (double)_nx*_ny*_nz;
+    double volume = ntot*_spacing*_spacing*_spacing;
+    estimateHalfComplex(buffer,volume/(ntot*ntot));
+#else
+    throw RuntimeError("GridPowerSpectrumEstimator: package not built with FFTW3.");
+#endif
+}
+
+void local::GridPowerSpectrumEstimator::estimateHalfComplex(float const *data, double norm) {
+    int nx(_nx), ny(_ny), nz(_nz), halfz(_halfz), nstat(_nstat), nbins(_nbins), ellMax(_ellMax);
+    int nyquistZ = (nz % 2) ? -1 : nz/2;
+    double twopi(8*std::atan(1));
+    double dkx = twopi/(nx*_spacing), dky = twopi/(ny*_spacing), dkz = twopi/(nz*_spacing);
+    std::size_t slabSize((std::size_t)nbins*nstat);
+    _slabSums.assign(slabSize*nx,0);
+#pragma omp parallel for schedule(static) num_threads(_nthreads)
+    for(int ix = 0; ix < nx; ++ix) {
+        double *sums = &_slabSums[slabSize*ix];
+        std::vector<double> legendre(ellMax+1,1);
+        int jx = (ix > nx/2 ? ix-nx : ix);
+        int cx = (nx-ix) % nx;
+        double kx = jx*dkx;
+        for(int iy = 0; iy < ny; ++iy) {
+            int jy = (iy > ny/2 ? iy-ny : iy);
+            int cy = (ny-iy) % ny;
+            double ky = jy*dky;
+            std::size_t row(iy + (std::size_t)ny*ix), partner(cy + (std::size_t)ny*cx);
+            for(int iz = 0; iz < halfz; ++iz) {
+                double kz = iz*dkz;
+                double ksq = kx*kx + ky*ky + kz*kz;
+                if(ksq == 0) continue;
+                double k = std::sqrt(ksq);
+                int bin = _getBin(k);
+                if(bin < 0) continue;
+                std::size_t index(iz + halfz*row);
+                double re(data[2*index]), im(data[2*index+1]), weight(2);
+                if(iz == 0 || iz == nyquistZ) {
+                    // This plane is its own conjugate, so use the Hermitian part of each
+                    // conjugate pair once, as an inverse c2r transform would.
+                    if(partner < row) continue;
+                    if(partner == row) {
+                        weight = 1;
+                        im = 0;
+                    }
+                    else {
+                        std::size_t pindex(iz + halfz*partner);
+                        re = .5*(re + data[2*pindex]);
+                        im = .5*(im - data[2*pindex+1]);
+                    }
+                }
+                double power = norm*(re*re + im*im);
+                double *stat = sums + (std::size_t)nstat*bin;
+                stat[0] += weight;
+                stat[1] += weight*k;
+                stat[2] += weight*power*power;
+                stat[3] += weight*power;
+                if(ellMax > 0) {
+                    double mu = (_losAxis == 0 ? kx : _losAxis == 1 ? ky : kz)/k;
+                    legendre[1] = mu;
+                    for(int ell = 2; ell <= ellMax; ++ell) {
+                        legendre[ell] = ((2*ell-1)*mu*legendre[ell-1] - (ell-1)*legendre[ell-2])/ell;
+                    }
+                    for(int ell = 2; ell <= ellMax; ell += 2) {
+                        stat[3+ell/2] += weight*power*legendre[ell];
+                    }
+                }
+            }
+        }
+    }
+    // Sum the slabs in a fixed order so that the results do not depend on the threads used.
+    std::fill(_sums.begin(),_sums.end(),0.);
+    for(int ix = 0; ix < nx; ++ix) {
+        double const *sums = &_slabSums[slabSize*ix];
+        for(std::size_t i = 0; i < slabSize; ++i) _sums[i] += sums[i];
+    }
+}
+
+void local::GridPowerSpectrumEstimator::_checkBin(int bin) const {
+    if(bin < 0 || bin >= _nbins) {
+        throw RuntimeError("GridPowerSpectrumEstimator: invalid bin index.");
+    }
+}
+
+double local::GridPowerSpectrumEstimator::getBinLow(int bin) const {
+    _checkBin(bin);
+    return _binning == LogBins ? _kmin*std::exp(bin*_dbin) : _kmin + bin*_dbin;
+}
+
+double local::GridPowerSpectrumEstimator::getBinHigh(int bin) const {
+    _checkBin(bin);
+    return _binning == LogBins ? _kmin*std::exp((bin+1)*_dbin) : _kmin + (bin+1)*_dbin;
+}
+
+double local::GridPowerSpectrumEstimator::getBinCenter(int bin) const {
+    _checkBin(bin);
+    return _binning == LogBins ? _kmin*std::exp((bin+.5)*_dbin) : _kmin + (bin+.5)*_dbin;
+}
+
+double local::GridPowerSpectrumEstimator::getNumModes(int bin) const {
+    _checkBin(bin);
+    return _sums[(std::size_t)_nstat*bin];
+}
+
+double local::GridPowerSpectrumEstimator::getMeanK(int bin) const {
+    double nmodes = getNumModes(bin);
+    return nmodes > 0 ? _sums[(std::size_t)_nstat*bin+1]/nmodes : 0;
+}
+
+double local::GridPowerSpectrumEstimator::getPower(int bin, int ell) const {
+    if(ell < 0 || ell > _ellMax || ell % 2) {
+        throw RuntimeError("GridPowerSpectrumEstimator::getPower: invalid multipole.");
+    }
+    double nmodes = getNumModes(bin);
+    return nmodes > 0 ? (2*ell+1)*_sums[(std::size_t)_nstat*bin+3+ell/2]/nmodes : 0;
+}
+
+double local::GridPowerSpectrumEstimator::getPowerVariance(int bin) const {
+    double nmodes = getNumModes(bin);
+    if(0 == nmodes) return 0;
+    double mean = getPower(bin);
+    return _sums[(std::size_t)_nstat*bin+2]/nmodes - mean*mean;
+}
+
+std::size_t local::GridPowerSpectrumEstimator::getMemorySize() const {
+    return sizeof(*this) + (_slabSums.size() + _sums.size())*sizeof(double) +
+#ifdef HAVE_LIBFFTW3F
+        (_pimpl->data ? (std::size_t)_nx*_ny*_halfz*8 : 0) +
+#endif
+        0;
+}
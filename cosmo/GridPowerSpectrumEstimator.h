@@ -0,0 +1,78 @@
+// Created 18-Oct-2026
+
+#ifndef COSMO_GRID_POWER_SPECTRUM_ESTIMATOR
+#define COSMO_GRID_POWER_SPECTRUM_ESTIMATOR
+
+#include "cosmo/AbsGaussianRandomFieldGenerator.h"
+
+#include "boost/smart_ptr.hpp"
+
+#include <vector>
+#include <cstddef>
+
+namespace cosmo {
+    class FftGaussianRandomFieldGenerator;
+    class MappedGridFile;
+    // Estimates the binned power spectrum P(k) of a field on a uniform periodic grid, and
+    // optionally its even multipoles P_ell(k) relative to a line of sight along one of the
+    // grid axes. Works directly on the half-complex (nx,ny,nz/2+1) layout of a real-to-complex
+    // FFT, counting each stored mode twice except for the self-conjugate kz = 0 and Nyquist
+    // planes, where each conjugate pair is counted once. Each x slab is accumulated
+    // separately and then summed in slab order, so the results do not depend on the
+    // number of threads.
+	class GridPowerSpectrumEstimator {
+	public:
+	    enum Binning { LinearBins, LogBins };
+	    // Creates a new estimator for a grid with the specified dimensions and spacing in Mpc/h,
+	    // using nbins bins in k from kmin to kmax in h/Mpc. Multipoles up to the even value
+	    // ellMax are estimated relative to the line-of-sight axis 0 (x), 1 (y) or 2 (z).
+		GridPowerSpectrumEstimator(int nx, int ny, int nz, double spacing, double kmin, double kmax,
+		    int nbins, Binning binning = LinearBins, int ellMax = 0, int losAxis = 2);
+		virtual ~GridPowerSpectrumEstimator();
+		// Sets the number of threads to use for each estimate. The default is 1.
+		void setNumThreads(int nthreads);
+		int getNumThreads() const;
+		// Estimates the power spectrum of the k-space field of the specified generator, which
+		// must be called after generateFieldK() and before transformFieldToR().
+		void estimate(FftGaussianRandomFieldGenerator const &generator);
+		// Estimates the power spectrum of an r-space grid, using a real-to-complex FFT.
+		void estimate(GaussianRandomFieldView const &field);
+		void estimate(MappedGridFile const &file);
+		// Estimates the power spectrum of half-complex data stored as interleaved (re,im)
+		// floats with dimensions (nx,ny,nz/2+1), where P = norm*|data|^2 for each mode.
+		void estimateHalfComplex(float const *data, double norm);
+		// Accessors for the binning.
+		int getNBins() const;
+		int getEllMax() const;
+		double getBinLow(int bin) const;
+		double getBinHigh(int bin) const;
+		double getBinCenter(int bin) const;
+		// Returns the results of the last estimate for the specified bin. The number of modes
+		// counts both members of each conjugate pair, as if the full grid were used.
+		double getNumModes(int bin) const;
+		double getMeanK(int bin) const;
+		double getPower(int bin, int ell = 0) const;
+		double getPowerVariance(int bin) const;
+		// Returns the memory size in bytes required for this estimator.
+		std::size_t getMemorySize() const;
+	private:
+        class Implementation;
+        int _nx, _ny, _nz, _halfz, _nbins, _ellMax, _losAxis, _nthreads, _nstat;
+        double _spacing, _kmin, _kmax, _dbin;
+        Binning _binning;
+        boost::scoped_ptr<Implementation> _pimpl;
+        // Per-slab sums of weight, weight*k, weight*P^2 and weight*P*L_ell(mu) for each bin.
+        std::vector<double> _slabSums, _sums;
+        // Copies an r-space grid into our FFT buffer and transforms it.
+        template <class T> void _estimateGrid(T const *data, std::size_t zstride, std::size_t step);
+        int _getBin(double k) const;
+        void _checkBin(int bin) const;
+	}; // GridPowerSpectrumEstimator
+
+	inline int GridPowerSpectrumEstimator::getNumThreads() const { return _nthreads; }
+	inline int GridPowerSpectrumEstimator::getNBins() const { return _nbins; }
+	inline int GridPowerSpectrumEstimator::getEllMax() const { return _ellMax; }
+
+} // cosmo
+
+#endif // COSMO_GRID_POWER_SPECTRUM_ESTIMATOR
@@ -0,0 +1,89 @@
+// Created 18-Oct-2026
+
+#include "cosmo/MappedGridFile.h"
+#include "cosmo/RuntimeError.h"
+
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace local = cosmo;
+
+local::MappedGridFile::MappedGridFile(std::string const &filename)
+: _fd(-1), _map(MAP_FAILED), _mapSize(0)
+{
+    _fd = ::open(filename.c_str(),O_RDONLY);
+    if(_fd < 0) {
+        throw RuntimeError("MappedGridFile: unable to open " + filename);
+    }
+    struct stat info;
+    if(0 != ::fstat(_fd,&info) || (std::size_t)info.st_size < sizeof(GridFileHeader)) {
+        ::close(_fd);
+        throw RuntimeError("MappedGridFile: missing header in " + filename);
+    }
+    _mapSize = info.st_size;
+    _map = ::mmap(0,_mapSize,PROT_READ,MAP_SHARED,_fd,0);
+    if(MAP_FAILED == _map) {
+        ::close(_fd);
+        throw RuntimeError("MappedGridFile: unable to map " + filename);
+    }
+    _header = (GridFileHeader const*)_map;
+    _data = (char const*)_map + sizeof(GridFileHeader);
+    // Validate the header before returning.
+    std::string problem;
+    if(0 != std::memcmp(_header->magic,"COSMOGRD",8)) {
+        problem = "not a grid file";
+    }
+    else if(1 != _header->version) {
+        problem = "unsupported version";
+    }
+    else if(0x01020304u != _header->byteOrder) {
+        problem = "wrong byte order";
+    }
+    else if(GridFileHeader::Float32 != _header->dataType && GridFileHeader::Float64 != _header->dataType) {
+        problem = "invalid data type";
+    }
+    else if(0 == _header->nx || 0 == _header->ny || 0 == _header->nz || _header->zstride < _header->nz) {
+        problem = "invalid dimensions";
+    }
+    else if(_mapSize < sizeof(GridFileHeader) + (std::size_t)_header->nx*_header->ny*_header->zstride*
+    getGridFileValueSize(getDataType())) {
+        problem = "truncated data";
+    }
+    if(problem.length() > 0) {
+        ::munmap(_map,_mapSize);
+        ::close(_fd);
+        throw RuntimeError("MappedGridFile: " + problem + " in " + filename);
+    }
+}
+
+local::MappedGridFile::~MappedGridFile() {
+    ::munmap(_map,_mapSize);
+    ::close(_fd);
+}
+
+float const *local::MappedGridFile::getFloatData() const {
+    if(GridFileHeader::Float32 != getDataType()) {
+        throw RuntimeError("MappedGridFile::getFloatData: data type is not Float32.");
+    }
+    return (float const*)_data;
+}
+
+double const *local::MappedGridFile::getDoubleData() const {
+    if(GridFileHeader::Float64 != getDataType()) {
+        throw RuntimeError("MappedGridFile::getDoubleData: data type is not Float64.");
+    }
+    return (double const*)_data;
+}
+
+double local::MappedGridFile::getValue(int x, int y, int z) const {
+    if(x < 0 || x >= getNx() || y < 0 || y >= getNy() || z < 0 || z >= getNz()) {
+        throw RuntimeError("MappedGridFile::getValue: invalid grid point.");
+    }
+    std::size_t index(z + (std::size_t)getZStride()*(y + (std::size_t)getNy()*x));
+    if(GridFileHeader::Float32 == getDataType()) return ((float const*)_data)[index];
+    return ((double const*)_data)[index];
+}
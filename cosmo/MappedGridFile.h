@@ -0,0 +1,57 @@
+// Created 18-Oct-2026
+
+#ifndef COSMO_MAPPED_GRID_FILE
+#define COSMO_MAPPED_GRID_FILE
+
+#include "cosmo/GridFile.h"
+
+#include "boost/cstdint.hpp"
+#include "boost/utility.hpp"
+
+#include <string>
+#include <cstddef>
+
+namespace cosmo {
+    // Provides read-only access to a binary grid file written by GridFileWriter by mapping
+    // it into memory, so that only the pages actually accessed are read from disk.
+	class MappedGridFile : boost::noncopyable {
+	public:
+	    // Maps the named file into memory and validates its header.
+		MappedGridFile(std::string const &filename);
+		virtual ~MappedGridFile();
+		// Accessors for the header values.
+		int getNx() const;
+		int getNy() const;
+		int getNz() const;
+		int getZStride() const;
+		double getSpacing() const;
+		boost::uint64_t getSeed() const;
+		boost::uint64_t getPowerHash() const;
+		GridFileHeader::DataType getDataType() const;
+		// Returns a pointer to the mapped values, which must have the corresponding data type.
+		float const *getFloatData() const;
+		double const *getDoubleData() const;
+		// Returns the value at the specified grid point as a double, for either data type.
+		double getValue(int x, int y, int z) const;
+	private:
+        int _fd;
+        void *_map;
+        std::size_t _mapSize;
+        GridFileHeader const *_header;
+        char const *_data;
+	}; // MappedGridFile
+	
+	inline int MappedGridFile::getNx() const { return _header->nx; }
+	inline int MappedGridFile::getNy() const { return _header->ny; }
+	inline int MappedGridFile::getNz() const { return _header->nz; }
+	inline int MappedGridFile::getZStride() const { return _header->zstride; }
+	inline double MappedGridFile::getSpacing() const { return _header->spacing; }
+	inline boost::uint64_t MappedGridFile::getSeed() const { return _header->seed; }
+	inline boost::uint64_t MappedGridFile::getPowerHash() const { return _header->powerHash; }
+	inline GridFileHeader::DataType MappedGridFile::getDataType() const {
+	    return (GridFileHeader::DataType)_header->dataType;
+	}
+
+} // cosmo
+
+#endif // COSMO_MAPPED_GRID_FILE
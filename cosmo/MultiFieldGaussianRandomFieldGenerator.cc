@@ -0,0 +1,278 @@
+// Created 18-Oct-2026
+
+#include "cosmo/MultiFieldGaussianRandomFieldGenerator.h"
+#include "cosmo/RuntimeError.h"
+#include "cosmo/PhiloxRandom.h"
+#include "cosmo/WallClock.h"
+#include "cosmo/GaussianRandomFieldSigmaTable.h"
+#include "cosmo/GridFileWriter.h"
+
+#include "likely/Random.h"
+
+#include "config.h"
+#ifdef HAVE_LIBFFTW3F
+#include "fftw3.h"
+#define FFTW(X) fftwf_ ## X // float transforms
+typedef float FftwReal;
+#endif
+
+#include <algorithm>
+#include <cmath>
+
+namespace local = cosmo;
+
+namespace cosmo {
+    struct MultiFieldGaussianRandomFieldGenerator::Implementation {
+#ifdef HAVE_LIBFFTW3F
+        FFTW(complex) *data;
+        FFTW(plan) plan;
+#endif
+    };
+} // cosmo::
+
+local::MultiFieldGaussianRandomFieldGenerator::MultiFieldGaussianRandomFieldGenerator(
+PowerSpectrumPtr powerSpectrum, double spacing, int nx, int ny, int nz, unsigned fields,
+likely::RandomPtr random)
+: AbsGaussianRandomFieldGenerator(powerSpectrum,spacing,nx,ny,nz,random),
+_halfz(nz/2+1), _pimpl(new Implementation()), _realization(0), _nthreads(1),
+_strategy(FftGaussianRandomFieldGenerator::EstimatePlan), _randomTime(0), _scaleTime(0), _fftTime(0)
+{
+#ifdef HAVE_LIBFFTW3F
+    _pimpl->data = 0;
+    _pimpl->plan = 0;
+#else
+    throw RuntimeError("MultiFieldGaussianRandomFieldGenerator: package not built with FFTW3.");
+#endif
+    // Store the requested fields in order of increasing flag value, so delta comes first.
+    for(unsigned flag = Delta; flag <= TidalZZ; flag <<= 1) {
+        if(fields & flag) _fields.push_back((FieldType)flag);
+    }
+    if(_fields.empty() || (fields & ~(unsigned)(Delta | Displacement | Gradient | Tidal))) {
+        throw RuntimeError("MultiFieldGaussianRandomFieldGenerator: invalid fields requested.");
+    }
+    // Calculate the number of complex values needed in k space for each field.
+    _nbuf = (std::size_t)getNx()*getNy()*_halfz;
+}
+
+local::MultiFieldGaussianRandomFieldGenerator::~MultiFieldGaussianRandomFieldGenerator() {
+#ifdef HAVE_LIBFFTW3F
+    if(0 != _pimpl->data) {
+        if(0 != _pimpl->plan) FFTW(destroy_plan)(_pimpl->plan);
+        FFTW(free)(_pimpl->data);
+    }
+#endif
+}
+
+bool local::MultiFieldGaussianRandomFieldGenerator::hasField(FieldType field) const {
+    return std::find(_fields.begin(),_fields.end(),field) != _fields.end();
+}
+
+int local::MultiFieldGaussianRandomFieldGenerator::_getSlot(FieldType field) const {
+    std::vector<FieldType>::const_iterator found = std::find(_fields.begin(),_fields.end(),field);
+    if(found == _fields.end()) {
+        throw RuntimeError("MultiFieldGaussianRandomFieldGenerator: field was not requested.");
+    }
+    return (int)(found - _fields.begin());
+}
+
+void local::MultiFieldGaussianRandomFieldGenerator::_initialize() {
+#ifdef HAVE_LIBFFTW3F
+    // Allocate one aligned buffer with the requested fields stored contiguously.
+    int nfields(getNumFields());
+    _pimpl->data = (FFTW(complex)*)FFTW(malloc)(sizeof(FFTW(complex))*_nbuf*nfields);
+    if(0 == _pimpl->data) {
+        throw RuntimeError("MultiFieldGaussianRandomFieldGenerator: unable to allocate field buffer.");
+    }
+    // Touch each slab first from the thread that will later write to it.
+    float *buffer = (float*)_pimpl->data;
+    long nx(getNx()), nyz(2*(long)getNy()*_halfz), nslabs(nx*nfields);
+#pragma omp parallel for schedule(static) num_threads(_nthreads)
+    for(long slab = 0; slab < nslabs; ++slab) {
+        std::fill(buffer + nyz*slab, buffer + nyz*(slab+1), 0.f);
+    }
+    _sigmaTable.reset(new GaussianRandomFieldSigmaTable(getPowerSpectrum(),getSpacing(),getNx(),getNy(),getNz()));
+    double start(getWallTime());
+    // Create a single in-place plan that transforms all of our fields together.
+    int flags = (_strategy == FftGaussianRandomFieldGenerator::PatientPlan) ? FFTW_PATIENT :
+        (_strategy == FftGaussianRandomFieldGenerator::MeasurePlan) ? FFTW_MEASURE : FFTW_ESTIMATE;
+#ifdef HAVE_LIBFFTW3F_THREADS
+    FFTW(plan_with_nthreads)(_nthreads);
+#endif
+    int dims[3] = { getNx(), getNy(), getNz() };
+    int inembed[3] = { getNx(), getNy(), _halfz };
+    int outembed[3] = { getNx(), getNy(), 2*_halfz };
+    _pimpl->plan = FFTW(plan_many_dft_c2r)(3,dims,nfields,
+        _pimpl->data,inembed,1,(int)_nbuf,buffer,outembed,1,(int)(2*_nbuf),flags);
+    if(0 == _pimpl->plan) {
+        throw RuntimeError("MultiFieldGaussianRandomFieldGenerator: unable to create plan.");
+    }
+    _fftTime += getWallTime() - start;
+#endif
+}
+
+void local::MultiFieldGaussianRandomFieldGenerator::generate() {
+#ifdef HAVE_LIBFFTW3F
+    if(0 == _pimpl->data) _initialize();
+    // Generate the unit Gaussians for delta_k once, in our first field.
+    double start(getWallTime());
+    if(_counterRandom) {
+        _fillCounterNormal();
+    }
+    else {
+        getRandom()->fillArrayNormal((float*)_pimpl->data,2*_nbuf);
+    }
+    _randomTime += getWallTime() - start;
+    start = getWallTime();
+    _deriveFields();
+    _scaleTime += getWallTime() - start;
+    start = getWallTime();
+    FFTW(execute)(_pimpl->plan);
+    _fftTime += getWallTime() - start;
+    // The default field is the first one in our buffer.
+    setFieldView((float const*)_pimpl->data,2*_halfz);
+#endif
+}
+
+void local::MultiFieldGaussianRandomFieldGenerator::_deriveFields() {
+#ifdef HAVE_LIBFFTW3F
+    int nx = getNx(), ny = getNy(), nz = getNz(), nfields = getNumFields();
+    int nxby2 = nx/2, nyby2 = ny/2;
+    double twopi(8*std::atan(1)), spacing(getSpacing());
+    double dkx = twopi/(nx*spacing), dky = twopi/(ny*spacing), dkz = twopi/(nz*spacing);
+    GaussianRandomFieldSigmaTable const &table(*_sigmaTable);
+    FFTW(complex) *data = _pimpl->data;
+    FieldType const *fields = &_fields[0];
+    std::size_t nbuf(_nbuf);
+#pragma omp parallel for schedule(static) num_threads(_nthreads)
+    for(int ix = 0; ix < nx; ++ix) {
+        int jx = (ix > nxby2 ? ix-nx : ix);
+        // Odd powers of k are zeroed on the Nyquist plane of an even dimension, where the
+        // mode is its own conjugate, so that the derived fields remain real.
+        double kx = jx*dkx, kxOdd = (2*jx == nx ? 0 : kx);
+        for(int iy = 0; iy < ny; ++iy) {
+            int jy = (iy > nyby2 ? iy-ny : iy);
+            double ky = jy*dky, kyOdd = (2*jy == ny ? 0 : ky);
+            std::size_t index(_halfz*(iy+(std::size_t)ny*ix));
+            for(int iz = 0; iz < _halfz; ++iz, ++index) {
+                double kz = iz*dkz, kzOdd = (2*iz == nz ? 0 : kz);
+                double ksq = kx*kx + ky*ky + kz*kz;
+                double sigma = table.getSigma(jx,jy,iz);
+                double re = data[index][0]*sigma, im = data[index][1]*sigma;
+                double invksq = (ksq > 0 ? 1/ksq : 0);
+                // Write the derived fields in reverse order, so that the unit Gaussians in
+                // the first field are only overwritten after they have been used.
+                for(int slot = nfields-1; slot >= 0; --slot) {
+                    double scale(0);
+                    bool imaginary(false);
+                    switch(fields[slot]) {
+                    case Delta: scale = 1; break;
+                    case DisplacementX: scale = kxOdd*invksq; imaginary = true; break;
+                    case DisplacementY: scale = kyOdd*invksq; imaginary = true; break;
+                    case DisplacementZ: scale = kzOdd*invksq; imaginary = true; break;
+                    case GradientX: scale = kxOdd; imaginary = true; break;
+                    case GradientY: scale = kyOdd; imaginary = true; break;
+                    case GradientZ: scale = kzOdd; imaginary = true; break;
+                    case TidalXX: scale = kx*kx*invksq; break;
+                    case TidalXY: scale = kxOdd*kyOdd*invksq; break;
+                    case TidalXZ: scale = kxOdd*kzOdd*invksq; break;
+                    case TidalYY: scale = ky*ky*invksq; break;
+                    case TidalYZ: scale = kyOdd*kzOdd*invksq; break;
+                    case TidalZZ: scale = kz*kz*invksq; break;
+                    default: break;
+                    }
+                    FFTW(complex) &out = data[index + nbuf*slot];
+                    if(imaginary) {
+                        // Multiply by i*scale.
+                        out[0] = (FftwReal)(-scale*im);
+                        out[1] = (FftwReal)(scale*re);
+                    }
+                    else {
+                        out[0] = (FftwReal)(scale*re);
+                        out[1] = (FftwReal)(scale*im);
+                    }
+                }
+            }
+        }
+    }
+#endif
+}
+
+void local::MultiFieldGaussianRandomFieldGenerator::_fillCounterNormal() {
+    // Use the same (mode index,realization) counters as FftGaussianRandomFieldGenerator.
+    PhiloxRandom const &random(*_counterRandom);
+    boost::uint64_t realization(_realization++);
+    float *buffer = (float*)_pimpl->data;
+    long nx(getNx()), nyz((long)getNy()*_halfz);
+#pragma omp parallel for schedule(static) num_threads(_nthreads)
+    for(long ix = 0; ix < nx; ++ix) {
+        std::size_t index(nyz*ix);
+        for(long iyz = 0; iyz < nyz; ++iyz, ++index) {
+            double g1,g2;
+            random.getNormalPair(index,realization,g1,g2);
+            buffer[2*index] = (float)g1;
+            buffer[2*index+1] = (float)g2;
+        }
+    }
+}
+
+local::GaussianRandomFieldView local::MultiFieldGaussianRandomFieldGenerator::getFieldView(FieldType field) const {
+    GaussianRandomFieldView view(getFieldView());
+    view.data += 2*_nbuf*_getSlot(field);
+    return view;
+}
+
+void local::MultiFieldGaussianRandomFieldGenerator::saveField(std::string const &filename,
+boost::uint64_t seed) const {
+    saveField(_fields[0],filename,seed);
+}
+
+void local::MultiFieldGaussianRandomFieldGenerator::saveField(FieldType field,
+std::string const &filename, boost::uint64_t seed) const {
+    GaussianRandomFieldView view(getFieldView(field));
+    GridFileWriter writer(filename,getNx(),getNy(),getNz(),2*_halfz,getSpacing(),
+        GridFileHeader::Float32,seed,hashPowerSpectrum(getPowerSpectrum(),getSpacing(),getNx(),getNy(),getNz()));
+    writer.write(view.data,2*_nbuf);
+    writer.close();
+}
+
+void local::MultiFieldGaussianRandomFieldGenerator::setCounterSeed(boost::uint64_t seed, boost::uint64_t realization) {
+    _counterRandom.reset(new PhiloxRandom(seed));
+    _realization = realization;
+}
+
+void local::MultiFieldGaussianRandomFieldGenerator::setNumThreads(int nthreads) {
+    if(nthreads <= 0) {
+        throw RuntimeError("MultiFieldGaussianRandomFieldGenerator::setNumThreads: expected nthreads > 0.");
+    }
+#ifdef HAVE_LIBFFTW3F
+    if(0 != _pimpl->plan) {
+        throw RuntimeError("MultiFieldGaussianRandomFieldGenerator::setNumThreads: plan already created.");
+    }
+#endif
+    FftGaussianRandomFieldGenerator::initializeThreads();
+    _nthreads = nthreads;
+}
+
+void local::MultiFieldGaussianRandomFieldGenerator::setPlanStrategy(FftGaussianRandomFieldGenerator::Strategy strategy) {
+#ifdef HAVE_LIBFFTW3F
+    if(0 != _pimpl->plan) {
+        throw RuntimeError("MultiFieldGaussianRandomFieldGenerator::setPlanStrategy: plan already created.");
+    }
+#endif
+    _strategy = strategy;
+}
+
+void local::MultiFieldGaussianRandomFieldGenerator::getTimings(double &randomTime, double &scaleTime, double &fftTime) const {
+    randomTime = _randomTime;
+    scaleTime = _scaleTime;
+    fftTime = _fftTime;
+}
+
+double local::MultiFieldGaussianRandomFieldGenerator::_getFieldUnchecked(int x, int y, int z) const {
+    return getFieldView()(x,y,z);
+}
+
+std::size_t local::MultiFieldGaussianRandomFieldGenerator::getMemorySize() const {
+    return sizeof(*this) + (std::size_t)getNx()*getNy()*_halfz*8*_fields.size() +
+        (_sigmaTable ? _sigmaTable->getMemorySize() : 0);
+}
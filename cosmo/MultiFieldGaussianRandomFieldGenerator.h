@@ -0,0 +1,98 @@
+// Created 18-Oct-2026
+
+#ifndef COSMO_MULTI_FIELD_GAUSSIAN_RANDOM_FIELD_GENERATOR
+#define COSMO_MULTI_FIELD_GAUSSIAN_RANDOM_FIELD_GENERATOR
+
+#include "cosmo/AbsGaussianRandomFieldGenerator.h"
+#include "cosmo/FftGaussianRandomFieldGenerator.h"
+
+#include "boost/smart_ptr.hpp"
+#include "boost/cstdint.hpp"
+
+#include <vector>
+
+namespace cosmo {
+    class GaussianRandomFieldSigmaTable;
+    // Generates several linear fields derived from the same realization of the k-space
+    // density contrast delta_k: delta itself, the Zel'dovich displacement psi = i k/k^2 delta_k,
+    // the density gradient i k delta_k, and the tidal tensor k_i k_j/k^2 delta_k (whose
+    // trace is delta). The random modes are drawn once, all requested fields are derived in
+    // a single k-space pass, and a single batched inverse FFT transforms them together.
+	class MultiFieldGaussianRandomFieldGenerator : public AbsGaussianRandomFieldGenerator {
+	public:
+	    // Flags for the fields that can be requested, which may be combined with |.
+	    enum FieldType {
+	        Delta = 1<<0,
+	        DisplacementX = 1<<1, DisplacementY = 1<<2, DisplacementZ = 1<<3,
+	        GradientX = 1<<4, GradientY = 1<<5, GradientZ = 1<<6,
+	        TidalXX = 1<<7, TidalXY = 1<<8, TidalXZ = 1<<9,
+	        TidalYY = 1<<10, TidalYZ = 1<<11, TidalZZ = 1<<12,
+	        Displacement = DisplacementX | DisplacementY | DisplacementZ,
+	        Gradient = GradientX | GradientY | GradientZ,
+	        Tidal = TidalXX | TidalXY | TidalXZ | TidalYY | TidalYZ | TidalZZ
+	    };
+	    // Creates a new generator for the fields selected by the specified combination of
+	    // FieldType flags. Displacements are in Mpc/h and gradients in h/Mpc.
+		MultiFieldGaussianRandomFieldGenerator(PowerSpectrumPtr powerSpectrum, double spacing,
+		    int nx, int ny, int nz, unsigned fields, likely::RandomPtr random = likely::RandomPtr());
+		virtual ~MultiFieldGaussianRandomFieldGenerator();
+        // Generates a new realization of all requested fields. The getField() and
+        // getFieldView() methods access delta, if requested, or else the requested
+        // field with the lowest flag value.
+        virtual void generate();
+        // Returns true if the specified field was requested.
+        bool hasField(FieldType field) const;
+        // Returns the number of fields that were requested.
+        int getNumFields() const;
+        // Returns a view of the most recent realization of the specified field, which
+        // must have been requested.
+        GaussianRandomFieldView getFieldView(FieldType field) const;
+        using AbsGaussianRandomFieldGenerator::getFieldView;
+        // Saves the most recent realization of the default field or the specified field
+        // to the named binary grid file.
+        virtual void saveField(std::string const &filename, boost::uint64_t seed = 0) const;
+        void saveField(FieldType field, std::string const &filename, boost::uint64_t seed = 0) const;
+        // Returns the memory size in bytes required for this generator.
+        virtual std::size_t getMemorySize() const;
+        // Uses a counter-based random source, exactly as FftGaussianRandomFieldGenerator, so
+        // that our delta field agrees with the corresponding realization of that generator.
+        void setCounterSeed(boost::uint64_t seed, boost::uint64_t realization = 0);
+        // Sets the number of threads to use. Must be called before the first call to generate().
+        void setNumThreads(int nthreads);
+        int getNumThreads() const;
+        // Selects the FFTW planning strategy. Must be called before the first call to generate().
+        void setPlanStrategy(FftGaussianRandomFieldGenerator::Strategy strategy);
+        // Returns the total wall-clock times in seconds spent generating random numbers,
+        // deriving the requested fields from them, and planning and executing FFTs.
+        // The one-time buffer allocation and power spectrum tabulation are not included.
+        void getTimings(double &randomTime, double &scaleTime, double &fftTime) const;
+	private:
+        class Implementation;
+        int _halfz;
+        std::size_t _nbuf;
+        boost::scoped_ptr<Implementation> _pimpl;
+        // The FieldType of each field in our buffer, in buffer order.
+        std::vector<FieldType> _fields;
+        PhiloxRandomPtr _counterRandom;
+        boost::uint64_t _realization;
+        int _nthreads;
+        FftGaussianRandomFieldGenerator::Strategy _strategy;
+        boost::scoped_ptr<GaussianRandomFieldSigmaTable> _sigmaTable;
+        double _randomTime, _scaleTime, _fftTime;
+        // Returns the position of the specified field in our buffer, or throws a RuntimeError.
+        int _getSlot(FieldType field) const;
+        // Allocates our buffer, tabulates sigma(|k|) and creates our plan.
+        void _initialize();
+        // Fills the first field of our buffer with unit Gaussians from our counter-based source.
+        void _fillCounterNormal();
+        // Derives each requested field in k space from the unit Gaussians in our first field.
+        void _deriveFields();
+        // The getField method calls this after checking for invalid (x,y,z).
+        virtual double _getFieldUnchecked(int x, int y, int z) const;
+	}; // MultiFieldGaussianRandomFieldGenerator
+
+    inline int MultiFieldGaussianRandomFieldGenerator::getNumFields() const { return (int)_fields.size(); }
+    inline int MultiFieldGaussianRandomFieldGenerator::getNumThreads() const { return _nthreads; }
+} // cosmo
+
+#endif // COSMO_MULTI_FIELD_GAUSSIAN_RANDOM_FIELD_GENERATOR
@@ -0,0 +1,520 @@
+// Created 18-Oct-2026
+
+#include "cosmo/NestedGaussianRandomFieldGenerator.h"
+#include "cosmo/GaussianRandomFieldSigmaTable.h"
+#include "cosmo/PhiloxRandom.h"
+#include "cosmo/GridFileWriter.h"
+#include "cosmo/RuntimeError.h"
+
+#include "config.h"
+#ifdef HAVE_LIBFFTW3F
+#include "fftw3.h"
+#define FFTW(X) fftwf_ ## X // float transforms
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace local = cosmo;
+
+namespace cosmo {
+#ifdef HAVE_LIBFFTW3F
+    // Evaluates a batch of Fourier series at a contiguous run of points,
+    //
+    //   g(m) = Sum_{j<nin} a(j) exp(2 pi i (k0+j)(offset+m)/length), m = 0,1,...,nout-1
+    //
+    // where -length < k0 <= 0, using the chirp-z transform, which needs a pair of FFTs whose
+    // size only needs to be at least nin+nout-1, independent of the length of the period.
+    // When the period is short enough that a single zero-padded FFT of the whole period is
+    // cheaper, we use that instead. Each call to evaluate() transforms howmany series, with
+    // a(j) of series t stored at work[j + getSize()*t]. The work buffer must be allocated
+    // with FFTW(malloc) and hold getWorkSize() values, half of which are used as scratch.
+    class ZoomTransform {
+    public:
+        ZoomTransform(int nin, int k0, int length, int offset, int nout, int howmany);
+        ~ZoomTransform();
+        int getSize() const { return _size; }
+        int getHowMany() const { return _howmany; }
+        std::size_t getWorkSize() const { return 2*(std::size_t)_size*_howmany; }
+        // Replaces the inputs a(j) of each series with its outputs g(m).
+        void evaluate(FFTW(complex) *work) const;
+    private:
+        int _nin, _k0, _nout, _howmany, _size;
+        bool _padded;
+        FFTW(complex) *_pre, *_kernel, *_post;
+        FFTW(plan) _forward, _backward;
+        void _multiply(FFTW(complex) *work, FFTW(complex) const *factors, int n) const;
+        static void _setPhase(FFTW(complex) &value, boost::int64_t numerator, boost::int64_t denominator, double sign);
+    };
+#endif
+    struct NestedGaussianRandomFieldGenerator::Implementation {
+#ifdef HAVE_LIBFFTW3F
+        // The child grid, in k space and then in place in r space.
+        FFTW(complex) *data;
+        FFTW(plan) plan;
+        // The parent modes after refining along x, then along x and y.
+        FFTW(complex) *longData;
+        // Evaluates the parent series at our grid points along each axis.
+        boost::scoped_ptr<ZoomTransform> zoomX, zoomY, zoomZ;
+#endif
+    };
+} // cosmo::
+
+#ifdef HAVE_LIBFFTW3F
+local::ZoomTransform::ZoomTransform(int nin, int k0, int length, int offset, int nout, int howmany)
+: _nin(nin), _k0(k0), _nout(nout), _howmany(howmany),
+_pre(0), _kernel(0), _post(0), _forward(0), _backward(0)
+{
+    // Use the smallest size 2^n, 3*2^n or 5*2^n that fits the linear convolution, since
+    // these are the sizes that FFTW handles most efficiently.
+    _size = 0;
+    for(int base = 1; base <= 5; base += 2) {
+        int size(base);
+        while(size < nin + nout - 1) size *= 2;
+        if(0 == _size || size < _size) _size = size;
+    }
+    // The chirp-z transform needs two FFTs and three passes of phase factors, so is only
+    // worthwhile when the period is several times longer.
+    _padded = (length >= nin && length <= 3*_size);
+    if(_padded) _size = length;
+    FFTW(complex) *work = (FFTW(complex)*)FFTW(malloc)(sizeof(FFTW(complex))*getWorkSize());
+    if(0 == work) {
+        throw RuntimeError("ZoomTransform: unable to allocate buffers.");
+    }
+    // Plan the batched transforms between the two halves of a temporary work buffer, since
+    // out-of-place transforms are significantly faster.
+    FFTW(complex) *scratch = work + getWorkSize()/2;
+    _backward = FFTW(plan_many_dft)(1,&_size,howmany,scratch,0,1,_size,work,0,1,_size,
+        FFTW_BACKWARD,FFTW_ESTIMATE);
+    if(!_padded) {
+        _forward = FFTW(plan_many_dft)(1,&_size,howmany,work,0,1,_size,scratch,0,1,_size,
+            FFTW_FORWARD,FFTW_ESTIMATE);
+    }
+    FFTW(free)(work);
+    if(0 == _backward || (!_padded && 0 == _forward)) {
+        throw RuntimeError("ZoomTransform: unable to create FFT plans.");
+    }
+    _pre = (FFTW(complex)*)FFTW(malloc)(sizeof(FFTW(complex))*nin);
+    if(0 == _pre) {
+        throw RuntimeError("ZoomTransform: unable to allocate buffers.");
+    }
+    boost::int64_t L(length), twoL(2*L);
+    if(_padded) {
+        // Shift our window to the start of the padded transform.
+        for(int j = 0; j < nin; ++j) {
+            _setPhase(_pre[j],(k0 + j)*(boost::int64_t)offset,L,+1);
+        }
+        return;
+    }
+    _kernel = (FFTW(complex)*)FFTW(malloc)(sizeof(FFTW(complex))*_size);
+    _post = (FFTW(complex)*)FFTW(malloc)(sizeof(FFTW(complex))*nout);
+    if(0 == _kernel || 0 == _post) {
+        throw RuntimeError("ZoomTransform: unable to allocate buffers.");
+    }
+    // With k = k0+j, write k(offset+m) = k offset + (k^2 + m^2 - (k-m)^2)/2 so that the
+    // sum becomes a convolution over j-m. The phases are reduced with integer arithmetic
+    // so that they stay accurate for long periods.
+    for(int j = 0; j < nin; ++j) {
+        boost::int64_t k(k0 + j);
+        _setPhase(_pre[j],2*k*offset + k*k,twoL,+1);
+    }
+    for(int m = 0; m < nout; ++m) {
+        _setPhase(_post[m],(boost::int64_t)m*m,twoL,+1);
+    }
+    std::fill((float*)_kernel,(float*)(_kernel + _size),0.f);
+    for(int n = 1-nin; n < nout; ++n) {
+        boost::int64_t k(k0 - n);
+        FFTW(complex) &value = _kernel[(n + _size) % _size];
+        _setPhase(value,k*k,twoL,-1);
+    }
+    // Store the transformed kernel with the normalization of the inverse transform.
+    FFTW(plan) plan = FFTW(plan_dft_1d)(_size,_kernel,_kernel,FFTW_FORWARD,FFTW_ESTIMATE);
+    if(0 == plan) {
+        throw RuntimeError("ZoomTransform: unable to create FFT plans.");
+    }
+    FFTW(execute)(plan);
+    FFTW(destroy_plan)(plan);
+    for(int n = 0; n < _size; ++n) {
+        _kernel[n][0] /= _size;
+        _kernel[n][1] /= _size;
+    }
+}
+
+local::ZoomTransform::~ZoomTransform() {
+    if(0 != _forward) FFTW(destroy_plan)(_forward);
+    if(0 != _backward) FFTW(destroy_plan)(_backward);
+    if(0 != _pre) FFTW(free)(_pre);
+    if(0 != _kernel) FFTW(free)(_kernel);
+    if(0 != _post) FFTW(free)(_post);
+}
+
+void local::ZoomTransform::_setPhase(FFTW(complex) &value, boost::int64_t numerator,
+boost::int64_t denominator, double sign) {
+    // Sets value = exp(sign 2 pi i numerator/denominator).
+    numerator %= denominator;
+    if(numerator < 0) numerator += denominator;
+    double phase = sign*8*std::atan(1)*numerator/denominator;
+    value[0] = (float)std::cos(phase);
+    value[1] = (float)std::sin(phase);
+}
+
+void local::ZoomTransform::_multiply(FFTW(complex) *work, FFTW(complex) const *factors, int n) const {
+    for(int t = 0; t < _howmany; ++t) {
+        FFTW(complex) *series = work + (std::size_t)_size*t;
+        for(int j = 0; j < n; ++j) {
+            float re(series[j][0]*factors[j][0] - series[j][1]*factors[j][1]);
+            float im(series[j][0]*factors[j][1] + series[j][1]*factors[j][0]);
+            series[j][0] = re;
+            series[j][1] = im;
+        }
+    }
+}
+
+void local::ZoomTransform::evaluate(FFTW(complex) *work) const {
+    FFTW(complex) *scratch = work + getWorkSize()/2;
+    _multiply(work,_pre,_nin);
+    if(_padded) {
+        // Zero pad each series to the full period with its negative wavenumbers at the end.
+        int nneg(-_k0);
+        for(int t = 0; t < _howmany; ++t) {
+            float const *series = (float const*)(work + (std::size_t)_size*t);
+            float *padded = (float*)(scratch + (std::size_t)_size*t);
+            std::copy(series + 2*nneg,series + 2*_nin,padded);
+            std::fill(padded + 2*(_nin - nneg),padded + 2*(_size - nneg),0.f);
+            std::copy(series,series + 2*nneg,padded + 2*(_size - nneg));
+        }
+        FFTW(execute_dft)(_backward,scratch,work);
+        return;
+    }
+    for(int t = 0; t < _howmany; ++t) {
+        FFTW(complex) *series = work + (std::size_t)_size*t;
+        std::fill((float*)(series + _nin),(float*)(series + _size),0.f);
+    }
+    FFTW(execute_dft)(_forward,work,scratch);
+    _multiply(scratch,_kernel,_size);
+    FFTW(execute_dft)(_backward,scratch,work);
+    _multiply(work,_post,_nout);
+}
+#endif
+
+local::NestedGaussianRandomFieldGenerator::NestedGaussianRandomFieldGenerator(
+PowerSpectrumPtr powerSpectrum, double spacing, int nx, int ny, int nz, int refinement,
+int x0, int y0, int z0, int cx, int cy, int cz)
+: AbsGaussianRandomFieldGenerator(powerSpectrum,spacing/refinement,refinement*cx,refinement*cy,refinement*cz),
+_pimpl(new Implementation()), _refinement(refinement), _halfz(refinement*cz/2+1), _nthreads(1),
+_realization(0)
+{
+#ifdef HAVE_LIBFFTW3F
+    _pimpl->data = 0;
+    _pimpl->plan = 0;
+    _pimpl->longData = 0;
+#else
+    throw RuntimeError("NestedGaussianRandomFieldGenerator: package not built with FFTW3.");
+#endif
+    if(refinement < 1) {
+        throw RuntimeError("NestedGaussianRandomFieldGenerator: invalid refinement < 1.");
+    }
+    if(cx > nx || cy > ny || cz > nz) {
+        throw RuntimeError("NestedGaussianRandomFieldGenerator: child region is larger than the parent.");
+    }
+    if(x0 < 0 || x0 >= nx || y0 < 0 || y0 >= ny || z0 < 0 || z0 >= nz) {
+        throw RuntimeError("NestedGaussianRandomFieldGenerator: invalid child origin.");
+    }
+    _origin[0] = x0;
+    _origin[1] = y0;
+    _origin[2] = z0;
+    _parent.reset(new FftGaussianRandomFieldGenerator(powerSpectrum,spacing,nx,ny,nz));
+    _random.reset(new PhiloxRandom(0));
+    _nbuf = (std::size_t)getNx()*getNy()*_halfz;
+    std::size_t halfzParent(nz/2+1);
+    _nlong = (std::size_t)getNx()*(ny + getNy())*halfzParent;
+}
+
+local::NestedGaussianRandomFieldGenerator::~NestedGaussianRandomFieldGenerator() {
+#ifdef HAVE_LIBFFTW3F
+    if(0 != _pimpl->data) {
+        if(0 != _pimpl->plan) FFTW(destroy_plan)(_pimpl->plan);
+        FFTW(free)(_pimpl->data);
+        if(0 != _pimpl->longData) FFTW(free)(_pimpl->longData);
+    }
+#endif
+}
+
+void local::NestedGaussianRandomFieldGenerator::setCounterSeed(boost::uint64_t seed, boost::uint64_t realization) {
+    _random.reset(new PhiloxRandom(seed));
+    _realization = realization;
+}
+
+void local::NestedGaussianRandomFieldGenerator::setNumThreads(int nthreads) {
+    if(nthreads <= 0) {
+        throw RuntimeError("NestedGaussianRandomFieldGenerator::setNumThreads: expected nthreads > 0.");
+    }
+#ifdef HAVE_LIBFFTW3F
+    if(0 != _pimpl->plan) {
+        throw RuntimeError("NestedGaussianRandomFieldGenerator::setNumThreads: plan already created.");
+    }
+#endif
+    _parent->setNumThreads(nthreads);
+    _nthreads = nthreads;
+}
+
+void local::NestedGaussianRandomFieldGenerator::_initialize() {
+#ifdef HAVE_LIBFFTW3F
+    _pimpl->data = (FFTW(complex)*)FFTW(malloc)(sizeof(FFTW(complex))*_nbuf);
+    _pimpl->longData = (FFTW(complex)*)FFTW(malloc)(sizeof(FFTW(complex))*_nlong);
+    if(0 == _pimpl->data || 0 == _pimpl->longData) {
+        throw RuntimeError("NestedGaussianRandomFieldGenerator: unable to allocate buffers.");
+    }
+    float *buffer = (float*)_pimpl->data;
+    std::fill(buffer,buffer + 2*_nbuf,0.f);
+    _sigmaTable.reset(new GaussianRandomFieldSigmaTable(getPowerSpectrum(),getSpacing(),getNx(),getNy(),getNz()));
+#ifdef HAVE_LIBFFTW3F_THREADS
+    FFTW(plan_with_nthreads)(_nthreads);
+#endif
+    _pimpl->plan = FFTW(plan_dft_c2r_3d)(getNx(),getNy(),getNz(),_pimpl->data,buffer,FFTW_ESTIMATE);
+#ifdef HAVE_LIBFFTW3F_THREADS
+    FFTW(plan_with_nthreads)(1);
+#endif
+    if(0 == _pimpl->plan) {
+        throw RuntimeError("NestedGaussianRandomFieldGenerator: unable to create FFT plan.");
+    }
+    // Along each axis, the parent series has the wavenumbers -p/2,...,p/2 in units of its
+    // fundamental, with period r*p in units of our spacing. The x and y transforms are
+    // batched over the parent kz, and the z transforms over pairs of our y, in small enough
+    // batches that the work buffers stay in cache.
+    int r(_refinement), batch(16);
+    int px(_parent->getNx()), py(_parent->getNy()), pz(_parent->getNz()), phalfz(pz/2+1);
+    _pimpl->zoomX.reset(new ZoomTransform(2*(px/2)+1,-(px/2),r*px,r*_origin[0],getNx(),
+        std::min(batch,phalfz)));
+    _pimpl->zoomY.reset(new ZoomTransform(2*(py/2)+1,-(py/2),r*py,r*_origin[1],getNy(),
+        std::min(batch,phalfz)));
+    _pimpl->zoomZ.reset(new ZoomTransform(2*(pz/2)+1,-(pz/2),r*pz,r*_origin[2],getNz(),
+        std::min(batch,(getNy()+1)/2)));
+#endif
+}
+
+void local::NestedGaussianRandomFieldGenerator::generate() {
+#ifdef HAVE_LIBFFTW3F
+    if(0 == _pimpl->data) _initialize();
+    setFieldView(0,0);
+    boost::uint64_t realization(_realization++);
+    // Draw the parent modes, which remain in k space until we have refined them.
+    _parent->setCounterSeed(_random->getSeed(),realization);
+    _parent->generateFieldK();
+    _generateShortModes(realization);
+    FFTW(execute)(_pimpl->plan);
+    _addLongModes();
+    _parent->transformFieldToR();
+    setFieldView((float const*)_pimpl->data,2*_halfz);
+#endif
+}
+
+void local::NestedGaussianRandomFieldGenerator::_generateShortModes(boost::uint64_t realization) {
+#ifdef HAVE_LIBFFTW3F
+    // A child mode with integer wavenumbers (jx,jy,jz) is inside the parent Nyquist cube
+    // when 2|jx| <= cx, 2|jy| <= cy and 2|jz| <= cz, in which case the parent provides it.
+    // Our counters use the high bit of the realization to keep them distinct from the
+    // parent's counters for the same seed.
+    PhiloxRandom const &random(*_random);
+    boost::uint64_t hi(realization | ((boost::uint64_t)1 << 63));
+    GaussianRandomFieldSigmaTable const &table(*_sigmaTable);
+    int nx(getNx()), ny(getNy()), halfz(_halfz), r(_refinement);
+    int cx(nx/r), cy(ny/r), cz(getNz()/r);
+    FFTW(complex) *data = _pimpl->data;
+#pragma omp parallel for schedule(static) num_threads(_nthreads)
+    for(int ix = 0; ix < nx; ++ix) {
+        int jx = (ix > nx/2 ? ix-nx : ix);
+        bool longx(2*std::abs(jx) <= cx);
+        for(int iy = 0; iy < ny; ++iy) {
+            int jy = (iy > ny/2 ? iy-ny : iy);
+            bool longxy(longx && 2*std::abs(jy) <= cy);
+            std::size_t index(halfz*(iy+(std::size_t)ny*ix));
+            for(int iz = 0; iz < halfz; ++iz, ++index) {
+                if(longxy && 2*iz <= cz) {
+                    data[index][0] = data[index][1] = 0;
+                    continue;
+                }
+                double g1,g2;
+                random.getNormalPair(index,hi,g1,g2);
+                double sigma = table.getSigma(jx,jy,iz);
+                data[index][0] = (float)(sigma*g1);
+                data[index][1] = (float)(sigma*g2);
+            }
+        }
+    }
+#endif
+}
+
+void local::NestedGaussianRandomFieldGenerator::_addLongModes() {
+#ifdef HAVE_LIBFFTW3F
+    // Evaluate the parent Fourier series on our grid one axis at a time, only at our grid
+    // points. A parent Nyquist mode is split between +p/2 and -p/2 so that the result is
+    // real and agrees with the parent at each parent grid point.
+    int px(_parent->getNx()), py(_parent->getNy()), pz(_parent->getNz()), phalfz(pz/2+1);
+    int nx(getNx()), ny(getNy()), nz(getNz()), halfz(_halfz);
+    ZoomTransform const &zoomX(*_pimpl->zoomX), &zoomY(*_pimpl->zoomY), &zoomZ(*_pimpl->zoomZ);
+    FFTW(complex) const *parent = (FFTW(complex) const*)_parent->getFieldKData();
+    FFTW(complex) *alongX = _pimpl->longData, *alongXY = alongX + (std::size_t)nx*py*phalfz;
+    // Refine along x for each parent ky, in batches of kz.
+    int nbatch((phalfz + zoomX.getHowMany() - 1)/zoomX.getHowMany());
+#pragma omp parallel num_threads(_nthreads)
+    {
+        int size(zoomX.getSize()), howmany(zoomX.getHowMany());
+        FFTW(complex) *work = (FFTW(complex)*)FFTW(malloc)(sizeof(FFTW(complex))*zoomX.getWorkSize());
+        std::fill((float*)work,(float*)(work + zoomX.getWorkSize()),0.f);
+#pragma omp for schedule(static)
+        for(int index = 0; index < py*nbatch; ++index) {
+            int ky(index/nbatch), kz0(howmany*(index%nbatch)), count(std::min(howmany,phalfz-kz0));
+            for(int kx = 0; kx < px; ++kx) {
+                FFTW(complex) const *modes = parent + kz0 + phalfz*(ky + (std::size_t)py*kx);
+                FFTW(complex) const *partner = parent + kz0 + phalfz*((py-ky)%py + (std::size_t)py*((px-kx)%px));
+                int j((2*kx < px ? kx : kx - px) + px/2);
+                for(int t = 0; t < count; ++t) {
+                    FFTW(complex) &value = work[j + (std::size_t)size*t];
+                    int kz(kz0 + t);
+                    if(0 == kz || 2*kz == pz) {
+                        // Use the Hermitian part of the kz=0 and Nyquist planes, which contains
+                        // both (kx,ky) and (-kx,-ky), so that the r-space result is real.
+                        value[0] = (modes[t][0] + partner[t][0])/2;
+                        value[1] = (modes[t][1] - partner[t][1])/2;
+                    }
+                    else {
+                        value[0] = modes[t][0];
+                        value[1] = modes[t][1];
+                    }
+                    if(2*kx == px) {
+                        value[0] /= 2;
+                        value[1] /= 2;
+                        work[px + (std::size_t)size*t][0] = value[0];
+                        work[px + (std::size_t)size*t][1] = value[1];
+                    }
+                }
+            }
+            zoomX.evaluate(work);
+            for(int ix = 0; ix < nx; ++ix) {
+                FFTW(complex) *refined = alongX + kz0 + phalfz*(ky + (std::size_t)py*ix);
+                for(int t = 0; t < count; ++t) {
+                    refined[t][0] = work[ix + (std::size_t)size*t][0];
+                    refined[t][1] = work[ix + (std::size_t)size*t][1];
+                }
+            }
+        }
+        FFTW(free)(work);
+    }
+    // Refine along y for each child x, in batches of the parent kz.
+    nbatch = (phalfz + zoomY.getHowMany() - 1)/zoomY.getHowMany();
+#pragma omp parallel num_threads(_nthreads)
+    {
+        int size(zoomY.getSize()), howmany(zoomY.getHowMany());
+        FFTW(complex) *work = (FFTW(complex)*)FFTW(malloc)(sizeof(FFTW(complex))*zoomY.getWorkSize());
+        std::fill((float*)work,(float*)(work + zoomY.getWorkSize()),0.f);
+#pragma omp for schedule(static)
+        for(int index = 0; index < nx*nbatch; ++index) {
+            int ix(index/nbatch), kz0(howmany*(index%nbatch)), count(std::min(howmany,phalfz-kz0));
+            for(int ky = 0; ky < py; ++ky) {
+                FFTW(complex) const *modes = alongX + kz0 + phalfz*(ky + (std::size_t)py*ix);
+                int j((2*ky < py ? ky : ky - py) + py/2);
+                float weight(2*ky == py ? 0.5f : 1.f);
+                for(int t = 0; t < count; ++t) {
+                    FFTW(complex) &value = work[j + (std::size_t)size*t];
+                    value[0] = weight*modes[t][0];
+                    value[1] = weight*modes[t][1];
+                    if(2*ky == py) {
+                        work[py + (std::size_t)size*t][0] = value[0];
+                        work[py + (std::size_t)size*t][1] = value[1];
+                    }
+                }
+            }
+            zoomY.evaluate(work);
+            for(int iy = 0; iy < ny; ++iy) {
+                FFTW(complex) *refined = alongXY + kz0 + phalfz*(iy + (std::size_t)ny*ix);
+                for(int t = 0; t < count; ++t) {
+                    refined[t][0] = work[iy + (std::size_t)size*t][0];
+                    refined[t][1] = work[iy + (std::size_t)size*t][1];
+                }
+            }
+        }
+        FFTW(free)(work);
+    }
+    // Refine along z for each child x and add the result to our r-space grid. The series
+    // along z for each pair of our y values, A(kz) and B(kz), are real in r space, so we
+    // evaluate the Hermitian extension of A + iB over -pz/2,...,pz/2 in a single transform
+    // and read back A from the real part and B from the imaginary part. Only the real parts
+    // of the kz=0 and Nyquist modes contribute, and the Nyquist mode is split between
+    // +pz/2 and -pz/2.
+    float *field = (float*)_pimpl->data;
+    int npair((ny+1)/2);
+    nbatch = (npair + zoomZ.getHowMany() - 1)/zoomZ.getHowMany();
+#pragma omp parallel num_threads(_nthreads)
+    {
+        int size(zoomZ.getSize()), howmany(zoomZ.getHowMany());
+        FFTW(complex) *work = (FFTW(complex)*)FFTW(malloc)(sizeof(FFTW(complex))*zoomZ.getWorkSize());
+        std::fill((float*)work,(float*)(work + zoomZ.getWorkSize()),0.f);
+#pragma omp for schedule(static)
+        for(int index = 0; index < nx*nbatch; ++index) {
+            int ix(index/nbatch), pair0(howmany*(index%nbatch)), count(std::min(howmany,npair-pair0));
+            for(int t = 0; t < count; ++t) {
+                int iy(2*(pair0 + t));
+                FFTW(complex) const *modesA = alongXY + phalfz*(iy + (std::size_t)ny*ix);
+                FFTW(complex) const *modesB = (iy+1 < ny) ? modesA + phalfz : 0;
+                FFTW(complex) *series = work + (std::size_t)size*t;
+                for(int kz = 0; kz < phalfz; ++kz) {
+                    bool selfConjugate(0 == kz || 2*kz == pz);
+                    float weight(2*kz == pz ? 0.5f : 1.f);
+                    float ar(weight*modesA[kz][0]), ai(selfConjugate ? 0.f : modesA[kz][1]);
+                    float br(0), bi(0);
+                    if(0 != modesB) {
+                        br = weight*modesB[kz][0];
+                        bi = selfConjugate ? 0.f : modesB[kz][1];
+                    }
+                    series[pz/2 + kz][0] = ar - bi;
+                    series[pz/2 + kz][1] = ai + br;
+                    if(kz > 0) {
+                        series[pz/2 - kz][0] = ar + bi;
+                        series[pz/2 - kz][1] = br - ai;
+                    }
+                }
+            }
+            zoomZ.evaluate(work);
+            for(int t = 0; t < count; ++t) {
+                int iy(2*(pair0 + t));
+                FFTW(complex) const *series = work + (std::size_t)size*t;
+                float *row = field + 2*halfz*(iy + (std::size_t)ny*ix);
+                for(int iz = 0; iz < nz; ++iz) row[iz] += series[iz][0];
+                if(iy+1 < ny) {
+                    row += 2*halfz;
+                    for(int iz = 0; iz < nz; ++iz) row[iz] += series[iz][1];
+                }
+            }
+        }
+        FFTW(free)(work);
+    }
+#endif
+}
+
+double local::NestedGaussianRandomFieldGenerator::_getFieldUnchecked(int x, int y, int z) const {
+#ifdef HAVE_LIBFFTW3F
+    float const *realData = (float const*)(_pimpl->data);
+    return realData[z + 2*_halfz*(y + (std::size_t)getNy()*x)];
+#else
+    return 0;
+#endif
+}
+
+void local::NestedGaussianRandomFieldGenerator::saveField(std::string const &filename, boost::uint64_t seed) const {
+#ifdef HAVE_LIBFFTW3F
+    if(!hasFieldView()) {
+        throw RuntimeError("NestedGaussianRandomFieldGenerator::saveField: no field generated yet.");
+    }
+    GridFileWriter writer(filename,getNx(),getNy(),getNz(),2*_halfz,getSpacing(),
+        GridFileHeader::Float32,seed,hashPowerSpectrum(getPowerSpectrum(),getSpacing(),getNx(),getNy(),getNz()));
+    writer.write((float const*)_pimpl->data,2*_nbuf);
+    writer.close();
+#endif
+}
+
+std::size_t local::NestedGaussianRandomFieldGenerator::getMemorySize() const {
+    return sizeof(*this) + (_nbuf + _nlong)*8 + _parent->getMemorySize() +
+        (_sigmaTable ? _sigmaTable->getMemorySize() : 0);
+}
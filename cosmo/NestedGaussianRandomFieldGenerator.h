@@ -0,0 +1,87 @@
+// Created 18-Oct-2026
+
+#ifndef COSMO_NESTED_GAUSSIAN_RANDOM_FIELD_GENERATOR
+#define COSMO_NESTED_GAUSSIAN_RANDOM_FIELD_GENERATOR
+
+#include "cosmo/AbsGaussianRandomFieldGenerator.h"
+#include "cosmo/FftGaussianRandomFieldGenerator.h"
+
+#include "boost/smart_ptr.hpp"
+#include "boost/cstdint.hpp"
+
+namespace cosmo {
+    class PhiloxRandom;
+    // Generates a zoom-in realization: a coarse periodic parent grid, and a child region of
+    // the parent that is refined by an integer factor. The child field is the parent's own
+    // Fourier series evaluated on the fine grid (so every parent mode is shared exactly),
+    // plus the modes of a periodic box the size of the child region that lie beyond the
+    // parent Nyquist frequency along any axis. Both sets of modes use counter-based random
+    // values keyed by (seed,realization,mode), so each realization is reproducible and the
+    // child is consistent with its parent whatever the number of threads. The parent series
+    // is evaluated one axis at a time and only at the child grid points, using chirp-z
+    // transforms whose size is set by the parent and child dimensions along that axis
+    // rather than by the refined parent length, unless a zero-padded transform of the
+    // refined length is cheaper. Since the first pass visits every parent mode, adding the
+    // parent modes costs about as much as one to a few FFTs of the parent grid, in addition
+    // to the FFT of the child grid. The grid accessed through this base class is the child
+    // grid.
+	class NestedGaussianRandomFieldGenerator : public AbsGaussianRandomFieldGenerator {
+	public:
+	    // Creates a new generator for a parent grid with the specified spacing in Mpc/h and
+	    // dimensions, and a child region of (cx,cy,cz) parent cells starting at the parent
+	    // grid point (x0,y0,z0) that is refined by the specified factor. The child region
+	    // wraps around the periodic parent grid if necessary.
+		NestedGaussianRandomFieldGenerator(PowerSpectrumPtr powerSpectrum, double spacing,
+		    int nx, int ny, int nz, int refinement, int x0, int y0, int z0, int cx, int cy, int cz);
+		virtual ~NestedGaussianRandomFieldGenerator();
+        // Generates new parent and child realizations.
+        virtual void generate();
+        // Returns the generator of our parent grid, whose r-space field is available after
+        // each call to generate().
+        FftGaussianRandomFieldGenerator const &getParent() const;
+        // Accessors for constructor parameters.
+        int getRefinement() const;
+        void getChildOrigin(int &x0, int &y0, int &z0) const;
+        // Sets the seed and the realization number of the next call to generate(), which
+        // increments after each call. The default seed is zero.
+        void setCounterSeed(boost::uint64_t seed, boost::uint64_t realization = 0);
+        boost::uint64_t getRealization() const;
+        // Sets the number of threads to use. Must be called before the first call to generate().
+        void setNumThreads(int nthreads);
+        int getNumThreads() const;
+        // Saves the most recent child realization to the named binary grid file.
+        virtual void saveField(std::string const &filename, boost::uint64_t seed = 0) const;
+        // Returns the memory size in bytes required for this generator, including its parent.
+        virtual std::size_t getMemorySize() const;
+	private:
+        class Implementation;
+        boost::scoped_ptr<Implementation> _pimpl;
+        boost::scoped_ptr<FftGaussianRandomFieldGenerator> _parent;
+        boost::scoped_ptr<GaussianRandomFieldSigmaTable> _sigmaTable;
+        boost::scoped_ptr<PhiloxRandom> _random;
+        int _refinement, _origin[3], _halfz, _nthreads;
+        boost::uint64_t _realization;
+        std::size_t _nbuf, _nlong;
+        void _initialize();
+        // Fills our buffer with the child modes beyond the parent Nyquist frequency.
+        void _generateShortModes(boost::uint64_t realization);
+        // Adds the parent Fourier series on the child grid to our r-space buffer.
+        void _addLongModes();
+        virtual double _getFieldUnchecked(int x, int y, int z) const;
+	}; // NestedGaussianRandomFieldGenerator
+
+    inline FftGaussianRandomFieldGenerator const &NestedGaussianRandomFieldGenerator::getParent() const {
+        return *_parent;
+    }
+    inline int NestedGaussianRandomFieldGenerator::getRefinement() const { return _refinement; }
+    inline void NestedGaussianRandomFieldGenerator::getChildOrigin(int &x0, int &y0, int &z0) const {
+        x0 = _origin[0];
+        y0 = _origin[1];
+        z0 = _origin[2];
+    }
+    inline boost::uint64_t NestedGaussianRandomFieldGenerator::getRealization() const { return _realization; }
+    inline int NestedGaussianRandomFieldGenerator::getNumThreads() const { return _nthreads; }
+
+} // cosmo
+
+#endif // COSMO_NESTED_GAUSSIAN_RANDOM_FIELD_GENERATOR
@@ -0,0 +1,203 @@
+// Created 18-Oct-2026
+
+#include "cosmo/OutOfCoreGaussianRandomFieldGenerator.h"
+#include "cosmo/FftGaussianRandomFieldGenerator.h"
+#include "cosmo/GaussianRandomFieldSigmaTable.h"
+#include "cosmo/PhiloxRandom.h"
+#include "cosmo/GridFileWriter.h"
+#include "cosmo/RuntimeError.h"
+
+#include "config.h"
+#ifdef HAVE_LIBFFTW3F
+#include "fftw3.h"
+#define FFTW(X) fftwf_ ## X // float transforms
+#endif
+
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+
+namespace local = cosmo;
+
+local::OutOfCoreGaussianRandomFieldGenerator::OutOfCoreGaussianRandomFieldGenerator(
+PowerSpectrumPtr powerSpectrum, double spacing, int nx, int ny, int nz, boost::uint64_t seed,
+std::size_t memoryBudget, std::string const &scratchName)
+: _spacing(spacing), _nx(nx), _ny(ny), _nz(nz), _halfz(nz/2+1), _random(new PhiloxRandom(seed)),
+_nthreads(1), _scratchName(scratchName)
+{
+#ifndef HAVE_LIBFFTW3F
+    throw RuntimeError("OutOfCoreGaussianRandomFieldGenerator: package not built with FFTW3.");
+#endif
+    if(spacing <= 0) {
+        throw RuntimeError("OutOfCoreGaussianRandomFieldGenerator: invalid grid spacing.");
+    }
+    if(nx <= 0 || ny <= 0 || nz <= 0) {
+        throw RuntimeError("OutOfCoreGaussianRandomFieldGenerator: invalid grid size.");
+    }
+    if(0 == scratchName.length()) {
+        throw RuntimeError("OutOfCoreGaussianRandomFieldGenerator: missing scratch file name.");
+    }
+    // The first pass needs 8*nx*ny bytes for each kz plane and the second pass needs
+    // 8*ny*(nz/2+1) bytes for each x slab, plus 8*ny bytes to stage its reads.
+    std::size_t planeSize = 8*(std::size_t)nx*ny, slabSize = 8*(std::size_t)ny*(_halfz+1);
+    _planesPerBatch = (int)std::min<std::size_t>(_halfz,memoryBudget/planeSize);
+    _slabsPerBatch = (int)std::min<std::size_t>(nx,memoryBudget/slabSize);
+    if(0 == _planesPerBatch || 0 == _slabsPerBatch) {
+        throw RuntimeError("OutOfCoreGaussianRandomFieldGenerator: memory budget is too small.");
+    }
+    _sigmaTable.reset(new GaussianRandomFieldSigmaTable(powerSpectrum,spacing,nx,ny,nz));
+    _powerHash = hashPowerSpectrum(powerSpectrum,spacing,nx,ny,nz);
+}
+
+local::OutOfCoreGaussianRandomFieldGenerator::~OutOfCoreGaussianRandomFieldGenerator() { }
+
+void local::OutOfCoreGaussianRandomFieldGenerator::setNumThreads(int nthreads) {
+    if(nthreads <= 0) {
+        throw RuntimeError("OutOfCoreGaussianRandomFieldGenerator::setNumThreads: expected nthreads > 0.");
+    }
+    FftGaussianRandomFieldGenerator::initializeThreads();
+    _nthreads = nthreads;
+}
+
+void local::OutOfCoreGaussianRandomFieldGenerator::generate(std::string const &outputName,
+boost::uint64_t realization) {
+    // The scratch file is as large as the full k-space grid, so always remove it.
+    try {
+        _transformPlanes(realization);
+        _transformSlabs(outputName,realization);
+    }
+    catch(...) {
+        std::remove(_scratchName.c_str());
+        throw;
+    }
+    std::remove(_scratchName.c_str());
+}
+
+void local::OutOfCoreGaussianRandomFieldGenerator::_transformPlanes(boost::uint64_t realization) {
+#ifdef HAVE_LIBFFTW3F
+    std::ofstream scratch(_scratchName.c_str(),std::ios::binary | std::ios::trunc);
+    if(!scratch.good()) {
+        throw RuntimeError("OutOfCoreGaussianRandomFieldGenerator: unable to open scratch file.");
+    }
+    std::size_t planeSize((std::size_t)_nx*_ny);
+    FFTW(complex) *data = (FFTW(complex)*)FFTW(malloc)(sizeof(FFTW(complex))*planeSize*_planesPerBatch);
+    if(0 == data) {
+        throw RuntimeError("OutOfCoreGaussianRandomFieldGenerator: unable to allocate plane buffer.");
+    }
+    PhiloxRandom const &random(*_random);
+    GaussianRandomFieldSigmaTable const &table(*_sigmaTable);
+    int nxby2(_nx/2), nyby2(_ny/2), dims[2] = { _nx, _ny };
+    for(int iz0 = 0; iz0 < _halfz; iz0 += _planesPerBatch) {
+        int nplanes = std::min(_planesPerBatch,_halfz-iz0);
+        // Generate this batch of kz planes with the same (mode,realization) counters and
+        // float rounding as FftGaussianRandomFieldGenerator, so that the fields agree.
+        for(int iplane = 0; iplane < nplanes; ++iplane) {
+            int iz = iz0 + iplane;
+            FFTW(complex) *plane = data + planeSize*iplane;
+#pragma omp parallel for schedule(static) num_threads(_nthreads)
+            for(int ix = 0; ix < _nx; ++ix) {
+                int jx = (ix > nxby2 ? ix-_nx : ix);
+                for(int iy = 0; iy < _ny; ++iy) {
+                    int jy = (iy > nyby2 ? iy-_ny : iy);
+                    double g1,g2;
+                    random.getNormalPair(iz+_halfz*(iy+(std::size_t)_ny*ix),realization,g1,g2);
+                    double sigma = table.getSigma(jx,jy,iz);
+                    std::size_t index(iy+(std::size_t)_ny*ix);
+                    plane[index][0] = (float)g1*sigma;
+                    plane[index][1] = (float)g2*sigma;
+                }
+            }
+        }
+        // Transform each plane from (kx,ky) to (x,y).
+#ifdef HAVE_LIBFFTW3F_THREADS
+        FFTW(plan_with_nthreads)(_nthreads);
+#endif
+        FFTW(plan) plan = FFTW(plan_many_dft)(2,dims,nplanes,data,0,1,(int)planeSize,
+            data,0,1,(int)planeSize,FFTW_BACKWARD,FFTW_ESTIMATE);
+        FFTW(execute)(plan);
+        FFTW(destroy_plan)(plan);
+        // Append the transformed planes to the scratch file, which is ordered by (kz,x,y).
+        scratch.write((char const*)data,(std::streamsize)(sizeof(FFTW(complex))*planeSize*nplanes));
+        if(!scratch.good()) {
+            FFTW(free)(data);
+            throw RuntimeError("OutOfCoreGaussianRandomFieldGenerator: error writing scratch file.");
+        }
+    }
+    FFTW(free)(data);
+    scratch.close();
+#endif
+}
+
+void local::OutOfCoreGaussianRandomFieldGenerator::_transformSlabs(std::string const &outputName,
+boost::uint64_t realization) {
+#ifdef HAVE_LIBFFTW3F
+    std::ifstream scratch(_scratchName.c_str(),std::ios::binary);
+    if(!scratch.good()) {
+        throw RuntimeError("OutOfCoreGaussianRandomFieldGenerator: unable to open scratch file.");
+    }
+    // The grid file records the seed of realization zero, which is the only one that can
+    // be reproduced from the seed alone.
+    GridFileWriter out(outputName,_nx,_ny,_nz,_nz,_spacing,GridFileHeader::Float32,
+        realization ? 0 : _random->getSeed(),_powerHash);
+    std::size_t slabSize((std::size_t)_ny*_halfz);
+    FFTW(complex) *data = (FFTW(complex)*)FFTW(malloc)(sizeof(FFTW(complex))*slabSize*_slabsPerBatch);
+    FFTW(complex) *staging = (FFTW(complex)*)FFTW(malloc)(sizeof(FFTW(complex))*(std::size_t)_ny*_slabsPerBatch);
+    if(0 == data || 0 == staging) {
+        if(data) FFTW(free)(data);
+        if(staging) FFTW(free)(staging);
+        throw RuntimeError("OutOfCoreGaussianRandomFieldGenerator: unable to allocate slab buffer.");
+    }
+    float *realData = (float*)data;
+    int nz(_nz);
+    bool ok(true);
+    for(int x0 = 0; x0 < _nx && ok; x0 += _slabsPerBatch) {
+        int nslabs = std::min(_slabsPerBatch,_nx-x0);
+        std::size_t nrows((std::size_t)nslabs*_ny);
+        // Transpose this batch of x slabs from (kz,x,y) order in the scratch file to
+        // (x,y,kz) order in memory, reading one contiguous block per kz plane.
+        for(int iz = 0; iz < _halfz; ++iz) {
+            std::streamoff offset = (std::streamoff)sizeof(FFTW(complex))*(((std::streamoff)iz*_nx + x0)*_ny);
+            scratch.seekg(offset);
+            scratch.read((char*)staging,(std::streamsize)(sizeof(FFTW(complex))*nrows));
+            if(!scratch.good()) {
+                ok = false;
+                break;
+            }
+            for(std::size_t row = 0; row < nrows; ++row) {
+                data[iz+_halfz*row][0] = staging[row][0];
+                data[iz+_halfz*row][1] = staging[row][1];
+            }
+        }
+        if(!ok) break;
+        // Transform each (x,y) row from kz to z in place.
+#ifdef HAVE_LIBFFTW3F_THREADS
+        FFTW(plan_with_nthreads)(_nthreads);
+#endif
+        FFTW(plan) plan = FFTW(plan_many_dft_c2r)(1,&nz,(int)nrows,data,0,1,_halfz,
+            realData,0,1,2*_halfz,FFTW_ESTIMATE);
+        FFTW(execute)(plan);
+        FFTW(destroy_plan)(plan);
+        // Stream the real values of each row to the output file, skipping the padding.
+        try {
+            for(std::size_t row = 0; row < nrows; ++row) {
+                out.write(realData + 2*_halfz*row,_nz);
+            }
+        }
+        catch(RuntimeError const &) {
+            ok = false;
+        }
+    }
+    FFTW(free)(staging);
+    FFTW(free)(data);
+    if(!ok) {
+        throw RuntimeError("OutOfCoreGaussianRandomFieldGenerator: error transferring slab data.");
+    }
+    out.close();
+#endif
+}
+
+std::size_t local::OutOfCoreGaussianRandomFieldGenerator::getMemorySize() const {
+    std::size_t planeBytes = 8*(std::size_t)_nx*_ny*_planesPerBatch;
+    std::size_t slabBytes = 8*(std::size_t)_ny*(_halfz+1)*_slabsPerBatch;
+    return sizeof(*this) + std::max(planeBytes,slabBytes) + _sigmaTable->getMemorySize();
+}
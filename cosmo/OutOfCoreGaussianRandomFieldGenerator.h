@@ -0,0 +1,63 @@
+// Created 18-Oct-2026
+
+#ifndef COSMO_OUT_OF_CORE_GAUSSIAN_RANDOM_FIELD_GENERATOR
+#define COSMO_OUT_OF_CORE_GAUSSIAN_RANDOM_FIELD_GENERATOR
+
+#include "cosmo/types.h"
+
+#include "boost/smart_ptr.hpp"
+#include "boost/cstdint.hpp"
+
+#include <string>
+#include <cstddef>
+
+namespace cosmo {
+    class GaussianRandomFieldSigmaTable;
+    // Generates Gaussian random fields that are too large to hold in memory. The k-space
+    // modes are generated with a counter-based random source so that they can be produced
+    // in any order. The 3D inverse FFT is performed as 2D complex transforms of batches of
+    // kz planes, whose results are staged through a scratch file, followed by 1D c2r
+    // transforms along z of batches of x slabs, which are streamed to the output file.
+    // The realizations are the same as FftGaussianRandomFieldGenerator with the same
+    // counter seed, up to floating-point roundoff.
+	class OutOfCoreGaussianRandomFieldGenerator {
+	public:
+	    // Creates a new generator for the specified grid spacing in Mpc/h and dimensions
+	    // that uses at most memoryBudget bytes for its field buffers and stages intermediate
+	    // results through the specified scratch file, which needs 8*nx*ny*(nz/2+1) bytes.
+		OutOfCoreGaussianRandomFieldGenerator(PowerSpectrumPtr powerSpectrum, double spacing,
+		    int nx, int ny, int nz, boost::uint64_t seed, std::size_t memoryBudget,
+		    std::string const &scratchName);
+		virtual ~OutOfCoreGaussianRandomFieldGenerator();
+		// Generates the specified realization and writes its r-space values to the named
+		// unpadded binary grid file (see GridFileHeader).
+		void generate(std::string const &outputName, boost::uint64_t realization = 0);
+		// Returns the number of kz planes transformed in each batch of the first pass and
+		// the number of x slabs transformed in each batch of the second pass.
+		int getPlanesPerBatch() const;
+		int getSlabsPerBatch() const;
+		// Sets the number of threads to use for generating modes and for FFTs. The default is 1.
+		void setNumThreads(int nthreads);
+		int getNumThreads() const;
+        // Returns the peak memory size in bytes used by this generator.
+        std::size_t getMemorySize() const;
+	private:
+        double _spacing;
+        int _nx, _ny, _nz, _halfz, _planesPerBatch, _slabsPerBatch, _nthreads;
+        PhiloxRandomPtr _random;
+        boost::uint64_t _powerHash;
+        std::string _scratchName;
+        boost::scoped_ptr<GaussianRandomFieldSigmaTable> _sigmaTable;
+        // Performs the first pass for the specified realization, writing to our scratch file.
+        void _transformPlanes(boost::uint64_t realization);
+        // Performs the second pass, reading our scratch file and writing the named output file.
+        void _transformSlabs(std::string const &outputName, boost::uint64_t realization);
+	}; // OutOfCoreGaussianRandomFieldGenerator
+	
+	inline int OutOfCoreGaussianRandomFieldGenerator::getPlanesPerBatch() const { return _planesPerBatch; }
+	inline int OutOfCoreGaussianRandomFieldGenerator::getSlabsPerBatch() const { return _slabsPerBatch; }
+	inline int OutOfCoreGaussianRandomFieldGenerator::getNumThreads() const { return _nthreads; }
+
+} // cosmo
+
+#endif // COSMO_OUT_OF_CORE_GAUSSIAN_RANDOM_FIELD_GENERATOR
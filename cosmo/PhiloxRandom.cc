@@ -0,0 +1,51 @@
+// Created 18-Oct-2026
+
+#include "cosmo/PhiloxRandom.h"
+
+#include <cmath>
+
+namespace local = cosmo;
+
+namespace {
+    // Philox4x32 multipliers and Weyl key increments.
+    const boost::uint32_t PhiloxM0 = 0xD2511F53u, PhiloxM1 = 0xCD9E8D57u;
+    const boost::uint32_t PhiloxW0 = 0x9E3779B9u, PhiloxW1 = 0xBB67AE85u;
+} // anonymous
+
+local::PhiloxRandom::PhiloxRandom(boost::uint64_t seed)
+: _seed(seed)
+{ }
+
+local::PhiloxRandom::~PhiloxRandom() { }
+
+void local::PhiloxRandom::getWords(boost::uint64_t lo, boost::uint64_t hi, boost::uint32_t words[4]) const {
+    boost::uint32_t c0(lo), c1(lo >> 32), c2(hi), c3(hi >> 32);
+    boost::uint32_t k0(_seed), k1(_seed >> 32);
+    for(int round = 0; round < 10; ++round) {
+        boost::uint64_t p0 = (boost::uint64_t)PhiloxM0*c0, p1 = (boost::uint64_t)PhiloxM1*c2;
+        boost::uint32_t hi0(p0 >> 32), lo0(p0), hi1(p1 >> 32), lo1(p1);
+        c0 = hi1 ^ c1 ^ k0;
+        c1 = lo1;
+        c2 = hi0 ^ c3 ^ k1;
+        c3 = lo0;
+        k0 += PhiloxW0;
+        k1 += PhiloxW1;
+    }
+    words[0] = c0;
+    words[1] = c1;
+    words[2] = c2;
+    words[3] = c3;
+}
+
+void local::PhiloxRandom::getNormalPair(boost::uint64_t lo, boost::uint64_t hi, double &g1, double &g2) const {
+    boost::uint32_t words[4];
+    getWords(lo,hi,words);
+    // Build two uniform values in (0,1) with 53-bit resolution from pairs of words.
+    const double twoToMinus53(1./9007199254740992.);
+    double u1 = ((((boost::uint64_t)words[0] << 21) | (words[1] >> 11)) + 0.5)*twoToMinus53;
+    double u2 = ((((boost::uint64_t)words[2] << 21) | (words[3] >> 11)) + 0.5)*twoToMinus53;
+    double twopi(8*std::atan(1));
+    double r = std::sqrt(-2*std::log(u1)), phi = twopi*u2;
+    g1 = r*std::cos(phi);
+    g2 = r*std::sin(phi);
+}
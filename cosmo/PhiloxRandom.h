@@ -0,0 +1,34 @@
+// Created 18-Oct-2026
+
+#ifndef COSMO_PHILOX_RANDOM
+#define COSMO_PHILOX_RANDOM
+
+#include "boost/cstdint.hpp"
+
+namespace cosmo {
+    // Implements the Philox4x32-10 counter-based random number generator of Salmon et al,
+    // "Parallel random numbers: as easy as 1, 2, 3" (SC11). Each call maps a 128-bit counter
+    // and our 64-bit key to four independent 32-bit random words, with no internal state,
+    // so that any number of threads can generate the values for any counters in any order
+    // and obtain identical results.
+	class PhiloxRandom {
+	public:
+	    // Creates a new generator using the specified seed as its key.
+		PhiloxRandom(boost::uint64_t seed);
+		virtual ~PhiloxRandom();
+		// Returns our seed.
+		boost::uint64_t getSeed() const;
+		// Fills words with the random output for the 128-bit counter (hi,lo).
+		void getWords(boost::uint64_t lo, boost::uint64_t hi, boost::uint32_t words[4]) const;
+		// Returns a pair of independent unit Gaussian random values for the 128-bit
+		// counter (hi,lo), calculated with the Box-Muller method.
+		void getNormalPair(boost::uint64_t lo, boost::uint64_t hi, double &g1, double &g2) const;
+	private:
+        boost::uint64_t _seed;
+	}; // PhiloxRandom
+	
+    inline boost::uint64_t PhiloxRandom::getSeed() const { return _seed; }
+
+} // cosmo
+
+#endif // COSMO_PHILOX_RANDOM
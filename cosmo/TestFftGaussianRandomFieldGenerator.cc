@@ -61,6 +61,8 @@ void local::TestFftGaussianRandomFieldGenerator::generateFieldK() {
     _pimpl->data = (FFTW(complex)*)&_buffer[0];
     _transformed = getRandom()->fillFloatArrayNormal(ngen);
     _pimpl->output = (FFTW(complex)*)&_transformed[0];
+    // The r-space values are the real parts of our complex output buffer.
+    setFieldView(&_transformed[0],2*getNz(),2);
     _pimpl->plan = FFTW(plan_dft_3d)(getNx(),getNy(),getNz(),_pimpl->data,_pimpl->output,-1,FFTW_ESTIMATE);
     // Scale each complex value according to the power for the coresponding k-vector.
     double twopi(8*std::atan(1)), spacing(getSpacing());
@@ -99,6 +99,34 @@ double local::legendreP(int ell, double mu) {
     }
 }
 
+void local::getGaussLegendre(int n, std::vector<double> &x, std::vector<double> &w, double a, double b) {
+    if(n <= 0) throw RuntimeError("getGaussLegendre: expected n > 0.");
+    x.resize(n);
+    w.resize(n);
+    double pi(4*std::atan(1)), mid(0.5*(a+b)), half(0.5*(b-a));
+    // The roots are symmetric so we only need to find half of them.
+    for(int i = 0; i < (n+1)/2; ++i) {
+        // Newton iterations starting from an asymptotic estimate of the i-th root of P_n.
+        double z(std::cos(pi*(i+0.75)/(n+0.5))), dp;
+        for(int iter = 0; iter < 100; ++iter) {
+            // Evaluate P_n(z) and its derivative using the three-term recurrence.
+            double p1(1), p2(0);
+            for(int j = 1; j <= n; ++j) {
+                double p3(p2);
+                p2 = p1;
+                p1 = ((2*j-1)*z*p2-(j-1)*p3)/j;
+            }
+            dp = n*(z*p1-p2)/(z*z-1);
+            double dz(p1/dp);
+            z -= dz;
+            if(std::fabs(dz) < 1e-14) break;
+        }
+        x[i] = mid - half*z;
+        x[n-1-i] = mid + half*z;
+        w[i] = w[n-1-i] = 2*half/((1-z*z)*dp*dp);
+    }
+}
+
 namespace cosmo {
     class MultipoleIntegrand {
     public:
@@ -10,6 +10,8 @@
 #include "boost/function.hpp"
 #include "boost/smart_ptr.hpp"
 
+#include <vector>
+
 namespace cosmo {
     // Represents an isotropic power spectrum of 3D inhomogeneities based on a model of
     // primordial fluctuations and a transfer function.
@@ -53,6 +55,11 @@ namespace cosmo {
 	// Evaluates the Legendre polynomial for even ell up to 12 and returns 0 for any other ell.
     double legendreP(int ell, double mu);
 
+    // Fills x and w with the abscissas and weights of the n-point Gauss-Legendre
+    // quadrature rule for the interval [a,b].
+    void getGaussLegendre(int n, std::vector<double> &x, std::vector<double> &w,
+        double a = -1, double b = +1);
+
     // Returns the specified multipole projection of the function provided, calculated
     // using numerical integration over 0 < mu < 1. Only even 0 <= ell <= 12 are implemented.
     double getMultipole(likely::GenericFunctionPtr fOfMuPtr, int ell, double epsAbs = 1e-6, double epsRel = 1e-6);
@@ -0,0 +1,13 @@
+// Created 18-Oct-2026
+
+#include "cosmo/WallClock.h"
+
+#include <sys/time.h>
+
+namespace local = cosmo;
+
+double local::getWallTime() {
+    struct timeval now;
+    gettimeofday(&now,0);
+    return now.tv_sec + 1e-6*now.tv_usec;
+}
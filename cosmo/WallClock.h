@@ -0,0 +1,12 @@
+// Created 18-Oct-2026
+
+#ifndef COSMO_WALL_CLOCK
+#define COSMO_WALL_CLOCK
+
+namespace cosmo {
+    // Returns the elapsed wall-clock time in seconds since an arbitrary fixed reference,
+    // with microsecond resolution, for timing code that may run on several threads.
+    double getWallTime();
+} // cosmo
+
+#endif // COSMO_WALL_CLOCK
@@ -21,7 +21,23 @@
 #include "cosmo/AdaptiveMultipoleTransform.h"
 #include "cosmo/DistortedPowerCorrelation.h"
 #include "cosmo/DistortedPowerCorrelationFft.h"
+#include "cosmo/DistortedPowerCorrelationNestedFft.h"
+#include "cosmo/DistortedPowerCorrelationHankel.h"
 
+#include "cosmo/PhiloxRandom.h"
 #include "cosmo/AbsGaussianRandomFieldGenerator.h"
 #include "cosmo/FftGaussianRandomFieldGenerator.h"
 #include "cosmo/TestFftGaussianRandomFieldGenerator.h"
+#include "cosmo/GaussianRandomFieldSigmaTable.h"
+#include "cosmo/OutOfCoreGaussianRandomFieldGenerator.h"
+#include "cosmo/BatchedGaussianRandomFieldGenerator.h"
+#include "cosmo/MultiFieldGaussianRandomFieldGenerator.h"
+#include "cosmo/GridPowerSpectrumEstimator.h"
+#include "cosmo/GridCorrelationEstimator.h"
+#include "cosmo/GridPeakStacker.h"
+#include "cosmo/ConstrainedGaussianRandomFieldGenerator.h"
+#include "cosmo/NestedGaussianRandomFieldGenerator.h"
+#include "cosmo/GridFile.h"
+#include "cosmo/GridFileWriter.h"
+#include "cosmo/MappedGridFile.h"
+#include "cosmo/WallClock.h"
@@ -19,6 +19,43 @@ namespace cosmo {
     class AbsGaussianRandomFieldGenerator;
     typedef boost::shared_ptr<AbsGaussianRandomFieldGenerator> AbsGaussianRandomFieldGeneratorPtr;
 
+    class PhiloxRandom;
+    typedef boost::shared_ptr<PhiloxRandom> PhiloxRandomPtr;
+
+    class GaussianRandomFieldSigmaTable;
+    typedef boost::shared_ptr<const GaussianRandomFieldSigmaTable> GaussianRandomFieldSigmaTableCPtr;
+
+    class OutOfCoreGaussianRandomFieldGenerator;
+    typedef boost::shared_ptr<OutOfCoreGaussianRandomFieldGenerator> OutOfCoreGaussianRandomFieldGeneratorPtr;
+
+    class BatchedGaussianRandomFieldGenerator;
+    typedef boost::shared_ptr<BatchedGaussianRandomFieldGenerator> BatchedGaussianRandomFieldGeneratorPtr;
+
+    class MultiFieldGaussianRandomFieldGenerator;
+    typedef boost::shared_ptr<MultiFieldGaussianRandomFieldGenerator> MultiFieldGaussianRandomFieldGeneratorPtr;
+
+    class GridPowerSpectrumEstimator;
+    typedef boost::shared_ptr<GridPowerSpectrumEstimator> GridPowerSpectrumEstimatorPtr;
+
+    class GridCorrelationEstimator;
+    typedef boost::shared_ptr<GridCorrelationEstimator> GridCorrelationEstimatorPtr;
+
+    class GridPeakStacker;
+    typedef boost::shared_ptr<GridPeakStacker> GridPeakStackerPtr;
+
+    class ConstrainedGaussianRandomFieldGenerator;
+    typedef boost::shared_ptr<ConstrainedGaussianRandomFieldGenerator> ConstrainedGaussianRandomFieldGeneratorPtr;
+
+    class NestedGaussianRandomFieldGenerator;
+    typedef boost::shared_ptr<NestedGaussianRandomFieldGenerator> NestedGaussianRandomFieldGeneratorPtr;
+
+    class GridFileWriter;
+    typedef boost::shared_ptr<GridFileWriter> GridFileWriterPtr;
+
+    class MappedGridFile;
+    typedef boost::shared_ptr<MappedGridFile> MappedGridFilePtr;
+    typedef boost::shared_ptr<const MappedGridFile> MappedGridFileCPtr;
+
     class TabulatedPower;
     typedef boost::shared_ptr<const TabulatedPower> TabulatedPowerCPtr;
 
@@ -34,6 +71,14 @@ namespace cosmo {
     typedef boost::shared_ptr<DistortedPowerCorrelationFft> DistortedPowerCorrelationFftPtr;
     typedef boost::shared_ptr<const DistortedPowerCorrelationFft> DistortedPowerCorrelationFftCPtr;
 
+    class DistortedPowerCorrelationNestedFft;
+    typedef boost::shared_ptr<DistortedPowerCorrelationNestedFft> DistortedPowerCorrelationNestedFftPtr;
+    typedef boost::shared_ptr<const DistortedPowerCorrelationNestedFft> DistortedPowerCorrelationNestedFftCPtr;
+
+    class DistortedPowerCorrelationHankel;
+    typedef boost::shared_ptr<DistortedPowerCorrelationHankel> DistortedPowerCorrelationHankelPtr;
+    typedef boost::shared_ptr<const DistortedPowerCorrelationHankel> DistortedPowerCorrelationHankelCPtr;
+
     // Represents a function that returns a dimensionless transfer function value T(k)
     // given an input wavenumber k in 1/(Mpc/h).
     typedef boost::function<double (double)> TransferFunction;
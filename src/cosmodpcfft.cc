@@ -14,6 +14,7 @@
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <vector>
 
 namespace po = boost::program_options;
 namespace lk = likely;
@@ -99,14 +100,17 @@ int main(int argc, char **argv) {
     // Configure command-line option processing
     po::options_description cli("Cosmology distorted power correlation function");
     std::string input,delta,output;
-    int nx,ny,nz,nr,nk,nmu;
-    double spacing,rmin,rmax,maxRelError,kmin,kmax;
+    int nx,ny,nz,nr,nk,nmu,nkTable,nmuTable,fineN,ellMax,nwedge,nquad;
+    double spacing,rmin,rmax,maxRelError,kmin,kmax,fineSpacing,rsplit,veps;
     double bias,biasbeta,biasGamma,biasSourceAbsorber,biasAbsorberResponse,meanFreePath,
         snlPar,snlPerp,kc,kcAlt,pc,sigma8,qnl,kv,av,bv,kp,knl,pnl,kpp,pp,kv0,pv,kvi,pvi;
     bool imagpart;
     cli.add_options()
         ("help,h", "prints this info and exits.")
         ("verbose", "prints additional information.")
+        ("double-precision", "uses double-precision FFTs (twice the memory of the default single precision).")
+        ("save-grid", "saves the tabulated xi(rperp,rpar) of a single grid to <output>.xi.grid.")
+        ("hankel", "uses a Hankel transform in kperp and 1D FFT along the ny line-of-sight points instead of a 3D FFT.")
         ("input,i", po::value<std::string>(&input)->default_value(""),
             "filename to read k,P(k) values from")
         ("delta", po::value<std::string>(&delta)->default_value(""),
@@ -121,6 +125,15 @@ int main(int argc, char **argv) {
             "Grid size along line-of-sight y-axis (or zero for ny=nx).")
         ("nz", po::value<int>(&nz)->default_value(0),
             "Grid size along z-axis (or zero for nz=ny).")
+        ("fine-spacing", po::value<double>(&fineSpacing)->default_value(0),
+            "Spacing in Mpc/h of a nested fine grid for small separations (or zero for a single grid).")
+        ("fine-n", po::value<int>(&fineN)->default_value(160),
+            "Size of the nested fine grid along each axis (ignored when fine-spacing = 0).")
+        ("rsplit", po::value<double>(&rsplit)->default_value(0),
+            "Scale in Mpc/h for splitting power between nested grids (or zero for the coarse spacing).")
+        ("compare-single", "compares nested grids with a single grid of the fine spacing covering the coarse grid.")
+        ("veps", po::value<double>(&veps)->default_value(0.01),
+            "Hankel transform accuracy parameter (ignored unless hankel is specified).")
         ("bias", po::value<double>(&bias)->default_value(-0.14),
             "linear tracer bias")
         ("biasbeta", po::value<double>(&biasbeta)->default_value(-0.196),
@@ -187,7 +200,17 @@ int main(int argc, char **argv) {
             "number of points spanning [rmin,rmax] to use")
         ("nmu", po::value<int>(&nmu)->default_value(11),
             "number of equally spaced mu_k and mu_r values for saving results")
+        ("ell-max", po::value<int>(&ellMax)->default_value(-1),
+            "maximum even multipole xi_ell(r) to append to the saved r values (or -1 for none)")
+        ("nwedge", po::value<int>(&nwedge)->default_value(0),
+            "number of equal |mu| wedges to append to the saved r values (or 0 for none)")
+        ("nquad", po::value<int>(&nquad)->default_value(16),
+            "number of Gauss-Legendre points for multipole and wedge projections")
         ("imagpart", po::value<bool>(&imagpart)->default_value(false), "specify whether or not the Power Spectrum has imaginary part")
+        ("nk-table", po::value<int>(&nkTable)->default_value(0),
+            "number of k values for tabulating the distortion (or zero to evaluate at each grid point)")
+        ("nmu-table", po::value<int>(&nmuTable)->default_value(201),
+            "number of mu values for tabulating the distortion (ignored when nk-table = 0)")
         ;
     // Do the command line parsing now
     po::variables_map vm;
@@ -203,7 +226,8 @@ int main(int argc, char **argv) {
         std::cout << cli << std::endl;
         return 1;
     }
-    bool verbose(vm.count("verbose"));
+    bool verbose(vm.count("verbose")), doublePrecision(vm.count("double-precision")),
+        useHankel(vm.count("hankel"));
 
     if(input.length() == 0) {
         std::cerr << "Missing input filename." << std::endl;
@@ -213,6 +237,24 @@ int main(int argc, char **argv) {
 	// Fill in any missing grid dimensions.
     if(0 == ny) ny = nx;
     if(0 == nz) nz = ny;
+    if(fineSpacing > 0 && (ny != nx || nz != nx)) {
+        std::cerr << "Nested grids must be cubic." << std::endl;
+        return 1;
+    }
+    if((ellMax >= 0 || nwedge > 0) && (useHankel || fineSpacing > 0)) {
+        std::cerr << "Multipoles and wedges are only available with a single grid." << std::endl;
+        return 1;
+    }
+    if(useHankel && (doublePrecision || fineSpacing > 0 || !vm["fine-n"].defaulted() ||
+        !vm["rsplit"].defaulted() || nkTable > 0 || vm.count("save-grid") || vm.count("compare-single"))) {
+        std::cerr << "Option hankel cannot be combined with double-precision, fine-spacing, fine-n, rsplit, "
+            << "nk-table, save-grid or compare-single." << std::endl;
+        return -2;
+    }
+    if(fineSpacing <= 0 && (!vm["fine-n"].defaulted() || !vm["rsplit"].defaulted() || vm.count("compare-single"))) {
+        std::cerr << "Options fine-n, rsplit and compare-single require fine-spacing." << std::endl;
+        return -2;
+    }
 
     try {
         cosmo::TabulatedPowerCPtr power =
@@ -233,14 +275,87 @@ int main(int argc, char **argv) {
         cosmo::KMuPkFunctionCPtr imdistPtr(new cosmo::KMuPkFunction(boost::bind(
             &LyaDistortion::operator(),rsd,_1,_2,_3)));
 
-    	cosmo::DistortedPowerCorrelationFft dpc(PkPtr,distPtr,imdistPtr,imagpart,spacing,nx,ny,nz);
-    	if(verbose) {
-        	std::cout << "Memory size = "
-            	<< boost::format("%.1f Mb") % (dpc.getMemorySize()/1048576.) << std::endl;
-    	}
-    	// Transform
-    	dpc.transform();
+        // Create a single grid, nested coarse + fine grids, or a Hankel transform engine.
+        boost::shared_ptr<cosmo::DistortedPowerCorrelationFft> dpc;
+        boost::shared_ptr<cosmo::DistortedPowerCorrelationNestedFft> nested;
+        boost::shared_ptr<cosmo::DistortedPowerCorrelationHankel> hankel;
+        cosmo::RMuFunction getPower, getCorrelation;
+        std::size_t memorySize;
+        if(useHankel) {
+            hankel.reset(new cosmo::DistortedPowerCorrelationHankel(PkPtr,distPtr,imdistPtr,imagpart,
+                spacing,ny,spacing*nx/2,veps));
+            getPower = boost::bind(&cosmo::DistortedPowerCorrelationHankel::getPower,hankel,_1,_2);
+            getCorrelation = boost::bind(&cosmo::DistortedPowerCorrelationHankel::getCorrelation,hankel,_1,_2);
+            memorySize = hankel->getMemorySize();
+        }
+        else if(fineSpacing > 0) {
+            nested.reset(new cosmo::DistortedPowerCorrelationNestedFft(PkPtr,distPtr,imdistPtr,imagpart,
+                spacing,nx,fineSpacing,fineN,rsplit,doublePrecision));
+            if(nkTable > 0) nested->setDistortionTable(nkTable,nmuTable);
+            getPower = boost::bind(&cosmo::DistortedPowerCorrelationNestedFft::getPower,nested,_1,_2);
+            getCorrelation = boost::bind(&cosmo::DistortedPowerCorrelationNestedFft::getCorrelation,nested,_1,_2);
+            memorySize = nested->getMemorySize();
+        }
+        else {
+            dpc.reset(new cosmo::DistortedPowerCorrelationFft(PkPtr,distPtr,imdistPtr,imagpart,
+                spacing,nx,ny,nz,doublePrecision));
+            if(nkTable > 0) dpc->setDistortionTable(nkTable,nmuTable);
+            dpc->setQuadraturePoints(nquad);
+            getPower = boost::bind(&cosmo::DistortedPowerCorrelationFft::getPower,dpc,_1,_2);
+            getCorrelation = boost::bind(&cosmo::DistortedPowerCorrelationFft::getCorrelation,dpc,_1,_2);
+            memorySize = dpc->getMemorySize();
+        }
+        if(verbose) {
+            std::cout << "Memory size = "
+                << boost::format("%.1f Mb") % (memorySize/1048576.) << std::endl;
+        }
+        // Transform
+        if(hankel) {
+            hankel->transform();
+            if(verbose) {
+                std::cout << "Hankel transforms use " << hankel->getNKPerp() << " kperp values" << std::endl;
+            }
+        }
+        else if(nested) {
+            nested->transform();
+            if(verbose) {
+                std::cout << "Nested grids split at " << nested->getSplitScale() << " Mpc/h" << std::endl;
+            }
+            if(vm.count("compare-single")) {
+                // Compare with a single grid that has the fine spacing and the coarse extent.
+                int nsingle = (int)std::floor(nx*spacing/fineSpacing + 0.5);
+                cosmo::DistortedPowerCorrelationFft single(PkPtr,distPtr,imdistPtr,imagpart,
+                    fineSpacing,nsingle,nsingle,nsingle,doublePrecision);
+                if(nkTable > 0) single.setDistortionTable(nkTable,nmuTable);
+                std::cout << "Comparing with a single grid of size " << nsingle << " using "
+                    << boost::format("%.1f Mb") % (single.getMemorySize()/1048576.) << std::endl;
+                single.transform();
+                double dr = (rmax-rmin)/(nr-1.), dmu = 1./(nmu-1.), maxDiff(0), maxXi(0), rWorst(rmin), muWorst(1);
+                for(int i = 0; i < nr; ++i) {
+                    double r = rmin + i*dr;
+                    for(int j = 0; j < nmu; ++j) {
+                        double mu = 1 - j*dmu;
+                        double xi = single.getCorrelation(r,mu);
+                        double diff = std::fabs(nested->getCorrelation(r,mu) - xi);
+                        if(std::fabs(xi) > maxXi) maxXi = std::fabs(xi);
+                        if(diff > maxDiff) {
+                            maxDiff = diff;
+                            rWorst = r;
+                            muWorst = mu;
+                        }
+                    }
+                }
+                std::cout << boost::format("Max |nested - single| = %.3g (%.3g of max |xi|) at r = %.1f, mu = %.2f")
+                    % maxDiff % (maxXi > 0 ? maxDiff/maxXi : 0.) % rWorst % muWorst << std::endl;
+            }
+        }
+        else {
+            dpc->transform();
+        }
         if(output.length() > 0) {
+            if(dpc && vm.count("save-grid")) {
+                dpc->saveCorrelationGrid(output + ".xi.grid");
+            }
             double dmu = 1./(nmu-1.);
             // Write out values tabulated for log-spaced k
             double dk = std::pow(kmax/kmin,1./(nk-1.));
@@ -251,23 +366,46 @@ int main(int argc, char **argv) {
                 kout << boost::lexical_cast<std::string>(k);
                 for(int j = 0; j < nmu; ++j) {
                     double mu = 1 - j*dmu;
-                    kout << ' ' << boost::lexical_cast<std::string>(dpc.getPower(k,mu));
+                    kout << ' ' << boost::lexical_cast<std::string>(getPower(k,mu));
                 }
                 kout << std::endl;
             }
             kout.close();
             // Write out values tabulated for linear-spaced r
             double dr = (rmax-rmin)/(nr-1.);
+            std::vector<double> rvec(nr), muvec(nmu), xi;
+            for(int i = 0; i < nr; ++i) rvec[i] = rmin + i*dr;
+            for(int j = 0; j < nmu; ++j) muvec[j] = 1 - j*dmu;
+            // Use batch evaluation when we have a single grid.
+            std::vector<std::vector<double> > columns;
+            if(dpc) {
+                dpc->getCorrelation(rvec,muvec,xi);
+                for(int ell = 0; ell <= ellMax; ell += 2) {
+                    columns.push_back(std::vector<double>());
+                    dpc->getCorrelationMultipoles(rvec,ell,columns.back());
+                }
+                for(int w = 0; w < nwedge; ++w) {
+                    columns.push_back(std::vector<double>());
+                    dpc->getCorrelationWedges(rvec,w/(double)nwedge,(w+1)/(double)nwedge,columns.back());
+                }
+            }
+            else {
+                xi.resize(nr*nmu);
+                for(int i = 0; i < nr; ++i) {
+                    for(int j = 0; j < nmu; ++j) xi[j+nmu*i] = getCorrelation(rvec[i],muvec[j]);
+                }
+            }
             std::string rfile = output + ".r.dat";
             std::ofstream rout(rfile.c_str());
             for(int i = 0; i < nr; ++i) {
-                double r = rmin + i*dr;
-                rout << boost::lexical_cast<std::string>(r);
+                rout << boost::lexical_cast<std::string>(rvec[i]);
                 for(int j = 0; j < nmu; ++j) {
-                    double mu = 1 - j*dmu;
-                    rout << ' ' << boost::lexical_cast<std::string>(dpc.getCorrelation(r,mu));
+                    rout << ' ' << boost::lexical_cast<std::string>(xi[j+nmu*i]);
+                }
+                for(std::size_t c = 0; c < columns.size(); ++c) {
+                    rout << ' ' << boost::lexical_cast<std::string>(columns[c][i]);
                 }
-                rout << std::endl;                
+                rout << std::endl;
             }
             rout.close();
         }
@@ -16,21 +16,36 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <algorithm>
 
 namespace po = boost::program_options;
 namespace lk = likely;
 
+// Accumulates field values for AbsGaussianRandomFieldGenerator::reduce.
+struct AccumulateValue {
+    void operator()(lk::WeightedAccumulator &accumulator, float value) const {
+        accumulator.accumulate(value);
+    }
+};
+
 int main(int argc, char **argv) {
     
     // Configure command-line option processing
-    double spacing;
+    double spacing, memoryBudget;
     long npairs;
-    int nx,ny,nz,seed,pairseed,nbins,nkbins,deltaSliceAvg;
-    std::string loadPowerFile, corrfile, powerfile, outfile, saveDeltaFile;
+    int nx,ny,nz,seed,pairseed,nbins,nkbins,deltaSliceAvg,nthreads,powerEllMax,corrEllMax,losAxis,
+        zoomRefinement,zoomSize,zoomX,zoomY,zoomZ;
+    std::string planStrategy, scratchFile, loadPowerFile, corrfile, powerfile, outfile, saveDeltaFile,
+        displacementPrefix, corr2dfile, zoomParentFile;
     po::options_description cli("Gaussian random field generator");
     cli.add_options()
         ("help,h", "Prints this info and exits.")
         ("verbose", "Prints additional information.")
+        ("counter-rng", "Uses a counter-based random source keyed by the seed, so that results do not depend on the number of threads.")
+        ("threads", po::value<int>(&nthreads)->default_value(1),
+            "Number of threads to use for generating the field.")
+        ("plan", po::value<std::string>(&planStrategy)->default_value("estimate"),
+            "FFTW planning strategy: estimate, measure or patient.")
         ("spacing", po::value<double>(&spacing)->default_value(1),
             "Grid spacing in Mpc/h.")
         ("nx", po::value<int>(&nx)->default_value(64),
@@ -49,8 +64,13 @@ int main(int argc, char **argv) {
             "Random seed to use for GRF.")
         ("corrfile", po::value<std::string>(&corrfile)->default_value(""),
             "Name of correlation function output file, leave blank to skip.")
+        ("corr2dfile", po::value<std::string>(&corr2dfile)->default_value(""),
+            "Name of (rperp,rpar) correlation function output file, leave blank to skip.")
+        ("corr-ell-max", po::value<int>(&corrEllMax)->default_value(0),
+            "Maximum even multipole of the correlation function to calculate.")
+        ("pair-corr", "Estimates the correlation function from random pairs instead of exactly using FFTs.")
         ("npairs", po::value<long>(&npairs)->default_value(1000000),
-            "Number of pairs to use in correlation function estimate.")
+            "Number of pairs to use in correlation function estimate with pair-corr.")
         ("pair-seed", po::value<int>(&pairseed)->default_value(42),
             "Random seed to use for correlation function pairs.")
         ("nbins", po::value<int>(&nbins)->default_value(50),
@@ -59,8 +79,32 @@ int main(int argc, char **argv) {
             "Name of power spectrum output file, leave blank to skip.")
         ("nkbins", po::value<int>(&nkbins)->default_value(100),
             "Number of k bins to use for power spectrum measurement.")
+        ("log-kbins", "Uses logarithmic instead of linear k bins for the power spectrum measurement.")
+        ("power-ell-max", po::value<int>(&powerEllMax)->default_value(0),
+            "Maximum even multipole of the power spectrum to measure.")
+        ("los-axis", po::value<int>(&losAxis)->default_value(2),
+            "Line-of-sight axis (0,1,2 for x,y,z) for power spectrum and correlation function multipoles.")
         ("output", po::value<std::string>(&outfile)->default_value(""),
-            "Filename to write delta field to.")
+            "Filename to write delta field to, as a binary grid file unless text-output is set.")
+        ("text-output", "Writes the delta field as text lines of 'x y z delta wgt' instead of a binary grid.")
+        ("save-displacements", po::value<std::string>(&displacementPrefix)->default_value(""),
+            "Saves the Zel'dovich displacements of the same realization to binary grid files PREFIX.psi[xyz].grid.")
+        ("memory-budget", po::value<double>(&memoryBudget)->default_value(0),
+            "Generates the field out of core using at most this many Mb for field buffers and writes it to the output file as binary floats (or zero to generate in memory).")
+        ("scratch", po::value<std::string>(&scratchFile)->default_value("cosmogrf.scratch"),
+            "Name of the scratch file used for out-of-core generation.")
+        ("zoom-refinement", po::value<int>(&zoomRefinement)->default_value(0),
+            "Generates a nested zoom-in region refined by this factor and writes it to the output file as a binary grid (or zero to generate a single grid).")
+        ("zoom-size", po::value<int>(&zoomSize)->default_value(0),
+            "Size of the cubic zoom-in region in parent grid cells (or zero for nx/4).")
+        ("zoom-x", po::value<int>(&zoomX)->default_value(0),
+            "Parent grid x index of the zoom-in region origin.")
+        ("zoom-y", po::value<int>(&zoomY)->default_value(0),
+            "Parent grid y index of the zoom-in region origin.")
+        ("zoom-z", po::value<int>(&zoomZ)->default_value(0),
+            "Parent grid z index of the zoom-in region origin.")
+        ("zoom-parent", po::value<std::string>(&zoomParentFile)->default_value(""),
+            "Saves the parent grid of a zoom-in realization to the named binary grid file.")
         ;
 
     // do the command line parsing now
@@ -85,6 +129,24 @@ int main(int argc, char **argv) {
         std::cerr << "nkbins must be > 0" << std::endl;
         return -3;
     }
+    if(nthreads <= 0) {
+        std::cerr << "threads must be > 0" << std::endl;
+        return -3;
+    }
+    cosmo::FftGaussianRandomFieldGenerator::Strategy strategy;
+    if(planStrategy == "estimate") {
+        strategy = cosmo::FftGaussianRandomFieldGenerator::EstimatePlan;
+    }
+    else if(planStrategy == "measure") {
+        strategy = cosmo::FftGaussianRandomFieldGenerator::MeasurePlan;
+    }
+    else if(planStrategy == "patient") {
+        strategy = cosmo::FftGaussianRandomFieldGenerator::PatientPlan;
+    }
+    else {
+        std::cerr << "Invalid plan strategy: " << planStrategy << std::endl;
+        return -3;
+    }
     bool verbose(vm.count("verbose"));
 
     // Fill in any missing grid dimensions.
@@ -125,60 +187,144 @@ int main(int argc, char **argv) {
         return -2;
     }
     
+    // Generate the field out of core, if requested, without any further analysis.
+    if(memoryBudget > 0) {
+        if(0 == outfile.length()) {
+            std::cerr << "Missing required output filename for out-of-core generation." << std::endl;
+            return -2;
+        }
+        try {
+            cosmo::OutOfCoreGaussianRandomFieldGenerator generator(power, spacing, nx, ny, nz, seed,
+                (std::size_t)(memoryBudget*1048576), scratchFile);
+            generator.setNumThreads(nthreads);
+            if(verbose) {
+                std::cout << "Memory size = "
+                    << boost::format("%.1f Mb") % (generator.getMemorySize()/1048576.)
+                    << " using " << generator.getPlanesPerBatch() << " kz planes and "
+                    << generator.getSlabsPerBatch() << " x slabs per batch" << std::endl;
+            }
+            generator.generate(outfile);
+        }
+        catch(std::runtime_error const &e) {
+            std::cerr << "ERROR: exiting with an exception:\n  " << e.what() << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+
+    // Generate a nested zoom-in field, if requested, without any further analysis.
+    if(zoomRefinement > 0) {
+        if(0 == outfile.length()) {
+            std::cerr << "Missing required output filename for zoom-in generation." << std::endl;
+            return -2;
+        }
+        if(0 == zoomSize) zoomSize = std::max(1,nx/4);
+        try {
+            cosmo::NestedGaussianRandomFieldGenerator generator(power, spacing, nx, ny, nz, zoomRefinement,
+                zoomX, zoomY, zoomZ, zoomSize, zoomSize, zoomSize);
+            generator.setCounterSeed(seed);
+            generator.setNumThreads(nthreads);
+            generator.generate();
+            if(verbose) {
+                std::cout << "Memory size = "
+                    << boost::format("%.1f Mb") % (generator.getMemorySize()/1048576.) << std::endl;
+                std::cout << boost::format("Generated a (%d,%d,%d) zoom-in grid with %.3f Mpc/h spacing.")
+                    % generator.getNx() % generator.getNy() % generator.getNz() % generator.getSpacing()
+                    << std::endl;
+            }
+            generator.saveField(outfile,seed);
+            if(zoomParentFile.length() > 0) generator.getParent().saveField(zoomParentFile,seed);
+        }
+        catch(std::runtime_error const &e) {
+            std::cerr << "ERROR: exiting with an exception:\n  " << e.what() << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+
     // Initialize the random number source.
     lk::Random::instance()->setSeed(seed);
     
-    // Create the generator.
-    cosmo::FftGaussianRandomFieldGenerator generator(power, spacing, nx, ny, nz);
+    // Create the generator. When displacements are requested, a single multi-field generator
+    // derives delta and psi from the same k-space draw, and its delta field is used below.
+    typedef cosmo::MultiFieldGaussianRandomFieldGenerator MultiField;
+    boost::scoped_ptr<cosmo::FftGaussianRandomFieldGenerator> fftGenerator;
+    boost::scoped_ptr<MultiField> multiGenerator;
+    if(displacementPrefix.length() > 0) {
+        multiGenerator.reset(new MultiField(power, spacing, nx, ny, nz,
+            MultiField::Delta | MultiField::Displacement));
+        if(vm.count("counter-rng")) multiGenerator->setCounterSeed(seed);
+        multiGenerator->setNumThreads(nthreads);
+        multiGenerator->setPlanStrategy(strategy);
+    }
+    else {
+        fftGenerator.reset(new cosmo::FftGaussianRandomFieldGenerator(power, spacing, nx, ny, nz));
+        if(vm.count("counter-rng")) fftGenerator->setCounterSeed(seed);
+        fftGenerator->setNumThreads(nthreads);
+        fftGenerator->setPlanStrategy(strategy);
+    }
+    cosmo::AbsGaussianRandomFieldGenerator &generator = multiGenerator ?
+        (cosmo::AbsGaussianRandomFieldGenerator&)*multiGenerator :
+        (cosmo::AbsGaussianRandomFieldGenerator&)*fftGenerator;
     if(verbose) {
         std::cout << "Memory size = "
             << boost::format("%.1f Mb") % (generator.getMemorySize()/1048576.) << std::endl;
     }
 
-    // Generate delta field in k-space.
-    generator.generateFieldK();
+    // Generate delta field in k-space, or all fields in r-space with the multi-field generator.
+    if(multiGenerator) multiGenerator->generate();
+    else fftGenerator->generateFieldK();
 
-    // Perform power spectrum estimate from k-space delta field.
+    // Perform power spectrum estimate from k-space delta field, or from the r-space delta
+    // field of the multi-field generator.
     if (powerfile.length() > 0) {
-        // Prepare power spectrum bins.
-        double kmax = pi/spacing, kmin = pi/(spacing*std::pow(nx*ny*nz,1./3.));
-        double binsize = (kmax-kmin)/nkbins;
-        boost::scoped_array<lk::WeightedAccumulator> 
-            powerAccumulator(new lk::WeightedAccumulator[nkbins]);
-        // k-space grid spacing.
-        double dkx(2*pi/(nx*spacing)), dky(2*pi/(ny*spacing)), dkz(2*pi/(nz*spacing));
-        double powerNorm = nx*ny*nz*spacing*spacing*spacing;
-        for(int ix = 0; ix < nx; ++ix){
-            double kx = (ix > nx/2 ? ix-nx : ix)*dkx;
-            for(int iy = 0; iy < ny; ++iy){
-                double ky = (iy > ny/2 ? iy-ny : iy)*dky;
-                for(int iz = 0; iz < nz; ++iz){
-                    double kz = (iz > nz/2 ? iz-nz : iz)*dkz;
-                    double ksq = kx*kx + ky*ky + kz*kz;
-                    double k = std::sqrt(ksq);
-                    int index = (int) ((k-kmin)/binsize);
-                    if (index < 0 || index >= nkbins) continue;
-                    double redk(generator.getFieldKRe(ix,iy,iz)), imdk(generator.getFieldKIm(ix,iy,iz));
-                    powerAccumulator[index].accumulate(powerNorm*(redk*redk+imdk*imdk));
+        try {
+            double kmax = pi/spacing, kmin = pi/(spacing*std::pow(nx*ny*nz,1./3.));
+            cosmo::GridPowerSpectrumEstimator estimator(nx, ny, nz, spacing, kmin, kmax, nkbins,
+                vm.count("log-kbins") ? cosmo::GridPowerSpectrumEstimator::LogBins :
+                cosmo::GridPowerSpectrumEstimator::LinearBins, powerEllMax, losAxis);
+            estimator.setNumThreads(nthreads);
+            if(multiGenerator) estimator.estimate(multiGenerator->getFieldView(MultiField::Delta));
+            else estimator.estimate(*fftGenerator);
+            // Output power spectrum.
+            std::ofstream out(powerfile.c_str());
+            for(int i = 0; i < nkbins; ++i) {
+                out << boost::format("%d %f %f %f %d") 
+                    % i % estimator.getBinCenter(i)
+                    % estimator.getPower(i) % estimator.getPowerVariance(i)
+                    % (long)estimator.getNumModes(i);
+                for(int ell = 2; ell <= powerEllMax; ell += 2) {
+                    out << ' ' << estimator.getPower(i,ell);
                 }
+                out << std::endl;
             }
+            out.close();
         }
-        // Output power spectrum.
-        std::ofstream out(powerfile.c_str());
-        for(int i = 0; i < nkbins; ++i) {
-            out << boost::format("%d %f %f %f %d") 
-                % i % (kmin + (i+.5)*binsize)
-                % powerAccumulator[i].mean() % powerAccumulator[i].variance() 
-                % powerAccumulator[i].count() << std::endl;
+        catch(std::exception const &e) {
+            std::cerr << "Error while estimating power spectrum: " << e.what() << std::endl;
         }
-        out.close();
     }
 
     // Perform FFT to realspace.
-    generator.transformFieldToR();
+    if(fftGenerator) fftGenerator->transformFieldToR();
+    if(verbose) {
+        double randomTime, scaleTime, fftTime;
+        if(multiGenerator) multiGenerator->getTimings(randomTime,scaleTime,fftTime);
+        else fftGenerator->getTimings(randomTime,scaleTime,fftTime);
+        std::cout << boost::format("Generation times (secs): random %.3f, scale %.3f, FFT %.3f")
+            % randomTime % scaleTime % fftTime << std::endl;
+    }
 
     // Write delta field to file
-    if (outfile.length() > 0) {
+    if (outfile.length() > 0 && !vm.count("text-output")) {
+        try {
+            generator.saveField(outfile,seed);
+        }
+        catch(std::exception const &e) {
+            std::cerr << "Error while saving delta field: " << e.what() << std::endl;
+        }
+    }
+    else if (outfile.length() > 0) {
         try {
             std::ofstream out(outfile.c_str());
             double wgt = 1;
@@ -200,6 +346,18 @@ int main(int argc, char **argv) {
         }
     }
     
+    // Save the Zel'dovich displacements derived from the same k-space modes as delta.
+    if(multiGenerator) {
+        try {
+            multiGenerator->saveField(MultiField::DisplacementX,displacementPrefix + ".psix.grid",seed);
+            multiGenerator->saveField(MultiField::DisplacementY,displacementPrefix + ".psiy.grid",seed);
+            multiGenerator->saveField(MultiField::DisplacementZ,displacementPrefix + ".psiz.grid",seed);
+        }
+        catch(std::exception const &e) {
+            std::cerr << "Error while saving displacement fields: " << e.what() << std::endl;
+        }
+    }
+
     // Perform correlation function estimate on r-space delta field.
     if(saveDeltaFile.length() > 0) {
         std::ofstream out(saveDeltaFile.c_str());
@@ -216,8 +374,47 @@ int main(int argc, char **argv) {
         out.close();
     }
     
-    // Perform correlation function estimate from r-space delta field.
-    if (corrfile.length() > 0) {
+    // Calculate the exact correlation function of the r-space delta field.
+    if ((corrfile.length() > 0 || corr2dfile.length() > 0) && !vm.count("pair-corr")) {
+        try {
+            double rmin(0), rmax(200);
+            cosmo::GridCorrelationEstimator estimator(nx, ny, nz, spacing, rmin, rmax, nbins,
+                corrEllMax, losAxis);
+            estimator.setNumThreads(nthreads);
+            estimator.estimate(generator.getFieldView());
+            if(corrfile.length() > 0) {
+                std::ofstream out(corrfile.c_str());
+                for(int i = 0; i < nbins; ++i) {
+                    out << boost::format("%d %f %f %g %d")
+                        % i % estimator.getBinCenter(i) % estimator.getMeanR(i)
+                        % estimator.getCorrelation(i) % (long)estimator.getNumLags(i);
+                    for(int ell = 2; ell <= corrEllMax; ell += 2) {
+                        out << ' ' << estimator.getCorrelation(i,ell);
+                    }
+                    out << std::endl;
+                }
+                out.close();
+            }
+            if(corr2dfile.length() > 0) {
+                std::ofstream out(corr2dfile.c_str());
+                for(int ipar = 0; ipar < nbins; ++ipar) {
+                    for(int iperp = 0; iperp < nbins; ++iperp) {
+                        out << boost::format("%f %f %g %d")
+                            % estimator.getBinCenter(iperp) % estimator.getBinCenter(ipar)
+                            % estimator.getCorrelation2D(iperp,ipar)
+                            % (long)estimator.getNumLags2D(iperp,ipar) << std::endl;
+                    }
+                }
+                out.close();
+            }
+        }
+        catch(std::exception const &e) {
+            std::cerr << "Error while calculating correlation function: " << e.what() << std::endl;
+        }
+    }
+
+    // Estimate the correlation function from random pairs of the r-space delta field.
+    if (corrfile.length() > 0 && vm.count("pair-corr")) {
         double rmin(0), rmax(200);
         double binsize = (rmax - rmin)/nbins;
         // Prepare correlation function accumulators.
@@ -274,14 +471,8 @@ int main(int argc, char **argv) {
 
     if(verbose) {
         // Calculate the statistics of the generated delta field.
-        lk::WeightedAccumulator accumulator;
-        for(int ix = 0; ix < nx; ++ix) {
-            for(int iy = 0; iy < ny; ++iy) {
-                for(int iz = 0; iz < nz; ++iz) {
-                    accumulator.accumulate(generator.getField(ix,iy,iz));
-                }
-            }
-        }
+        lk::WeightedAccumulator accumulator =
+            generator.reduce(lk::WeightedAccumulator(),AccumulateValue());
         // Compare with var(k1,k2) = Integral[k^2/(2pi) P(k),{k,k1,k2}]. This will not match exactly
         // because we are comparing a sphere in k-space with a cuboid in r-space.
         double kmax = pi/spacing, kmin = pi/(spacing*std::pow(nx*ny*nz,1./3.));
@@ -1,5 +1,5 @@
 // Created 8-Oct-2012 by Daniel Margala (University of California, Irvine) <dmargala@uci.edu>
-// Stacks many Gaussian random fields on the field maximum (or minimum).
+// Stacks many Gaussian random fields on the field maximum (or minimum), or on all of their peaks.
 
 #include "cosmo/cosmo.h"
 #include "likely/likely.h"
@@ -11,6 +11,12 @@
 #include <fstream>
 #include <string>
 #include <cmath>
+#include <algorithm>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace po = boost::program_options;
 namespace lk = likely;
@@ -20,17 +26,156 @@ double distance(double x0, double x1, double period){
     double dx(x1 - x0);
     return (dx > 0 ? (dx > period/2 ? dx - period : dx) : (dx < -period/2 ? dx + period : dx) );
 }
+
+// Accumulates the sum, sum of squares and number of values in each histogram bin.
+struct BinSums {
+    BinSums(int nbins) : sum(nbins,0), sumsq(nbins,0), count(nbins,0) { }
+    double mean(int bin) const { return count[bin] > 0 ? sum[bin]/count[bin] : 0; }
+    double variance(int bin) const {
+        double mu(mean(bin));
+        return count[bin] > 0 ? sumsq[bin]/count[bin] - mu*mu : 0;
+    }
+    void accumulate(int bin, double value) {
+        sum[bin] += value;
+        sumsq[bin] += value*value;
+        ++count[bin];
+    }
+    void add(BinSums const &other) {
+        for(std::size_t bin = 0; bin < sum.size(); ++bin) {
+            sum[bin] += other.sum[bin];
+            sumsq[bin] += other.sumsq[bin];
+            count[bin] += other.count[bin];
+        }
+    }
+    std::vector<double> sum, sumsq;
+    std::vector<long> count;
+};
+
+// Finds the first grid point with the largest (or smallest) field value.
+struct ExtremeFinder {
+    ExtremeFinder(bool findMinimum) : minimum(findMinimum), first(true) { }
+    void operator()(int x, int y, int z, float value) {
+        if(first || (minimum ? value < extremeValue : value > extremeValue)) {
+            first = false;
+            extremeValue = value;
+            extremeIndex[0] = x;
+            extremeIndex[1] = y;
+            extremeIndex[2] = z;
+        }
+    }
+    bool minimum, first;
+    float extremeValue;
+    int extremeIndex[3];
+};
+
+// Returns the grid point to stack the current field of the generator on, which is either
+// the specified fixed point or else the field maximum (or minimum).
+void findStackPoint(cosmo::AbsGaussianRandomFieldGenerator const &generator, int const *fixedIndex,
+bool minimum, int extremeIndex[3]) {
+    if(0 == fixedIndex) {
+        ExtremeFinder finder(generator.forEachVoxel(ExtremeFinder(minimum)));
+        std::copy(finder.extremeIndex,finder.extremeIndex+3,extremeIndex);
+    }
+    else {
+        std::copy(fixedIndex,fixedIndex+3,extremeIndex);
+    }
+}
+
+// Accumulates the 1-d and 2-d histograms and the extreme values of stacked fields.
+struct StackAccumulator {
+    StackAccumulator(int nbins) : xi(nbins), xi2d(nbins*nbins), extreme(1) { }
+    // Adds a field stacked on the specified grid point, using the 1-d and 2-d histogram
+    // bins of each periodic offset from that point (or -1 outside the histogram).
+    void accumulate(cosmo::GaussianRandomFieldView const &field, int const extremeIndex[3],
+    std::vector<int> const &offsetBin, std::vector<int> const &offsetBin2d) {
+        extreme.accumulate(0,field(extremeIndex[0],extremeIndex[1],extremeIndex[2]));
+        int nx(field.nx), ny(field.ny), nz(field.nz);
+        for(int ix = 0; ix < nx; ++ix){
+            int ox(ix - extremeIndex[0]);
+            if(ox < 0) ox += nx;
+            for(int iy = 0; iy < ny; ++iy){
+                int oy(iy - extremeIndex[1]);
+                if(oy < 0) oy += ny;
+                float const *row(field.getRow(ix,iy));
+                std::size_t offsetRow(nz*(oy + (std::size_t)ny*ox));
+                for(int iz = 0; iz < nz; ++iz){
+                    int oz(iz - extremeIndex[2]);
+                    if(oz < 0) oz += nz;
+                    double value(row[field.step*iz]);
+                    int bin(offsetBin[offsetRow + oz]), bin2d(offsetBin2d[offsetRow + oz]);
+                    if(bin >= 0) xi.accumulate(bin,value);
+                    if(bin2d >= 0) xi2d.accumulate(bin2d,value);
+                }
+            }
+        }
+    }
+    // Adds a field stacked on each of the peaks found by the specified stacker, using the
+    // sums over peaks that its last stack() calculated for each periodic offset.
+    void accumulatePeaks(cosmo::GridPeakStacker const &stacker,
+    std::vector<int> const &offsetBin, std::vector<int> const &offsetBin2d) {
+        int npeaks(stacker.getNumPeaks());
+        if(0 == npeaks) return;
+        for(int peak = 0; peak < npeaks; ++peak) extreme.accumulate(0,stacker.getPeakValue(peak));
+        cosmo::GaussianRandomFieldView sums(stacker.getSumView()), squares(stacker.getSquareSumView());
+        int nx(sums.nx), ny(sums.ny), nz(sums.nz);
+        for(int ox = 0; ox < nx; ++ox){
+            for(int oy = 0; oy < ny; ++oy){
+                float const *sumRow(sums.getRow(ox,oy)), *squareRow(squares.getRow(ox,oy));
+                std::size_t offsetRow(nz*(oy + (std::size_t)ny*ox));
+                for(int oz = 0; oz < nz; ++oz){
+                    int bin(offsetBin[offsetRow + oz]), bin2d(offsetBin2d[offsetRow + oz]);
+                    if(bin >= 0) {
+                        xi.sum[bin] += sumRow[oz];
+                        xi.sumsq[bin] += squareRow[oz];
+                        xi.count[bin] += npeaks;
+                    }
+                    if(bin2d >= 0) {
+                        xi2d.sum[bin2d] += sumRow[oz];
+                        xi2d.sumsq[bin2d] += squareRow[oz];
+                        xi2d.count[bin2d] += npeaks;
+                    }
+                }
+            }
+        }
+    }
+    void add(StackAccumulator const &other) {
+        xi.add(other.xi);
+        xi2d.add(other.xi2d);
+        extreme.add(other.extreme);
+    }
+    BinSums xi, xi2d, extreme;
+};
+
+// Saves the 1d stack to the named file.
+void saveStack1d(std::string const &filename, BinSums const &xi, double binsize, double rmin) {
+    std::ofstream out(filename.c_str());
+    boost::format outFormat("%.2f %.10f %.10f %d");
+    for(int index = 0; index < (int)xi.sum.size(); ++index) {
+        out << (outFormat % ((index+.5)*binsize+rmin)
+            % xi.mean(index) % xi.variance(index) % xi.count[index]) << std::endl;
+    }
+    out.close();
+}
  
 int main(int argc, char **argv) {
     // Configure command-line option processing
-    double spacing, xlos, ylos, zlos, binsize, rmin;
+    double spacing, xlos, ylos, zlos, binsize, rmin, peakNu, constrainNu;
     long npairs;
-    int nx,ny,nz,seed,nfields,nbins;
-    std::string loadPowerFile, prefix;
+    int nx,ny,nz,seed,nfields,nbins,nthreads,batchSize,workers,maxPeaks;
+    std::string planStrategy, loadPowerFile, prefix, saveField;
     po::options_description cli("Stacks many Gaussian random fields on the field maximum (or minimum).");
     cli.add_options()
         ("help,h", "Prints this info and exits.")
         ("verbose", "Prints additional information.")
+        ("counter-rng", "Uses a counter-based random source keyed by the seed, so that results do not depend on the number of threads.")
+        ("threads", po::value<int>(&nthreads)->default_value(1),
+            "Number of threads to use for generating each field.")
+        ("plan", po::value<std::string>(&planStrategy)->default_value("estimate"),
+            "FFTW planning strategy: estimate, measure or patient.")
+        ("batch", po::value<int>(&batchSize)->default_value(1),
+            "Number of fields to generate at once with a single batched FFT.")
+        ("workers", po::value<int>(&workers)->default_value(0),
+            "Number of worker threads that each generate and stack whole fields, using counter-based random substreams keyed by the seed and field index, so that results do not depend on the number of workers (or zero to stack fields serially).")
         ("spacing", po::value<double>(&spacing)->default_value(4),
             "Grid spacing in Mpc/h.")
         ("nx", po::value<int>(&nx)->default_value(76),
@@ -45,12 +190,22 @@ int main(int argc, char **argv) {
             "Random seed to use for GRF.")
         ("prefix", po::value<std::string>(&prefix)->default_value("stack"),
             "Prefix for output file names.")
+        ("save-field", po::value<std::string>(&saveField)->default_value(""),
+            "Saves the last generated field to the named binary grid file.")
         ("nfields", po::value<int>(&nfields)->default_value(1000),
             "Number of fields to stack.")
         ("fiducial",
             "Stack relative to box center instead of local maximum.")
         ("minimum",
             "Stack relative to the local minimum instead of local maximum.")
+        ("peaks",
+            "Stack relative to every local maximum (or minimum) of each field above the peak threshold, using FFT cross correlations.")
+        ("peak-nu", po::value<double>(&peakNu)->default_value(2),
+            "Peak threshold in units of the field RMS.")
+        ("max-peaks", po::value<int>(&maxPeaks)->default_value(0),
+            "Maximum number of the most extreme peaks to stack in each field (or zero for all peaks above threshold).")
+        ("constrain-nu", po::value<double>(&constrainNu),
+            "Generates constrained realizations with a maximum (or minimum) of height nu times the field RMS at the box center, with zero gradient and the mean BBKS peak curvature for this height, and stacks on the center.")
         ("snapshot",
             "Save snapshot of 1d projection every 10%%.")
         ("xlos", po::value<double>(&xlos)->default_value(1),
@@ -83,13 +238,55 @@ int main(int argc, char **argv) {
         return 1;
     }  
     bool verbose(vm.count("verbose")), fiducial(vm.count("fiducial")), snapshot(vm.count("snapshot")),
-        minimum(vm.count("minimum"));
+        minimum(vm.count("minimum")), peaks(vm.count("peaks")), constrained(vm.count("constrain-nu"));
 
     double normlos(std::sqrt(xlos*xlos + ylos*ylos + zlos*zlos));
     if(normlos <= 0){
         std::cerr << "Invalid line-of-sight specification: norm must be > 0." << std::endl;
         return -2;
     }
+    if(nthreads <= 0) {
+        std::cerr << "Invalid number of threads: must be > 0." << std::endl;
+        return -2;
+    }
+    if(batchSize <= 0) {
+        std::cerr << "Invalid batch size: must be > 0." << std::endl;
+        return -2;
+    }
+    if(workers < 0) {
+        std::cerr << "Invalid number of workers: must be >= 0." << std::endl;
+        return -2;
+    }
+    if(workers > 0 && (vm.count("test") || batchSize > 1)) {
+        std::cerr << "Workers cannot be combined with the test or batched generators." << std::endl;
+        return -2;
+    }
+    if(peaks && fiducial) {
+        std::cerr << "Options peaks and fiducial are mutually exclusive." << std::endl;
+        return -2;
+    }
+    if(constrained && (fiducial || peaks || vm.count("test") || batchSize > 1)) {
+        std::cerr << "Option constrain-nu cannot be combined with fiducial, peaks, test or batch." << std::endl;
+        return -2;
+    }
+    if(peaks && (peakNu < 0 || maxPeaks < 0)) {
+        std::cerr << "Invalid peak options: peak-nu and max-peaks must be >= 0." << std::endl;
+        return -2;
+    }
+    cosmo::FftGaussianRandomFieldGenerator::Strategy strategy;
+    if(planStrategy == "estimate") {
+        strategy = cosmo::FftGaussianRandomFieldGenerator::EstimatePlan;
+    }
+    else if(planStrategy == "measure") {
+        strategy = cosmo::FftGaussianRandomFieldGenerator::MeasurePlan;
+    }
+    else if(planStrategy == "patient") {
+        strategy = cosmo::FftGaussianRandomFieldGenerator::PatientPlan;
+    }
+    else {
+        std::cerr << "Invalid plan strategy: " << planStrategy << std::endl;
+        return -2;
+    }
 
     // Fill in any missing grid dimensions.
     if(0 == ny) ny = nx;
@@ -133,25 +330,90 @@ int main(int argc, char **argv) {
     // Initialize the random number source.
     lk::Random::instance()->setSeed(seed);
 
+    // Constrained realizations have a maximum (or minimum) of height nu*sigma at the box
+    // center, with zero gradient and the mean peak curvature for this height.
+    double constrainSign(minimum ? -1 : +1);
+
     // Create the generator.
     cosmo::AbsGaussianRandomFieldGeneratorPtr generator;
-    if(vm.count("test")) {
+    boost::shared_ptr<cosmo::FftGaussianRandomFieldGenerator> fftGenerator;
+    boost::shared_ptr<cosmo::BatchedGaussianRandomFieldGenerator> batchedGenerator;
+    std::vector<boost::shared_ptr<cosmo::FftGaussianRandomFieldGenerator> > workerGenerators;
+    if(workers > 0) {
+        // Each worker has its own generator. Generate one field with each of them here, to
+        // tabulate its power spectrum and create its FFTW plan, since neither the power
+        // spectrum interpolator nor the FFTW planner is thread safe.
+        for(int worker = 0; worker < workers; ++worker) {
+            boost::shared_ptr<cosmo::FftGaussianRandomFieldGenerator> workerGenerator;
+            if(constrained) {
+                cosmo::ConstrainedGaussianRandomFieldGeneratorPtr constrainedGenerator(
+                    new cosmo::ConstrainedGaussianRandomFieldGenerator(power, spacing, nx, ny, nz));
+                constrainedGenerator->constrainPeak(constrainSign*constrainNu);
+                workerGenerator = constrainedGenerator;
+            }
+            else {
+                workerGenerator.reset(new cosmo::FftGaussianRandomFieldGenerator(power, spacing, nx, ny, nz));
+            }
+            workerGenerator->setPlanStrategy(strategy);
+            workerGenerator->setCounterSeed(seed);
+            workerGenerator->generate();
+            workerGenerators.push_back(workerGenerator);
+        }
+        generator = workerGenerators[0];
+    }
+    else if(vm.count("test")) {
         generator.reset(new cosmo::TestFftGaussianRandomFieldGenerator(power, spacing, nx, ny, nz));
     }
+    else if(batchSize > 1) {
+        batchedGenerator.reset(new cosmo::BatchedGaussianRandomFieldGenerator(
+            power, spacing, nx, ny, nz, std::min(batchSize,nfields)));
+        if(vm.count("counter-rng")) batchedGenerator->setCounterSeed(seed);
+        batchedGenerator->setNumThreads(nthreads);
+        batchedGenerator->setPlanStrategy(strategy);
+        generator = batchedGenerator;
+    }
     else {
-        generator.reset(new cosmo::FftGaussianRandomFieldGenerator(power, spacing, nx, ny, nz));
+        if(constrained) {
+            cosmo::ConstrainedGaussianRandomFieldGeneratorPtr constrainedGenerator(
+                new cosmo::ConstrainedGaussianRandomFieldGenerator(power, spacing, nx, ny, nz));
+            constrainedGenerator->setNumThreads(nthreads);
+            constrainedGenerator->constrainPeak(constrainSign*constrainNu);
+            fftGenerator = constrainedGenerator;
+        }
+        else {
+            fftGenerator.reset(new cosmo::FftGaussianRandomFieldGenerator(power, spacing, nx, ny, nz));
+            fftGenerator->setNumThreads(nthreads);
+        }
+        if(vm.count("counter-rng")) fftGenerator->setCounterSeed(seed);
+        fftGenerator->setPlanStrategy(strategy);
+        generator = fftGenerator;
+    }
+
+    // Create a peak stacker for each worker (or a single one for serial stacking).
+    std::vector<cosmo::GridPeakStackerPtr> stackers;
+    if(peaks) {
+        for(int worker = 0; worker < std::max(1,workers); ++worker) {
+            cosmo::GridPeakStackerPtr stacker(new cosmo::GridPeakStacker(nx, ny, nz));
+            if(0 == workers) {
+                stacker->setNumThreads(nthreads);
+            }
+            else {
+                // Create the FFTW plans now, since the planner is not thread safe.
+                stacker->stack(workerGenerators[worker]->getFieldView());
+            }
+            stackers.push_back(stacker);
+        }
     }
     if(verbose) {
+        std::size_t memorySize(generator->getMemorySize());
+        if(peaks) memorySize += stackers[0]->getMemorySize();
         std::cout << "Memory size = "
-            << boost::format("%.1f Mb") % (generator->getMemorySize()/1048576.) << std::endl;
+            << boost::format("%.1f Mb") % (memorySize*std::max(1,workers)/1048576.) << std::endl;
     }
 
-    // Initialize histogram
+    // Initialize histograms and extreme values of grfs
     double rmax(rmin + nbins*binsize);
-    boost::scoped_array<lk::WeightedAccumulator> xi(new lk::WeightedAccumulator[nbins]);
-    boost::scoped_array<lk::WeightedAccumulator> xi2d(new lk::WeightedAccumulator[nbins*nbins]);
-    // Collect extreme values of grfs
-    lk::WeightedAccumulator extremeValues;
+    StackAccumulator stack(nbins);
     // Line-of-sight direction
     double xparl(xlos/normlos), yparl(ylos/normlos), zparl(zlos/normlos);
 
@@ -162,101 +424,153 @@ int main(int argc, char **argv) {
             % xparl % yparl % zparl << std::endl;
     }
 
+    // The 1-d and 2-d histogram bins of each grid point only depend on its periodic offset
+    // (ox,oy,oz) from the extreme point, so look them up once for each offset, using -1
+    // for offsets outside the histogram.
+    std::size_t ngrid((std::size_t)nx*ny*nz);
+    std::vector<int> offsetBin(ngrid), offsetBin2d(ngrid);
+    for(int ox = 0; ox < nx; ++ox){
+        for(int oy = 0; oy < ny; ++oy){
+            for(int oz = 0; oz < nz; ++oz){
+                // Calculate distance from extreme value point on grid (wrap-around)
+                double dx(distance(ox,0,nx)), dy(distance(oy,0,ny)), dz(distance(oz,0,nz));
+                double dr(std::sqrt(dx*dx + dy*dy + dz*dz));
+                // Apply grid spacing
+                double r(spacing*dr);
+                double rparl(spacing*std::fabs(dx*xparl + dy*yparl + dz*zparl));
+                double rperp(std::sqrt(r*r-rparl*rparl));
+                std::size_t offset(oz + nz*(oy + (std::size_t)ny*ox));
+                offsetBin[offset] = offsetBin2d[offset] = -1;
+                if(r < rmax && r >= rmin) {
+                    offsetBin[offset] = std::min(nbins-1,(int)std::floor((r-rmin)/binsize));
+                }
+                if(rparl < rmax && rperp < rmax && rparl >= rmin && rperp >= rmin){
+                    offsetBin2d[offset] = std::min(nbins-1,(int)std::floor((rperp-rmin)/binsize))
+                        + nbins*std::min(nbins-1,(int)std::floor((rparl-rmin)/binsize));
+                }
+            }
+        }
+    }
+
     lk::RandomPtr random = lk::Random::instance();
     random->setSeed(seed);
 
-    for(int ifield = 0; ifield < nfields; ++ifield){
-        // Generate Gaussian random field
-        generator->generate();
-        double extremeValue(generator->getField(0,0,0));
-        std::vector<int> extremeIndex(3,0);
-        if(!fiducial) {
-            for(int ix = 0; ix < nx; ++ix){
-                for(int iy = 0; iy < ny; ++iy){
-                    for(int iz = 0; iz < nz; ++iz){
-                        double value = generator->getField(ix,iy,iz);
-                        if((minimum ? value < extremeValue : value > extremeValue)){
-                            extremeValue = value;
-                            extremeIndex[0] = ix;
-                            extremeIndex[1] = iy;
-                            extremeIndex[2] = iz;
-                        }
-                    }
+    // Stack on a fixed grid point, if requested, instead of searching each field.
+    int fixedPoint[3] = { 0, 0, 0 };
+    if(constrained) {
+        fixedPoint[0] = nx/2;
+        fixedPoint[1] = ny/2;
+        fixedPoint[2] = nz/2;
+    }
+    int const *fixedIndex = (fiducial || constrained) ? fixedPoint : 0;
+
+    // Process the fields in segments that end at each 10% checkpoint.
+    int segmentSize = (nfields > 10) ? nfields/10 : nfields;
+    for(int begin = 0; begin < nfields; begin += segmentSize) {
+        int end = std::min(begin + segmentSize, nfields);
+        if(0 == workers) {
+            for(int ifield = begin; ifield < end; ++ifield){
+                // Generate Gaussian random field
+                generator->generate();
+                if(peaks) {
+                    cosmo::GaussianRandomFieldView field(generator->getFieldView());
+                    stackers[0]->findPeaks(field,peakNu,maxPeaks,minimum);
+                    stackers[0]->stack(field);
+                    stack.accumulatePeaks(*stackers[0],offsetBin,offsetBin2d);
+                    continue;
                 }
+                int extremeIndex[3];
+                findStackPoint(*generator,fixedIndex,minimum,extremeIndex);
+                stack.accumulate(generator->getFieldView(),extremeIndex,offsetBin,offsetBin2d);
             }
         }
         else {
-            // extremeIndex[0] = random->getInteger(0,nx-1);
-            // extremeIndex[1] = random->getInteger(0,ny-1);
-            // extremeIndex[2] = random->getInteger(0,nz-1);
-            extremeIndex[0] = 0;
-            extremeIndex[1] = 0;
-            extremeIndex[2] = 0;
-        }
-        // Accumulate extreme value
-        extremeValues.accumulate(generator->getField(extremeIndex[0],extremeIndex[1],extremeIndex[2]));
-        // Fill 1-d, 2-d histograms
-        for(int ix = 0; ix < nx; ++ix){
-            for(int iy = 0; iy < ny; ++iy){
-                for(int iz = 0; iz < nz; ++iz){
-                    // Calculate distance from extreme value point on grid (wrap-around)
-                    double dx(distance(ix,extremeIndex[0],nx)), 
-                        dy(distance(iy,extremeIndex[1],ny)), 
-                        dz(distance(iz,extremeIndex[2],nz));
-                    //double dx(ix-extremeIndex[0]), dy(iy-extremeIndex[1]), dz(iz-extremeIndex[2]);
-                    double dr(std::sqrt(dx*dx + dy*dy + dz*dz));
-                    // Apply grid spacing
-                    double r(spacing*dr);
-                    double rparl(spacing*std::fabs(dx*xparl + dy*yparl + dz*zparl));
-                    double rperp(std::sqrt(r*r-rparl*rparl));
-                    // Look up field value
-                    double value(generator->getField(ix,iy,iz));
-                    // Accumulate value in appropriate bin
-                    if(r < rmax && r >= rmin) {
-                        xi[std::floor((r-rmin)/binsize)].accumulate(value);
-                    }
-                    if(rparl < rmax && rperp < rmax && rparl >= rmin && rperp >= rmin){
-                        xi2d[std::floor((rperp-rmin)/binsize)+nbins*std::floor((rparl-rmin)/binsize)].accumulate(value);
+            // Divide this segment into blocks of consecutive fields, independently of the number
+            // of workers. Each block is stacked separately by whichever worker takes it and the
+            // blocks are then added in order, so the results do not depend on the number of
+            // workers. Blocks are processed in waves to limit their memory.
+            int const fieldsPerBlock(16), blocksPerWave(64);
+            for(int wave = begin; wave < end; wave += fieldsPerBlock*blocksPerWave) {
+                int waveEnd = std::min(wave + fieldsPerBlock*blocksPerWave, end);
+                int nblocks = (waveEnd - wave + fieldsPerBlock - 1)/fieldsPerBlock;
+                std::vector<StackAccumulator> blocks(nblocks,StackAccumulator(nbins));
+#pragma omp parallel for schedule(dynamic) num_threads(workers)
+                for(int block = 0; block < nblocks; ++block) {
+#ifdef _OPENMP
+                    int worker = omp_get_thread_num();
+#else
+                    int worker = 0;
+#endif
+                    cosmo::FftGaussianRandomFieldGenerator &workerGenerator(*workerGenerators[worker]);
+                    int first = wave + block*fieldsPerBlock, last = std::min(first + fieldsPerBlock, waveEnd);
+                    for(int ifield = first; ifield < last; ++ifield) {
+                        // Each field uses its own random substream keyed by (seed,ifield).
+                        workerGenerator.setCounterSeed(seed,ifield);
+                        workerGenerator.generate();
+                        if(peaks) {
+                            cosmo::GaussianRandomFieldView field(workerGenerator.getFieldView());
+                            stackers[worker]->findPeaks(field,peakNu,maxPeaks,minimum);
+                            stackers[worker]->stack(field);
+                            blocks[block].accumulatePeaks(*stackers[worker],offsetBin,offsetBin2d);
+                            continue;
+                        }
+                        int extremeIndex[3];
+                        findStackPoint(workerGenerator,fixedIndex,minimum,extremeIndex);
+                        blocks[block].accumulate(workerGenerator.getFieldView(),extremeIndex,
+                            offsetBin,offsetBin2d);
                     }
                 }
+                for(int block = 0; block < nblocks; ++block) stack.add(blocks[block]);
             }
         }
-        if(nfields > 10 && (ifield+1) % (nfields/10) == 0) {
+        if(nfields > 10 && end % segmentSize == 0) {
             // Print status message in 10% intervals
             if(verbose) {
-                std::cout << "Generating " << ifield+1 << "..." << std::endl;
+                std::cout << "Generating " << end << "..." << std::endl;
             }
             // Save 1d stack to file every 10%
             if(snapshot) {
-                std::string outFilename((boost::format("%s.snap%d.1d.dat") % prefix % int((ifield+1.)/nfields*10)).str());
-                std::ofstream out(outFilename.c_str());
-                boost::format outFormat("%.2f %.10f %.10f %d");
-                for(int index = 0; index < nbins; ++index) {
-                    out << (outFormat % ((index+.5)*binsize+rmin)
-                        % xi[index].mean() % xi[index].variance() % xi[index].count()) << std::endl;
-                }
-                out.close();
+                saveStack1d((boost::format("%s.snap%d.1d.dat") % prefix % int((double)end/nfields*10)).str(),
+                    stack.xi,binsize,rmin);
             }
         }
     }
 
+    // Save the last field, if requested.
+    if(saveField.length() > 0) {
+        try {
+            if(workers > 0) {
+                // Regenerate the last field, which any worker might have generated.
+                workerGenerators[0]->setCounterSeed(seed,nfields-1);
+                workerGenerators[0]->generate();
+            }
+            generator->saveField(saveField,seed);
+        }
+        catch(std::exception const &e) {
+            std::cerr << "Error while saving field: " << e.what() << std::endl;
+        }
+    }
+
     // Print extreme value mean, variance, and count
     if(verbose) {
-        std::cout << boost::format("Extreme value mean, variance, count: %.6f %.6f %d")
-            % extremeValues.mean() % extremeValues.variance() % extremeValues.count() << std::endl;
+        if((fftGenerator || batchedGenerator) && 0 == workers) {
+            double randomTime, scaleTime, fftTime;
+            if(fftGenerator) {
+                fftGenerator->getTimings(randomTime,scaleTime,fftTime);
+            }
+            else {
+                batchedGenerator->getTimings(randomTime,scaleTime,fftTime);
+            }
+            std::cout << boost::format("Generation times (secs): random %.3f, scale %.3f, FFT %.3f")
+                % randomTime % scaleTime % fftTime << std::endl;
+        }
+        std::cout << boost::format(peaks ? "Peak value mean, variance, count: %.6f %.6f %d" :
+            "Extreme value mean, variance, count: %.6f %.6f %d")
+            % stack.extreme.mean(0) % stack.extreme.variance(0) % stack.extreme.count[0] << std::endl;
     }
 
     // Save 1d stack to file.
-    {
-        std::string outFilename(prefix+".1d.dat");
-        std::ofstream out(outFilename.c_str());
-        boost::format outFormat("%.2f %.10f %.10f %d");
-        for(int index = 0; index < nbins; ++index) {
-            out << (outFormat % ((index+.5)*binsize+rmin)
-                % xi[index].mean() % xi[index].variance() % xi[index].count()) << std::endl;
-        }
-        out.close();
-    } 
+    saveStack1d(prefix+".1d.dat",stack.xi,binsize,rmin);
 
     // Save 2d stack to file.
     {
@@ -265,7 +579,7 @@ int main(int argc, char **argv) {
         boost::format outFormat("%.2f %.2f %.10f %.10f %d");
         for(int index = 0; index < nbins*nbins; ++index) {
             out << (outFormat % ((index%nbins+.5)*binsize+rmin) % ((index/nbins+.5)*binsize+rmin)
-                % xi2d[index].mean() % xi2d[index].variance() % xi2d[index].count()) << std::endl;
+                % stack.xi2d.mean(index) % stack.xi2d.variance(index) % stack.xi2d.count[index]) << std::endl;
         }
         out.close();
     }
@@ -6,71 +6,580 @@
 
 #include "boost/program_options.hpp"
 #include "boost/format.hpp"
+#include "boost/smart_ptr.hpp"
 
 #include <iostream>
 #include <fstream>
 #include <cmath>
 #include <vector>
+#include <algorithm>
+#include <functional>
 
 namespace po = boost::program_options;
 namespace lk = likely;
 
+// Accumulates the weighted sums of d_i*d_j and the sums of weights w_i*w_j for pairs in each
+// bin of a 2D grid of (r,mu) or (rP,rT) separations. Optionally also accumulates these sums
+// for each subsample region, for jackknife and bootstrap covariance estimates.
+struct PairSums {
+    PairSums(lk::BinnedGrid const &grid_, bool rmu_, double x1min_, double x1max_,
+    double x2min_, double x2max_) : grid(&grid_), rmu(rmu_), x1min(x1min_), x1max(x1max_),
+    x2min(x2min_), x2max(x2max_), dsum(grid_.getNBinsTotal(),0.), wsum(grid_.getNBinsTotal(),0.),
+    separation(2), npair(0), nused(0), regions(0), nregions(0) { }
+    // Enables region sums using the region label in [0,nregions) of each point. For each
+    // region and bin, we store the sums over pairs with both points in the region, and half
+    // of the sums over pairs with one point in the region and the other outside it.
+    void setRegions(std::vector<int> const *labels, int nregions_) {
+        regions = labels;
+        nregions = nregions_;
+        regionDsum.assign(2*nregions*dsum.size(),0.);
+        regionWsum.assign(2*nregions*dsum.size(),0.);
+    }
+    // Adds the products of the pair (i,j) in the specified bin to our region sums.
+    void accumulateRegions(int i, int j, int index, double dprod, double wprod) {
+        int nbins(dsum.size()), ri((*regions)[i]), rj((*regions)[j]);
+        if(ri == rj) {
+            regionDsum[2*ri*nbins + index] += dprod;
+            regionWsum[2*ri*nbins + index] += wprod;
+        }
+        else {
+            regionDsum[(2*ri+1)*nbins + index] += dprod/2;
+            regionWsum[(2*ri+1)*nbins + index] += wprod/2;
+            regionDsum[(2*rj+1)*nbins + index] += dprod/2;
+            regionWsum[(2*rj+1)*nbins + index] += wprod/2;
+        }
+    }
+    // Resets all of our sums and pair counts to zero.
+    void reset() {
+        std::fill(dsum.begin(),dsum.end(),0.);
+        std::fill(wsum.begin(),wsum.end(),0.);
+        std::fill(regionDsum.begin(),regionDsum.end(),0.);
+        std::fill(regionWsum.begin(),regionWsum.end(),0.);
+        npair = nused = 0;
+    }
+    // Adds the pair (i,j) with separation (dx,dy,dz), values d and weights w.
+    void accumulate(int i, int j, double dx, double dy, double dz, double di, double wi,
+    double dj, double wj) {
+        if(rmu) {
+            separation[0] = std::sqrt(dx*dx+dy*dy+dz*dz);
+            separation[1] = std::fabs(dz/separation[0]);
+        }
+        else {
+            separation[0] = std::fabs(dz);
+            separation[1] = std::sqrt(dx*dx+dy*dy);
+        }
+        npair++;
+        if(separation[0] < x1min || separation[0] >= x1max) return;
+        if(separation[1] < x2min || separation[1] >= x2max) return;
+        try {
+            int index = grid->getIndex(separation);
+            double wgt = wi*wj;
+            dsum[index] += wgt*di*dj;
+            wsum[index] += wgt;
+            if(regions) accumulateRegions(i,j,index,wgt*di*dj,wgt);
+            nused++;
+        }
+        catch(lk::RuntimeError const &e) {
+            std::cerr << "no bin found for i,j = " << i << ',' << j << std::endl;
+        }
+    }
+    // Adds the sums and pair counts of another instance with the same binning.
+    void add(PairSums const &other) {
+        for(std::size_t index = 0; index < dsum.size(); ++index) {
+            dsum[index] += other.dsum[index];
+            wsum[index] += other.wsum[index];
+        }
+        for(std::size_t index = 0; index < regionDsum.size(); ++index) {
+            regionDsum[index] += other.regionDsum[index];
+            regionWsum[index] += other.regionWsum[index];
+        }
+        npair += other.npair;
+        nused += other.nused;
+    }
+    // Returns the weighted mean of d_i*d_j in each bin.
+    void getXi(std::vector<double> &xi) const {
+        std::vector<double> result(dsum);
+        for(int index = 0; index < (int)result.size(); ++index) {
+            if(wsum[index] > 0) result[index] /= wsum[index];
+        }
+        result.swap(xi);
+    }
+    lk::BinnedGrid const *grid;
+    bool rmu;
+    double x1min, x1max, x2min, x2max;
+    std::vector<double> dsum, wsum, separation;
+    long npair, nused;
+    std::vector<int> const *regions;
+    int nregions;
+    std::vector<double> regionDsum, regionWsum;
+};
+
+// Calculates the covariance of xi in each pair of bins from the specified samples, each of
+// which has one value per bin, and stores its upper triangle in row-major order.
+void getSampleCovariance(std::vector<std::vector<double> > const &samples, double scale,
+int nthreads, std::vector<double> &cov) {
+    int nsamples(samples.size()), nbins(samples[0].size());
+    std::vector<double> mean(nbins,0.);
+    for(int sample = 0; sample < nsamples; ++sample) {
+        for(int bin = 0; bin < nbins; ++bin) mean[bin] += samples[sample][bin];
+    }
+    for(int bin = 0; bin < nbins; ++bin) mean[bin] /= nsamples;
+    cov.assign((std::size_t)nbins*(nbins+1)/2,0.);
+#pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+    for(int row = 0; row < nbins; ++row) {
+        double *covRow = &cov[(std::size_t)row*nbins - (std::size_t)row*(row-1)/2 - row];
+        for(int sample = 0; sample < nsamples; ++sample) {
+            std::vector<double> const &xi(samples[sample]);
+            double drow(xi[row] - mean[row]);
+            for(int col = row; col < nbins; ++col) covRow[col] += drow*(xi[col] - mean[col]);
+        }
+        for(int col = row; col < nbins; ++col) covRow[col] *= scale;
+    }
+}
+
+// Calculates the delete-one jackknife covariance of xi, where each jackknife sample omits
+// every pair with either point in one region.
+void getJackknifeCovariance(PairSums const &sums, int nthreads, std::vector<double> &cov) {
+    int nbins(sums.dsum.size()), nregions(sums.nregions);
+    std::vector<std::vector<double> > samples(nregions,std::vector<double>(nbins,0.));
+    for(int region = 0; region < nregions; ++region) {
+        double const *within = &sums.regionDsum[2*region*nbins], *cross = within + nbins;
+        double const *wwithin = &sums.regionWsum[2*region*nbins], *wcross = wwithin + nbins;
+        for(int bin = 0; bin < nbins; ++bin) {
+            double dsum = sums.dsum[bin] - within[bin] - 2*cross[bin];
+            double wsum = sums.wsum[bin] - wwithin[bin] - 2*wcross[bin];
+            if(wsum > 0) samples[region][bin] = dsum/wsum;
+        }
+    }
+    getSampleCovariance(samples,(nregions-1)/(double)nregions,nthreads,cov);
+}
+
+// Calculates the bootstrap covariance of xi from the specified number of samples, each of
+// which draws nregions regions with replacement using counter-based random numbers keyed by
+// (seed,sample). The pairs between two different regions are weighted by the mean of their
+// multiplicities, so that only the region sums are needed.
+void getBootstrapCovariance(PairSums const &sums, int nsamples, boost::uint64_t seed, int nthreads,
+std::vector<double> &cov) {
+    int nbins(sums.dsum.size()), nregions(sums.nregions);
+    cosmo::PhiloxRandom random(seed);
+    std::vector<std::vector<double> > samples(nsamples,std::vector<double>(nbins,0.));
+    std::vector<int> multiplicity(nregions);
+    std::vector<double> dsum(nbins), wsum(nbins);
+    boost::uint32_t words[4];
+    for(int sample = 0; sample < nsamples; ++sample) {
+        std::fill(multiplicity.begin(),multiplicity.end(),0);
+        for(int draw = 0; draw < nregions; ++draw) {
+            random.getWords((boost::uint64_t)draw,(boost::uint64_t)sample,words);
+            multiplicity[words[0] % nregions]++;
+        }
+        std::fill(dsum.begin(),dsum.end(),0.);
+        std::fill(wsum.begin(),wsum.end(),0.);
+        for(int region = 0; region < nregions; ++region) {
+            int m(multiplicity[region]);
+            if(0 == m) continue;
+            double const *within = &sums.regionDsum[2*region*nbins], *cross = within + nbins;
+            double const *wwithin = &sums.regionWsum[2*region*nbins], *wcross = wwithin + nbins;
+            for(int bin = 0; bin < nbins; ++bin) {
+                dsum[bin] += m*(within[bin] + cross[bin]);
+                wsum[bin] += m*(wwithin[bin] + wcross[bin]);
+            }
+        }
+        for(int bin = 0; bin < nbins; ++bin) {
+            if(wsum[bin] > 0) samples[sample][bin] = dsum[bin]/wsum[bin];
+        }
+    }
+    getSampleCovariance(samples,1./(nsamples-1),nthreads,cov);
+}
+
+// Saves the non-zero elements of the upper triangle of a covariance matrix.
+void saveCovariance(std::string const &filename, std::vector<double> const &cov, int nbins) {
+    std::ofstream out(filename.c_str());
+    std::size_t offset(0);
+    for(int row = 0; row < nbins; ++row) {
+        for(int col = row; col < nbins; ++col) {
+            double value(cov[offset++]);
+            if(value != 0) out << row << ' ' << col << ' ' << boost::format("%.10g") % value << std::endl;
+        }
+    }
+    out.close();
+}
+
+// Assigns each point to one of nregions spatial regions with equal numbers of points, by
+// dividing the points into slabs along x and then each slab along y, with as close to equal
+// numbers of divisions along x and y as nregions allows. The line of sight is along z.
+void assignRegions(std::vector<std::vector<double> > const &columns, int nregions,
+std::vector<int> &labels) {
+    int n(columns[0].size());
+    int nx = (int)std::floor(std::sqrt((double)nregions));
+    while(nregions % nx) --nx;
+    int ny(nregions/nx);
+    std::vector<std::pair<double,int> > order(n);
+    for(int i = 0; i < n; ++i) order[i] = std::make_pair(columns[0][i],i);
+    std::sort(order.begin(),order.end());
+    labels.resize(n);
+    for(int slab = 0; slab < nx; ++slab) {
+        int begin = (int)(((long)n*slab)/nx), end = (int)(((long)n*(slab+1))/nx);
+        std::vector<std::pair<double,int> > slabOrder(end - begin);
+        for(int k = begin; k < end; ++k) {
+            int i(order[k].second);
+            slabOrder[k-begin] = std::make_pair(columns[1][i],i);
+        }
+        std::sort(slabOrder.begin(),slabOrder.end());
+        int size(slabOrder.size());
+        for(int k = 0; k < size; ++k) {
+            labels[slabOrder[k].second] = slab*ny + (int)(((long)k*ny)/size);
+        }
+    }
+}
+
+// Stores the x, y, z, d and w columns as separate arrays that are each aligned to 64 bytes,
+// for the SIMD pair kernel.
+class PointArrays {
+public:
+    PointArrays(std::vector<std::vector<double> > const &columns) : n(columns[0].size()) {
+        // Pad each array to a multiple of 8 doubles so that every array stays aligned.
+        std::size_t stride = (n + 7)/8*8;
+        _storage.resize(5*stride + 8);
+        double *base = &_storage[0];
+        base += (8 - ((std::size_t)base/sizeof(double)) % 8) % 8;
+        double *arrays[5];
+        for(int column = 0; column < 5; ++column) {
+            arrays[column] = base + column*stride;
+            std::copy(columns[column].begin(),columns[column].end(),arrays[column]);
+        }
+        x = arrays[0];
+        y = arrays[1];
+        z = arrays[2];
+        d = arrays[3];
+        w = arrays[4];
+    }
+    int n;
+    double const *x, *y, *z, *d, *w;
+private:
+    std::vector<double> _storage;
+    // Our pointers refer to our own storage, so we cannot be copied.
+    PointArrays(PointArrays const &);
+    PointArrays &operator=(PointArrays const &);
+};
+
+// Maps a block index k to the point index first + k.
+struct ContiguousIndex {
+    ContiguousIndex(int first_) : first(first_) { }
+    int operator[](int k) const { return first + k; }
+    int first;
+};
+
+// Accumulates pairs for a grid of two uniform binnings, without the generic binning lookup.
+// Pairs are processed in blocks of points j: a branch-free loop that the compiler can
+// vectorize first calculates the separations, the bin indices (by multiplying and
+// truncating) and the weighted products of every pair in the block, with pairs outside the
+// grid assigned zero products in bin 0, and a scalar loop then adds them to their bins in
+// j order. The sums are then identical to PairSums::accumulate, except that a separation
+// within rounding errors of a bin edge might be assigned to the neighbouring bin, and that
+// a compiler that contracts multiply-adds (e.g. with -march=native) may round differently.
+class UniformPairKernel {
+public:
+    // Returns true if the binning has equal-width contiguous bins and sets its first low
+    // edge and the inverse of its bin width.
+    static bool isUniform(lk::AbsBinningCPtr bins, double &min, double &inverseWidth) {
+        int nbins(bins->getNBins());
+        min = bins->getBinLowEdge(0);
+        double max(bins->getBinHighEdge(nbins-1)), width((max - min)/nbins);
+        double tolerance(1e-12*std::max(std::fabs(min),std::fabs(max)));
+        for(int bin = 0; bin < nbins; ++bin) {
+            if(std::fabs(bins->getBinLowEdge(bin) - (min + bin*width)) > tolerance) return false;
+            if(std::fabs(bins->getBinHighEdge(bin) - (min + (bin+1)*width)) > tolerance) return false;
+        }
+        inverseWidth = 1/width;
+        return true;
+    }
+    // Creates a kernel for the specified grid, whose binnings must both be uniform.
+    UniformPairKernel(lk::BinnedGrid const &grid, lk::AbsBinningCPtr bins1, lk::AbsBinningCPtr bins2,
+    bool rmu) : _rmu(rmu) {
+        if(!isUniform(bins1,_min1,_inverse1) || !isUniform(bins2,_min2,_inverse2)) {
+            throw lk::RuntimeError("UniformPairKernel: binnings are not uniform.");
+        }
+        _n1 = bins1->getNBins();
+        _n2 = bins2->getNBins();
+        _max1 = bins1->getBinHighEdge(_n1-1);
+        _max2 = bins2->getBinHighEdge(_n2-1);
+        // Find the global index strides of each axis from the grid itself.
+        std::vector<double> center(2);
+        center[0] = (bins1->getBinLowEdge(0) + bins1->getBinHighEdge(0))/2;
+        center[1] = (bins2->getBinLowEdge(0) + bins2->getBinHighEdge(0))/2;
+        _offset = grid.getIndex(center);
+        _stride1 = _stride2 = 0;
+        if(_n1 > 1) {
+            center[0] = (bins1->getBinLowEdge(1) + bins1->getBinHighEdge(1))/2;
+            _stride1 = grid.getIndex(center) - _offset;
+            center[0] = (bins1->getBinLowEdge(0) + bins1->getBinHighEdge(0))/2;
+        }
+        if(_n2 > 1) {
+            center[1] = (bins2->getBinLowEdge(1) + bins2->getBinHighEdge(1))/2;
+            _stride2 = grid.getIndex(center) - _offset;
+        }
+    }
+    // Accumulates the pairs (i,index[k]) for k = 0,...,count-1.
+    template <class Index> void accumulate(PointArrays const &points, int i, Index index, int count,
+    PairSums &sums) const {
+        if(_rmu) {
+            _accumulate<Index,true>(points,i,index,count,sums);
+        }
+        else {
+            _accumulate<Index,false>(points,i,index,count,sums);
+        }
+    }
+private:
+    enum { BlockSize = 256 };
+    bool _rmu;
+    int _n1, _n2, _offset, _stride1, _stride2;
+    double _min1, _max1, _inverse1, _min2, _max2, _inverse2;
+    template <class Index, bool Rmu> void _accumulate(PointArrays const &points, int i, Index index,
+    int count, PairSums &sums) const {
+        double const *x(points.x), *y(points.y), *z(points.z), *d(points.d), *w(points.w);
+        double xi(x[i]), yi(y[i]), zi(z[i]), di(d[i]), wi(w[i]);
+        int bin[BlockSize], pair[BlockSize];
+        double dprod[BlockSize], wprod[BlockSize];
+        for(int block = 0; block < count; block += BlockSize) {
+            int size = std::min((int)BlockSize,count - block);
+            long nused(0);
+#if defined(_OPENMP) && _OPENMP >= 201307
+#pragma omp simd reduction(+:nused)
+#endif
+            for(int k = 0; k < size; ++k) {
+                int j = index[block + k];
+                double dx = xi - x[j], dy = yi - y[j], dz = zi - z[j];
+                double s1, s2;
+                if(Rmu) {
+                    s1 = std::sqrt(dx*dx+dy*dy+dz*dz);
+                    s2 = std::fabs(dz/s1);
+                }
+                else {
+                    s1 = std::fabs(dz);
+                    s2 = std::sqrt(dx*dx+dy*dy);
+                }
+                // This is false for a NaN separation.
+                bool inside = (s1 >= _min1 && s1 < _max1 && s2 >= _min2 && s2 < _max2);
+                int i1 = (int)((inside ? s1 - _min1 : 0)*_inverse1);
+                int i2 = (int)((inside ? s2 - _min2 : 0)*_inverse2);
+                i1 = i1 < _n1 ? i1 : _n1-1;
+                i2 = i2 < _n2 ? i2 : _n2-1;
+                double wgt = wi*w[j];
+                pair[k] = j;
+                bin[k] = inside ? _offset + i1*_stride1 + i2*_stride2 : 0;
+                dprod[k] = inside ? wgt*di*d[j] : 0;
+                wprod[k] = inside ? wgt : 0;
+                nused += inside ? 1 : 0;
+            }
+            double *dsum = &sums.dsum[0], *wsum = &sums.wsum[0];
+            for(int k = 0; k < size; ++k) {
+                dsum[bin[k]] += dprod[k];
+                wsum[bin[k]] += wprod[k];
+            }
+            if(sums.regions) {
+                for(int k = 0; k < size; ++k) {
+                    if(wprod[k] != 0 || dprod[k] != 0) sums.accumulateRegions(i,pair[k],bin[k],dprod[k],wprod[k]);
+                }
+            }
+            sums.npair += size;
+            sums.nused += nused;
+        }
+    }
+};
+
 // Brute force timing for 2M pairs in DR9-like volume:
 // used -603397146 of -1455759936 pairs.
 // 29805.930u 18.906s 8:17:02.56 100.0%    0+0k 0+4io 0pf+0w
-void bruteForce(std::vector<std::vector<double> > const &columns, lk::BinnedGrid const &grid, bool rmu,
-double x1min, double x1max, double x2min, double x2max, std::vector<double> &xi) {
-    // create internal accumulation vectors
-    int nbins = grid.getNBinsTotal();
-    std::vector<double> dsum(nbins,0.), wsum(nbins,0.);
-    // Do a brute force loop over all pairs
+// Accumulates all pairs (i,j>i) with i in [begin,end), using the SIMD kernel if one is provided.
+void bruteForce(std::vector<std::vector<double> > const &columns, PointArrays const &points,
+UniformPairKernel const *kernel, int begin, int end, PairSums &sums) {
     int n(columns[0].size());
-    long npair(0), nused(0);
-    std::vector<double> separation(2);
-    for(int i = 0; i < n-1; ++i) {
+    for(int i = begin; i < end; ++i) {
+        if(kernel) {
+            kernel->accumulate(points,i,ContiguousIndex(i+1),n-i-1,sums);
+            continue;
+        }
         double xi = columns[0][i];
         double yi = columns[1][i];
         double zi = columns[2][i];
         double di = columns[3][i];
         double wi = columns[4][i];
         for(int j = i+1; j < n; ++j) {
-            double dx = xi - columns[0][j];
-            double dy = yi - columns[1][j];
-            double dz = zi - columns[2][j];
-            if(rmu) {
-                separation[0] = std::sqrt(dx*dx+dy*dy+dz*dz);
-                separation[1] = std::fabs(dz/separation[0]);
+            sums.accumulate(i,j,xi - columns[0][j],yi - columns[1][j],zi - columns[2][j],
+                di,wi,columns[3][j],columns[4][j]);
+        }
+    }
+}
+
+// Sorts points into a grid of cells whose sides are at least the largest separation that
+// can be binned along each axis, so that only pairs in the same or adjacent cells need to
+// be considered. The points of each cell are listed in increasing index order.
+struct CellList {
+    CellList(std::vector<std::vector<double> > const &columns, double const side[3]) {
+        int n(columns[0].size());
+        // Use at most about 8n cells in total, to limit our memory.
+        int maxCells = std::max(1,(int)std::ceil(2*std::pow((double)n,1./3.)));
+        ncells = 1;
+        for(int axis = 0; axis < 3; ++axis) {
+            std::vector<double> const &values(columns[axis]);
+            lo[axis] = n > 0 ? *std::min_element(values.begin(),values.end()) : 0;
+            double hi = n > 0 ? *std::max_element(values.begin(),values.end()) : 0;
+            // Round down, with a small margin for rounding errors, so that each cell is at
+            // least as large as requested.
+            ncell[axis] = (side[axis] > 0) ? (int)std::floor((hi - lo[axis])/(side[axis]*(1+1e-9))) : 1;
+            ncell[axis] = std::max(1,std::min(maxCells,ncell[axis]));
+            scale[axis] = (hi > lo[axis]) ? ncell[axis]/(hi - lo[axis]) : 0;
+            ncells *= ncell[axis];
+        }
+        // Assign each point to a cell and sort the points by cell with a stable counting sort.
+        pointCell.resize(n);
+        start.assign(ncells+1,0);
+        for(int i = 0; i < n; ++i) {
+            int cell(0);
+            for(int axis = 0; axis < 3; ++axis) {
+                int c = std::min(ncell[axis]-1,(int)((columns[axis][i] - lo[axis])*scale[axis]));
+                cell = cell*ncell[axis] + c;
+            }
+            pointCell[i] = cell;
+            start[cell+1]++;
+        }
+        for(int cell = 0; cell < ncells; ++cell) start[cell+1] += start[cell];
+        points.resize(n);
+        std::vector<int> next(start.begin(),start.end()-1);
+        for(int i = 0; i < n; ++i) points[next[pointCell[i]]++] = i;
+    }
+    // Appends the indices j > i of the points in the cells adjacent to the cell of point i,
+    // including its own cell, in increasing order.
+    void getNeighbors(int i, std::vector<int> &neighbors) const {
+        neighbors.clear();
+        // Each cell list is sorted, so skip its indices <= i with a binary search and then
+        // merge the remaining ranges of the (at most 27) cells with a min-heap of their
+        // next indices.
+        std::pair<int,int> heap[27];
+        int const *next[27], *last[27];
+        int nranges(0);
+        int cell(pointCell[i]);
+        int cz(cell % ncell[2]), cy((cell/ncell[2]) % ncell[1]), cx(cell/(ncell[2]*ncell[1]));
+        for(int jx = std::max(0,cx-1); jx <= std::min(ncell[0]-1,cx+1); ++jx) {
+            for(int jy = std::max(0,cy-1); jy <= std::min(ncell[1]-1,cy+1); ++jy) {
+                for(int jz = std::max(0,cz-1); jz <= std::min(ncell[2]-1,cz+1); ++jz) {
+                    int other((jx*ncell[1] + jy)*ncell[2] + jz);
+                    int const *first(&points[0] + start[other]), *end(&points[0] + start[other+1]);
+                    first = std::upper_bound(first,end,i);
+                    if(first == end) continue;
+                    next[nranges] = first;
+                    last[nranges] = end;
+                    heap[nranges] = std::make_pair(*first,nranges);
+                    ++nranges;
+                }
+            }
+        }
+        std::greater<std::pair<int,int> > later;
+        std::make_heap(heap,heap+nranges,later);
+        while(nranges > 0) {
+            std::pop_heap(heap,heap+nranges,later);
+            std::pair<int,int> &top(heap[nranges-1]);
+            neighbors.push_back(top.first);
+            if(++next[top.second] != last[top.second]) {
+                top.first = *next[top.second];
+                std::push_heap(heap,heap+nranges,later);
             }
             else {
-                separation[0] = std::fabs(dz);
-                separation[1] = std::sqrt(dx*dx+dy*dy);
+                --nranges;
             }
-            npair++;
-            if(separation[0] < x1min || separation[0] >= x1max) continue;
-            if(separation[1] < x2min || separation[1] >= x2max) continue;
-            try {
-                int index = grid.getIndex(separation);
-                double wgt = wi*columns[4][j];
-                dsum[index] += wgt*di*columns[3][j];
-                wsum[index] += wgt;
-                nused++;
+        }
+    }
+    int ncell[3], ncells;
+    double lo[3], scale[3];
+    std::vector<int> pointCell, start, points;
+};
+
+// Accumulates the pairs (i,j>i) with i in [begin,end) that are in adjacent cells of a cell
+// list, visiting each point's pairs in increasing j order, so that the results are identical
+// to bruteForce(). Uses the SIMD kernel if one is provided.
+void cellList(std::vector<std::vector<double> > const &columns, PointArrays const &points,
+UniformPairKernel const *kernel, CellList const &cells, int begin, int end, PairSums &sums) {
+    std::vector<int> neighbors;
+    for(int i = begin; i < end; ++i) {
+        cells.getNeighbors(i,neighbors);
+        if(kernel) {
+            if(!neighbors.empty()) kernel->accumulate(points,i,&neighbors[0],(int)neighbors.size(),sums);
+            continue;
+        }
+        double xi = columns[0][i];
+        double yi = columns[1][i];
+        double zi = columns[2][i];
+        double di = columns[3][i];
+        double wi = columns[4][i];
+        for(std::vector<int>::const_iterator iter = neighbors.begin(); iter != neighbors.end(); ++iter) {
+            int j(*iter);
+            sums.accumulate(i,j,xi - columns[0][j],yi - columns[1][j],zi - columns[2][j],
+                di,wi,columns[3][j],columns[4][j]);
+        }
+    }
+}
+
+// Estimates xi in each bin with the brute-force or cell-list pair loop. The first points i
+// of each pair are divided into a fixed number of chunks, independently of the number of
+// threads, which are handed out dynamically to threads so that dense regions do not stall
+// them. Each chunk has its own sums and the chunks are then added in order, so the results
+// are bit-reproducible for any number of threads. The pairs are added to the specified sums,
+// which should initially be zero and determine whether region sums are accumulated.
+void estimate(std::vector<std::vector<double> > const &columns, bool rmu, double x1max, double x2max,
+bool useBruteForce, UniformPairKernel const *kernel, int nthreads, PairSums &sums) {
+    double start(cosmo::getWallTime());
+    PointArrays points(columns);
+    boost::scoped_ptr<CellList> cells;
+    if(!useBruteForce) {
+        // The largest separation along each axis that can be binned.
+        double side[3];
+        if(rmu) {
+            side[0] = side[1] = side[2] = x1max;
+        }
+        else {
+            side[0] = side[1] = x2max;
+            side[2] = x1max;
+        }
+        cells.reset(new CellList(columns,side));
+    }
+    int n(columns[0].size());
+    int nchunks = std::max(1,std::min(256,n-1));
+    // Region sums make each chunk's sums nregions times larger, so we then only keep a
+    // limited wave of chunks in memory at once. This does not change the order of additions.
+    int wave = sums.regions ? std::min(nchunks,4*nthreads) : nchunks;
+    std::vector<PairSums> chunkSums(wave,sums);
+    for(int first = 0; first < nchunks; first += wave) {
+        int last = std::min(nchunks,first + wave);
+#pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+        for(int chunk = first; chunk < last; ++chunk) {
+            int begin = (int)(((long)(n-1)*chunk)/nchunks), end = (int)(((long)(n-1)*(chunk+1))/nchunks);
+            PairSums &chunkSum(chunkSums[chunk - first]);
+            chunkSum.reset();
+            if(useBruteForce) {
+                bruteForce(columns,points,kernel,begin,end,chunkSum);
             }
-            catch(lk::RuntimeError const &e) {
-                std::cerr << "no bin found for i,j = " << i << ',' << j << std::endl;
+            else {
+                cellList(columns,points,kernel,*cells,begin,end,chunkSum);
             }
         }
+        for(int chunk = first; chunk < last; ++chunk) sums.add(chunkSums[chunk - first]);
     }
-    std::cout << "used " << nused << " of " << npair << " pairs." << std::endl;
-    for(int index = 0; index < nbins; ++index) {
-        if(wsum[index] > 0) dsum[index] /= wsum[index];
+    double elapsed(cosmo::getWallTime() - start);
+    std::cout << "used " << sums.nused << " of " << sums.npair << " pairs";
+    if(cells) {
+        std::cout << " tested in " << cells->ncell[0] << 'x' << cells->ncell[1] << 'x'
+            << cells->ncell[2] << " cells";
     }
-    dsum.swap(xi);
+    std::cout << boost::format(" in %.3f secs (%.3g pairs/sec) using %d threads%s.")
+        % elapsed % (elapsed > 0 ? sums.npair/elapsed : 0.) % nthreads
+        % (kernel ? " and the uniform-bin kernel" : "") << std::endl;
 }
 
 int main(int argc, char **argv) {
     
     // Configure command-line option processing
-    std::string infile,outfile,axis1,axis2;
+    std::string infile,outfile,axis1,axis2,jackknifeFile,bootstrapFile;
+    int nthreads,nregions,nbootstrap,bootstrapSeed;
     po::options_description cli("Correlation function estimator");
     cli.add_options()
         ("help,h", "Prints this info and exits.")
@@ -84,6 +593,21 @@ int main(int argc, char **argv) {
         ("axis2", po::value<std::string>(&axis2)->default_value("[0:200]*50"),
             "Axis-2 binning")
         ("rmu", "Use (r,mu) binning instead of (rP,rT) binning")
+        ("brute-force", "Loop over all pairs instead of using a cell list, for validation")
+        ("threads", po::value<int>(&nthreads)->default_value(1),
+            "Number of threads to use for pair counting")
+        ("scalar", "Use the generic binning lookup even when both binnings are uniform, for validation")
+        ("regions", po::value<int>(&nregions)->default_value(0),
+            "Number of equal-count x-y regions to use as subsamples for covariance estimates")
+        ("region-column", "Read an integer subsample label for each point from a sixth input column")
+        ("jackknife", po::value<std::string>(&jackknifeFile)->default_value(""),
+            "Filename to write the jackknife covariance of xi to")
+        ("bootstrap", po::value<std::string>(&bootstrapFile)->default_value(""),
+            "Filename to write the bootstrap covariance of xi to")
+        ("nbootstrap", po::value<int>(&nbootstrap)->default_value(1000),
+            "Number of bootstrap samples to use")
+        ("bootstrap-seed", po::value<int>(&bootstrapSeed)->default_value(1),
+            "Random seed to use for bootstrap samples")
         ;
 
     // do the command line parsing now
@@ -100,14 +624,31 @@ int main(int argc, char **argv) {
         std::cout << cli << std::endl;
         return 1;
     }
-    bool verbose(vm.count("verbose")),rmu(vm.count("rmu"));
+    bool verbose(vm.count("verbose")),rmu(vm.count("rmu")),useBruteForce(vm.count("brute-force"));
+    if(nthreads <= 0) {
+        std::cerr << "threads must be > 0" << std::endl;
+        return -2;
+    }
+    bool useRegionColumn(vm.count("region-column")), useCovariance(jackknifeFile.length() > 0 || bootstrapFile.length() > 0);
+    if(nregions < 0 || (nregions > 0 && useRegionColumn)) {
+        std::cerr << "regions must be >= 0 and cannot be used with region-column" << std::endl;
+        return -2;
+    }
+    if(useCovariance != (nregions > 0 || useRegionColumn)) {
+        std::cerr << "jackknife or bootstrap requires regions or region-column, and vice versa" << std::endl;
+        return -2;
+    }
+    if(bootstrapFile.length() > 0 && nbootstrap < 2) {
+        std::cerr << "nbootstrap must be > 1" << std::endl;
+        return -2;
+    }
 
     // Read the input file
     if(0 == infile.length()) {
         std::cerr << "Missing infile parameter." << std::endl;
         return -2;
     }
-    std::vector<std::vector<double> > columns(5);
+    std::vector<std::vector<double> > columns(useRegionColumn ? 6 : 5);
     try {
         std::ifstream in(infile.c_str());
         lk::readVectors(in,columns);
@@ -122,14 +663,52 @@ int main(int argc, char **argv) {
             << std::endl;
     }
 
+    // Assign each point to a subsample region, renumbering any labels read as 0,1,...
+    std::vector<int> regions;
+    if(useRegionColumn) {
+        std::vector<double> labels(columns[5]);
+        std::sort(labels.begin(),labels.end());
+        labels.erase(std::unique(labels.begin(),labels.end()),labels.end());
+        regions.resize(columns[5].size());
+        for(std::size_t i = 0; i < regions.size(); ++i) {
+            regions[i] = std::lower_bound(labels.begin(),labels.end(),columns[5][i]) - labels.begin();
+        }
+        nregions = labels.size();
+        columns.pop_back();
+    }
+    else if(nregions > 0) {
+        assignRegions(columns,nregions,regions);
+    }
+    if(useCovariance && nregions < 2) {
+        std::cerr << "Need at least 2 regions for covariance estimates." << std::endl;
+        return -2;
+    }
+    if(verbose && useCovariance) {
+        std::cout << "Using " << nregions << " subsample regions." << std::endl;
+    }
+
     // Generate the correlation function grid and run the estimator
-    std::vector<double> xi;
+    std::vector<double> xi, jackknifeCov, bootstrapCov;
     try {
         lk::AbsBinningCPtr bins1 = lk::createBinning(axis1), bins2 = lk::createBinning(axis2);
         double x1min(bins1->getBinLowEdge(0)), x1max(bins1->getBinHighEdge(bins1->getNBins()-1));
         double x2min(bins2->getBinLowEdge(0)), x2max(bins2->getBinHighEdge(bins2->getNBins()-1));
         lk::BinnedGrid grid(bins1,bins2);
-        bruteForce(columns,grid,rmu,x1min,x1max,x2min,x2max,xi);
+        // Use the SIMD kernel when both binnings are uniform, unless asked not to.
+        boost::scoped_ptr<UniformPairKernel> kernel;
+        double min, inverseWidth;
+        if(!vm.count("scalar") && UniformPairKernel::isUniform(bins1,min,inverseWidth) &&
+        UniformPairKernel::isUniform(bins2,min,inverseWidth)) {
+            kernel.reset(new UniformPairKernel(grid,bins1,bins2,rmu));
+        }
+        PairSums sums(grid,rmu,x1min,x1max,x2min,x2max);
+        if(useCovariance) sums.setRegions(&regions,nregions);
+        estimate(columns,rmu,x1max,x2max,useBruteForce,kernel.get(),nthreads,sums);
+        sums.getXi(xi);
+        if(jackknifeFile.length() > 0) getJackknifeCovariance(sums,nthreads,jackknifeCov);
+        if(bootstrapFile.length() > 0) {
+            getBootstrapCovariance(sums,nbootstrap,(boost::uint64_t)bootstrapSeed,nthreads,bootstrapCov);
+        }
     }
     catch(std::exception const &e) {
         std::cerr << "Error while running the estimator: " << e.what() << std::endl;
@@ -142,6 +721,8 @@ int main(int argc, char **argv) {
             out << index << ' ' << xi[index] << std::endl;
         }
         out.close();
+        if(!jackknifeCov.empty()) saveCovariance(jackknifeFile,jackknifeCov,xi.size());
+        if(!bootstrapCov.empty()) saveCovariance(bootstrapFile,bootstrapCov,xi.size());
     }
     catch(std::exception const &e) {
         std::cerr << "Error while saving results: " << e.what() << std::endl;